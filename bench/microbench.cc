@@ -0,0 +1,474 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Microbenchmarks of the containers and kernels that dominate kapar's run
+ * time.  Inputs are synthetic, but shaped like those seen by loadTraces:
+ * interfaces appear in traces with a skewed popularity, so most TraceIDSets
+ * are small and a minority are large, and most interfaces have only one or
+ * two distinct previous hops.
+ *
+ * Output is one tab-separated line per benchmark, after a "#" header line:
+ *   name  ops  ns_per_op  mops_per_sec  extra
+ * where ops is the number of operations timed in one repetition, the times
+ * are from the fastest of the repetitions, and extra is a list of
+ * "key=value" statistics about the inputs or results.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../lib/config.h"
+#include "../lib/ip4addr.h"
+#include "../lib/ivector.h"
+#include "../lib/Pool.h"
+#include "../lib/infile.h"
+#include "../lib/NetPrefix.h"
+#include "../lib/PathSeg.h"
+#include "../lib/CompactIDSet.h"
+#include "../lib/AnonSeg.h"
+
+using namespace std;
+
+static double cfg_scale = 1.0;	// multiplier for number of operations
+static int cfg_reps = 5;	// repetitions of each benchmark
+static volatile uint64_t sink;	// consumes results so they aren't optimized away
+
+// Small, fast generator, so inputs are the same on every platform.
+class Rand {
+    uint64_t s;
+public:
+    explicit Rand(uint64_t seed) : s(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+    uint32_t next() { s ^= s << 13; s ^= s >> 7; s ^= s << 17; return uint32_t(s >> 16); }
+    // uniform in [0, n)
+    uint32_t below(uint32_t n) { return uint32_t((uint64_t(next()) * n) >> 32); }
+    double real() { return next() / 4294967296.0; }
+    // in [0, n), skewed toward 0 like interface popularity
+    uint32_t skewed(uint32_t n) { double u = real(); return uint32_t(n * u * u * u * u); }
+};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t scaled(size_t n) { return max(size_t(1), size_t(n * cfg_scale)); }
+
+// Result of one repetition of a benchmark.
+struct Result {
+    uint64_t ops;	// number of operations timed
+    double sec;		// time taken by the operations
+    string extra;	// "key=value ..." statistics
+    uint64_t check;	// value computed from results, so they can't be elided
+    Result() : ops(0), sec(0), extra(), check(0) {}
+};
+
+// Interfaces and traces of a simulated loadTraces run.  Traces are grouped
+// by monitor, as they are in input files, and the first few hops of each
+// trace are drawn from a small set of interfaces near its monitor, so those
+// interfaces see long runs of nearby trace ids.  The remaining hops are drawn
+// from all interfaces with a skewed popularity.  Each trace visits HOPS
+// distinct interfaces.
+struct TraceSim {
+    static const int HOPS = 12;
+    static const int NEAR_HOPS = 3;	// hops drawn from the monitor's set
+    static const int NEAR_IFACES = 16;	// size of each monitor's set
+    static const int MONITORS = 20;
+    size_t n_ifaces, n_traces;
+    vector<uint32_t> hops;	// n_traces * HOPS interface indexes
+    TraceSim(size_t ifaces, size_t traces, uint64_t seed) :
+	n_ifaces(ifaces), n_traces(traces), hops(traces * HOPS)
+    {
+	Rand rnd(seed);
+	uint32_t n_near = MONITORS * NEAR_IFACES;
+	uint32_t n_far = uint32_t(n_ifaces) - n_near;
+	for (size_t t = 0; t < n_traces; ++t) {
+	    uint32_t mon = uint32_t(t * MONITORS / n_traces);
+	    uint32_t *h = &hops[t * HOPS];
+	    for (int i = 0; i < HOPS; ++i) {
+		// distinct within a trace, like a loop-free trace
+		do {
+		    h[i] = i < NEAR_HOPS ?
+			mon * NEAR_IFACES + rnd.skewed(NEAR_IFACES) :
+			n_near + rnd.skewed(n_far);
+		} while (find(h, h + i, h[i]) != h + i);
+	    }
+	}
+    }
+    void fill(vector<CompactIDSet> &sets) const {
+	for (size_t t = 0; t < n_traces; ++t) {
+	    const uint32_t *h = &hops[t * HOPS];
+	    for (int i = 0; i < HOPS; ++i)
+		sets[h[i]].append(TraceID(t + 1));
+	}
+    }
+};
+
+static string histogram(const vector<CompactIDSet> &sets)
+{
+    uint64_t hist[5] = {0,0,0,0,0};
+    for (size_t i = 0; i < sets.size(); ++i)
+	hist[min(sets[i].rawsize(), 4u)]++;
+    ostringstream out;
+    out << "rawsize0=" << hist[0] << " rawsize1=" << hist[1] <<
+	" rawsize2=" << hist[2] << " rawsize3=" << hist[3] <<
+	" rawsize>3=" << hist[4];
+    return out.str();
+}
+
+static void benchIDSetAppend(Result &r)
+{
+    static const TraceSim sim(scaled(200000), scaled(100000), 1);
+    vector<CompactIDSet> sets(sim.n_ifaces);
+    double start = now();
+    sim.fill(sets);
+    r.sec = now() - start;
+    r.ops = sim.n_traces * TraceSim::HOPS;
+    int64_t size = int64_t(r.ops), slots = 0;
+    for (size_t i = 0; i < sets.size(); ++i)
+	slots += sets[i].rawsize();
+    ostringstream out;
+    out << "slots_per_id=" << double(slots) / double(size) << " " << histogram(sets);
+    r.extra = out.str();
+    for (size_t i = 0; i < sets.size(); ++i) {
+	r.check += sets[i].rawsize();
+	sets[i].free();
+    }
+}
+
+static void benchIDSetOverlaps(Result &r)
+{
+    static const TraceSim sim(scaled(200000), scaled(100000), 2);
+    vector<CompactIDSet> sets(sim.n_ifaces);
+    sim.fill(sets);
+    // pairs of interfaces chosen like the candidate alias pairs:  both are
+    // usually popular enough to be seen in several traces
+    size_t n_pairs = scaled(1000000);
+    vector<pair<uint32_t,uint32_t> > pairs(n_pairs);
+    Rand rnd(3);
+    for (size_t i = 0; i < n_pairs; ++i) {
+	uint32_t a, b;
+	do { a = rnd.skewed(uint32_t(sets.size())); } while (sets[a].empty());
+	do { b = rnd.skewed(uint32_t(sets.size())); } while (sets[b].empty() || b == a);
+	pairs[i] = make_pair(a, b);
+    }
+    double start = now();
+    uint64_t n_overlap = 0;
+    for (size_t i = 0; i < n_pairs; ++i)
+	n_overlap += sets[pairs[i].first].overlaps(sets[pairs[i].second]);
+    r.sec = now() - start;
+    r.ops = n_pairs;
+    r.check = n_overlap;
+    ostringstream out;
+    out << "overlap_fraction=" << double(n_overlap) / double(n_pairs);
+    r.extra = out.str();
+    for (size_t i = 0; i < sets.size(); ++i)
+	sets[i].free();
+}
+
+// Named addresses only, so plain address order is the same as kapar's.
+template <int N>
+struct seg_less {
+    bool operator()(const PathSeg<N> &a, const PathSeg<N> &b) const {
+	return a.hop(0) != b.hop(0) ? a.hop(0) < b.hop(0) :
+	    N > 1 && a.hop(1) < b.hop(1);
+    }
+};
+
+// Sorted insertion of unique previous-hop segments, as in NamedIface.prev.
+static void benchIvectorInsert(Result &r)
+{
+    size_t n_ifaces = scaled(100000);
+    size_t n_keys = n_ifaces * 4;
+    // The number of distinct prev segments of an iface is 1 or 2 for most
+    // ifaces, and large for a few; keys are looked up many times.
+    vector<uint32_t> owner(n_keys);
+    vector<PathSeg<2> > keys;
+    keys.reserve(n_keys);
+    Rand rnd(4);
+    for (size_t i = 0; i < n_keys; ++i) {
+	owner[i] = rnd.skewed(uint32_t(n_ifaces));
+	keys.push_back(PathSeg<2>(ip4addr_t(rnd.below(64) + 1),
+	    ip4addr_t(rnd.below(8) + 1)));
+    }
+    vector<PathSegVec<2> > prev(n_ifaces);
+    uint64_t n_inserted = 0;
+    double start = now();
+    for (size_t i = 0; i < n_keys; ++i) {
+	PathSegVec<2> &v = prev[owner[i]];
+	PathSegVec<2>::iterator it = lower_bound(v.begin(), v.end(), keys[i],
+	    seg_less<2>());
+	if (it == v.end() || *it != keys[i]) {
+	    v.insert(it, keys[i]);
+	    ++n_inserted;
+	}
+    }
+    r.sec = now() - start;
+    r.ops = n_keys;
+    uint64_t mem = 0;
+    for (size_t i = 0; i < n_ifaces; ++i) {
+	mem += prev[i].memory();
+	prev[i].free();
+    }
+    r.check = n_inserted;
+    ostringstream out;
+    out << "inserted=" << n_inserted << " eff=" <<
+	double(n_inserted) * sizeof(PathSeg<2>) / double(mem);
+    r.extra = out.str();
+}
+
+// Growth of ivectors by push_back, through the local and dynamic storage.
+static void benchIvectorPushBack(Result &r)
+{
+    size_t n_vecs = scaled(100000);
+    vector<uint32_t> sizes(n_vecs);
+    Rand rnd(5);
+    uint64_t total = 0;
+    for (size_t i = 0; i < n_vecs; ++i)
+	total += sizes[i] = 1 + rnd.skewed(64);
+    vector<ivector<uint32_t, uint32_t> > vecs(n_vecs);
+    double start = now();
+    for (size_t i = 0; i < n_vecs; ++i) {
+	ivector<uint32_t, uint32_t> &v = vecs[i];
+	for (uint32_t j = 0; j < sizes[i]; ++j)
+	    v.push_back(j);
+    }
+    r.sec = now() - start;
+    r.ops = total;
+    uint64_t mem = 0;
+    for (size_t i = 0; i < n_vecs; ++i) {
+	mem += vecs[i].memory();
+	r.check += vecs[i][vecs[i].size() - 1];
+	vecs[i].free();
+    }
+    ostringstream out;
+    out << "eff=" << double(total) * sizeof(uint32_t) / double(mem);
+    r.extra = out.str();
+}
+
+// Allocate a batch of AnonSegs, free a random half, and allocate again.
+template <bool POOL>
+static void allocFree(Result &r)
+{
+    size_t n = scaled(500000);
+    vector<void*> p(n);
+    vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; ++i) order[i] = uint32_t(i);
+    Rand rnd(6);
+    for (size_t i = n - 1; i > 0; --i) swap(order[i], order[rnd.below(uint32_t(i + 1))]);
+    Pool<AnonSeg> pool;
+    double start = now();
+    for (size_t i = 0; i < n; ++i)
+	p[i] = POOL ? static_cast<void*>(new (pool) AnonSeg(ip4addr_t(i), ip4addr_t(i+1), 1)) :
+	    ::operator new(sizeof(AnonSeg));
+    for (size_t i = 0; i < n / 2; ++i) {
+	if (POOL) pool.free(p[order[i]], sizeof(AnonSeg));
+	else ::operator delete(p[order[i]]);
+    }
+    for (size_t i = 0; i < n / 2; ++i)
+	p[order[i]] = POOL ? static_cast<void*>(new (pool) AnonSeg(ip4addr_t(i), ip4addr_t(i+1), 2)) :
+	    ::operator new(sizeof(AnonSeg));
+    for (size_t i = 0; i < n; ++i) {
+	r.check += uintptr_t(p[i]) & 0xFF;
+	if (POOL) pool.free(p[i], sizeof(AnonSeg));
+	else ::operator delete(p[i]);
+    }
+    r.sec = now() - start;
+    r.ops = n * 3; // 1.5n allocations and 1.5n frees
+    pool.freeall();
+}
+
+static void benchPool(Result &r) { allocFree<true>(r); }
+static void benchNew(Result &r) { allocFree<false>(r); }
+
+// Lookups of anonymous segments, inserting those not found; about 40% of
+// lookups are for new segments, as in typical loadTraces logs.
+static void benchAnonSegSet(Result &r)
+{
+    size_t n_lookups = scaled(500000);
+    size_t n_keys = n_lookups * 2 / 5;
+    Pool<AnonSeg> pool;
+    vector<AnonSeg*> keys;
+    keys.reserve(n_lookups);
+    Rand rnd(7);
+    for (size_t i = 0; i < n_lookups; ++i) {
+	uint32_t k = i < n_keys ? uint32_t(i) : rnd.skewed(uint32_t(n_keys));
+	Rand krnd(k + 1000);
+	uint32_t lo = krnd.next(), hi = krnd.next();
+	keys.push_back(new (pool) AnonSeg(ip4addr_t(min(lo, hi)), ip4addr_t(max(lo, hi)),
+	    1 + int(krnd.below(3))));
+    }
+    for (size_t i = n_lookups - 1; i > 0; --i)
+	swap(keys[i], keys[rnd.below(uint32_t(i + 1))]);
+    AnonSegSet set;
+    uint64_t n_found = 0;
+    double start = now();
+    for (size_t i = 0; i < n_lookups; ++i) {
+	AnonSegSet::iterator it = set.find(keys[i]);
+	if (it != set.end()) ++n_found;
+	else set.insert(keys[i]);
+    }
+    r.sec = now() - start;
+    r.ops = n_lookups;
+    r.check = n_found;
+    ostringstream out;
+    out << "found=" << n_found << " size=" << set.size();
+    r.extra = out.str();
+    pool.freeall();
+}
+
+static void benchBogon(Result &r)
+{
+    NetPrefixSet bogons;
+    bogons.installStdBogons();
+    size_t n = scaled(2000000);
+    vector<ip4addr_t> addrs(n);
+    Rand rnd(8);
+    for (size_t i = 0; i < n; ++i)
+	addrs[i] = ip4addr_t(rnd.next());
+    uint64_t n_bogus = 0;
+    double start = now();
+    for (size_t i = 0; i < n; ++i)
+	n_bogus += bogons.covers(addrs[i]);
+    r.sec = now() - start;
+    r.ops = n;
+    r.check = n_bogus;
+    ostringstream out;
+    out << "prefixes=" << bogons.size() << " bogus_fraction=" <<
+	double(n_bogus) / double(n);
+    r.extra = out.str();
+}
+
+// Parsing of addresses as in the text trace loader.
+static void benchParse(Result &r)
+{
+    size_t n = scaled(1000000);
+    vector<char> text;
+    vector<size_t> offsets(n);
+    Rand rnd(9);
+    for (size_t i = 0; i < n; ++i) {
+	char buf[16];
+	uint32_t a = rnd.next();
+	int len = sprintf(buf, "%u.%u.%u.%u", a >> 24, (a >> 16) & 255,
+	    (a >> 8) & 255, a & 255);
+	offsets[i] = text.size();
+	text.insert(text.end(), buf, buf + len + 1);
+    }
+    double start = now();
+    for (size_t i = 0; i < n; ++i)
+	r.check += ip4addr_t(&text[offsets[i]]);
+    r.sec = now() - start;
+    r.ops = n;
+}
+
+struct Bench {
+    const char *name;
+    void (*fn)(Result &r);
+    const char *desc;
+};
+
+static const Bench benches[] = {
+    { "CompactIDSet.append", benchIDSetAppend,
+	"append trace ids to interfaces' TraceIDSets" },
+    { "CompactIDSet.overlaps", benchIDSetOverlaps,
+	"test pairs of TraceIDSets for a common trace" },
+    { "ivector.insert", benchIvectorInsert,
+	"sorted insert of unique PathSeg<2>s (NamedIface.prev)" },
+    { "ivector.push_back", benchIvectorPushBack,
+	"grow ivector<uint32_t> by push_back" },
+    { "Pool.alloc_free", benchPool,
+	"allocate and free AnonSegs from their Pool" },
+    { "new.alloc_free", benchNew,
+	"allocate and free AnonSeg-sized blocks with operator new" },
+    { "AnonSegSet.find_insert", benchAnonSegSet,
+	"look up anonymous segments, inserting new ones" },
+    { "NetPrefixSet.covers", benchBogon,
+	"bogon lookup of random addresses" },
+    { "ip4addr.parse", benchParse,
+	"parse dotted-quad addresses" },
+    { 0, 0, 0 }
+};
+
+static void usageExit(const char *name, int status)
+{
+    cerr << "Usage: " << name << " [-s <scale>] [-r <reps>] [-l] [<name>...]" << endl;
+    cerr << "Run the benchmarks whose names contain any of the <name>s (default: all)." << endl;
+    cerr << "-s <scale>   multiply the number of operations by <scale> (default: 1)" << endl;
+    cerr << "-r <reps>    repetitions of each benchmark (default: " << cfg_reps << ")" << endl;
+    cerr << "-l           list benchmarks" << endl;
+    exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    bool list = false;
+
+    while ((opt = getopt(argc, argv, "s:r:l")) != -1) {
+	switch (opt) {
+	case 's': cfg_scale = atof(optarg); break;
+	case 'r': cfg_reps = atoi(optarg); break;
+	case 'l': list = true; break;
+	default: usageExit(argv[0], 1);
+	}
+    }
+    if (cfg_scale <= 0 || cfg_reps < 1)
+	usageExit(argv[0], 1);
+
+    if (list) {
+	for (const Bench *b = benches; b->name; ++b)
+	    cout << b->name << "\t" << b->desc << endl;
+	return 0;
+    }
+
+    cout << "# scale=" << cfg_scale << " reps=" << cfg_reps << endl;
+    cout << "# name\tops\tns_per_op\tmops_per_sec\textra" << endl;
+    for (const Bench *b = benches; b->name; ++b) {
+	bool selected = (optind == argc);
+	for (int i = optind; i < argc && !selected; ++i)
+	    selected = strstr(b->name, argv[i]) != 0;
+	if (!selected) continue;
+	Result best;
+	for (int rep = 0; rep < cfg_reps; ++rep) {
+	    Result r;
+	    b->fn(r);
+	    sink += r.check;
+	    if (rep == 0 || r.sec < best.sec) best = r;
+	}
+	char buf[64];
+	snprintf(buf, sizeof(buf), "%.2f\t%.3f", best.sec * 1e9 / double(best.ops),
+	    double(best.ops) / best.sec / 1e6);
+	cout << b->name << "\t" << best.ops << "\t" << buf << "\t" << best.extra <<
+	    endl;
+    }
+    return 0;
+}
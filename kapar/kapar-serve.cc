@@ -0,0 +1,765 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * kapar-serve:  load a finished kapar topology once, and answer alias and
+ * link queries about it over a Unix domain socket (see QueryProtocol.h).
+ *
+ * The topology is either a binary topology file ("kapar -ob") or a text
+ * aliases file with an optional links file.  On SIGHUP, the files are
+ * loaded again in the background while queries continue to be answered
+ * from the old topology, which is replaced once the new one is ready.
+ * SIGINT or SIGTERM removes the socket and exits.
+ */
+
+#include "../lib/config.h"
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#ifdef __linux__
+# include <sys/epoll.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <stdexcept>
+
+#include "../lib/infile.h"
+#include "../lib/ip4addr.h"
+#include "../lib/QueryProtocol.h"
+#include "libkapar.h"
+
+using namespace std;
+
+static const char *progname;
+static const char *cfg_socket = 0;
+static const char *cfg_topo = 0;	// binary topology or aliases file
+static const char *cfg_links = 0;	// links file, or NULL
+
+static const size_t READ_SIZE = 65536;
+static const size_t OUT_HIGH = 4 << 20;	// stop reading above this much output
+
+static bool isAnonAddr(uint32_t addr) { return (addr & 0xF0000000) == 0xE0000000; }
+
+static bool iface_addr_less(const TopoIface &a, const TopoIface &b)
+    { return a.addr < b.addr; }
+
+static uint32_t parseId(const char *str, char prefix, const char **end)
+{
+    char *e;
+    if (*str != prefix || !isdigit(str[1]))
+	throw runtime_error(string("syntax error; expected \"") + prefix + "<id>\"");
+    unsigned long id = strtoul(str + 1, &e, 10);
+    *end = e;
+    return uint32_t(id);
+}
+
+struct IdAddr {
+    uint32_t id, addr;
+    IdAddr(uint32_t i, uint32_t a) : id(i), addr(a) {}
+    bool operator< (const IdAddr &b) const { return id < b.id; }
+};
+
+// Read the "node" or "link" lines of a kapar text output file.
+template<class F>
+static void readLines(const char *filename, const char *kind, char prefix, F f)
+{
+    vector<char> buf(1 << 20);
+    char *saveptr;
+    InFile in(filename);
+    while (in.gets(&buf[0], unsigned(buf.size()))) {
+	try {
+	    char *line = &buf[0];
+	    if (line[0] == '#' || line[0] == '\n') continue; // comment or empty
+	    if (!strchr(line, '\n') && strlen(line) == buf.size() - 1)
+		throw runtime_error("line too long");
+	    const char *word = strtok_r(line, " \t\n", &saveptr);
+	    if (!word || strcmp(word, kind) != 0)
+		throw runtime_error(string("syntax error; expected \"") + kind + "\"");
+	    const char *end;
+	    word = strtok_r(NULL, " \t\n", &saveptr);
+	    uint32_t id = word ? parseId(word, prefix, &end) : 0;
+	    if (!word || strcmp(end, ":") != 0)
+		throw runtime_error(string("syntax error; expected \"") + prefix + "<id>:\"");
+	    f(id, saveptr);
+	} catch (const std::runtime_error &e) { throw InFile::Error(in, e); }
+    }
+    in.close();
+}
+
+// Load a text aliases file and optional links file into topo.
+static void loadText(KaparTopology &topo, const char *aliasfile, const char *linkfile)
+{
+    vector<TopoIface> all; // may contain an address more than once
+    vector<IdAddr> nodeAddrs, linkAddrs, linkNodes;
+    vector<uint32_t> nodeIds, linkIds;
+
+    readLines(aliasfile, "node", 'N', [&](uint32_t nodeid, char *&saveptr) {
+	nodeIds.push_back(nodeid);
+	const char *word;
+	while ((word = strtok_r(NULL, " \t\n", &saveptr))) {
+	    ip4addr_t addr((string(word)));
+	    TopoIface iface = { addr, nodeid, 0, isAnonAddr(addr) ? TOPO_ANON : 0u };
+	    all.push_back(iface);
+	    nodeAddrs.push_back(IdAddr(nodeid, addr));
+	}
+    });
+    if (linkfile) {
+	readLines(linkfile, "link", 'L', [&](uint32_t linkid, char *&saveptr) {
+	    linkIds.push_back(linkid);
+	    const char *word, *end;
+	    while ((word = strtok_r(NULL, " \t\n", &saveptr))) {
+		uint32_t nodeid = parseId(word, 'N', &end);
+		if (!*end) { // implicit interface
+		    linkNodes.push_back(IdAddr(linkid, nodeid));
+		    continue;
+		}
+		if (*end != ':')
+		    throw runtime_error("syntax error; expected \"N<id>[:<IPaddr>]\"");
+		ip4addr_t addr((string(end + 1)));
+		TopoIface iface = { addr, nodeid, linkid, isAnonAddr(addr) ? TOPO_ANON : 0u };
+		all.push_back(iface);
+		linkAddrs.push_back(IdAddr(linkid, addr));
+	    }
+	});
+    }
+
+    // merge the node and link entries of each address
+    stable_sort(all.begin(), all.end(), iface_addr_less);
+    topo.ifaces.clear();
+    for (size_t i = 0; i < all.size(); ++i) {
+	if (topo.ifaces.empty() || topo.ifaces.back().addr != all[i].addr) {
+	    topo.ifaces.push_back(all[i]);
+	    continue;
+	}
+	TopoIface &iface = topo.ifaces.back();
+	if (!iface.nodeid) iface.nodeid = all[i].nodeid;
+	if (!iface.linkid) iface.linkid = all[i].linkid;
+	iface.flags |= all[i].flags;
+    }
+
+    struct CSR {
+	const vector<TopoIface> &ifaces;
+	CSR(const vector<TopoIface> &i) : ifaces(i) {}
+	uint32_t index(uint32_t addr) {
+	    TopoIface key = { addr, 0, 0, 0 };
+	    return uint32_t(lower_bound(ifaces.begin(), ifaces.end(), key,
+		iface_addr_less) - ifaces.begin());
+	}
+	// fill idx and vals from (id, value) pairs, for the ids in ids
+	void build(vector<uint32_t> &ids, vector<IdAddr> &pairs,
+	    vector<uint32_t> &idx, vector<uint32_t> &vals, bool addrs)
+	{
+	    sort(ids.begin(), ids.end());
+	    ids.erase(unique(ids.begin(), ids.end()), ids.end());
+	    stable_sort(pairs.begin(), pairs.end());
+	    idx.assign(ids.size() + 1, 0);
+	    vals.clear();
+	    vals.reserve(pairs.size());
+	    size_t p = 0;
+	    for (size_t k = 0; k < ids.size(); ++k) {
+		for ( ; p < pairs.size() && pairs[p].id == ids[k]; ++p)
+		    vals.push_back(addrs ? index(pairs[p].addr) : pairs[p].addr);
+		idx[k+1] = uint32_t(vals.size());
+	    }
+	}
+    } csr(topo.ifaces);
+    csr.build(nodeIds, nodeAddrs, topo.node_ifaces_idx, topo.node_ifaces, true);
+    topo.node_ids.swap(nodeIds);
+    vector<uint32_t> ids(linkIds);
+    csr.build(ids, linkNodes, topo.link_nodes_idx, topo.link_nodes, false);
+    csr.build(linkIds, linkAddrs, topo.link_ifaces_idx, topo.link_ifaces, true);
+    topo.link_ids.swap(linkIds);
+}
+
+// Load a binary topology file into topo.
+static void loadBinary(KaparTopology &topo, const char *filename)
+{
+    TopoFile f(filename);
+    const TopoHeader &h = f.header();
+    topo.ifaces.assign(f.ifaces, f.ifaces + h.n_ifaces);
+    topo.node_ids.assign(f.node_ids, f.node_ids + h.n_nodes);
+    topo.node_ifaces_idx.assign(f.node_ifaces_idx, f.node_ifaces_idx + h.n_nodes + 1);
+    topo.node_ifaces.assign(f.node_ifaces, f.node_ifaces + h.n_node_ifaces);
+    topo.link_ids.assign(f.link_ids, f.link_ids + h.n_links);
+    topo.link_ifaces_idx.assign(f.link_ifaces_idx, f.link_ifaces_idx + h.n_links + 1);
+    topo.link_ifaces.assign(f.link_ifaces, f.link_ifaces + h.n_link_ifaces);
+    topo.link_nodes_idx.assign(f.link_nodes_idx, f.link_nodes_idx + h.n_links + 1);
+    topo.link_nodes.assign(f.link_nodes, f.link_nodes + h.n_link_nodes);
+}
+
+static KaparTopology *loadTopology()
+{
+    KaparTopology *topo = new KaparTopology();
+    try {
+	char magic[8] = "";
+	FILE *file = fopen(cfg_topo, "rb");
+	if (!file)
+	    throw runtime_error(string("can't open ") + cfg_topo + ": " + strerror(errno));
+	size_t n = fread(magic, 1, sizeof(magic), file);
+	fclose(file);
+	if (n == sizeof(magic) && memcmp(magic, TOPO_MAGIC, 8) == 0)
+	    loadBinary(*topo, cfg_topo);
+	else
+	    loadText(*topo, cfg_topo, cfg_links);
+	topo->index();
+    } catch (...) {
+	delete topo;
+	throw;
+    }
+    cerr << progname << ": loaded " << topo->n_ifaces() << " ifaces, " <<
+	topo->n_nodes() << " nodes, " << topo->n_links() << " links" << endl;
+    return topo;
+}
+
+// Background reload, started by SIGHUP.  The new topology (or NULL if
+// loading failed) is handed to the event loop through a pipe.
+static int reloadPipe[2];
+
+static void *reload(void *)
+{
+    KaparTopology *topo = 0;
+    try {
+	topo = loadTopology();
+    } catch (const std::exception &e) {
+	cerr << progname << ": reload failed: " << e.what() << endl;
+    }
+    if (write(reloadPipe[1], &topo, sizeof(topo)) != sizeof(topo))
+	abort(); // can't happen with a pointer-sized write to an empty pipe
+    return 0;
+}
+
+static void startReload()
+{
+#ifdef HAVE_PTHREAD
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reload, NULL) == 0) {
+	pthread_detach(thread);
+	return;
+    }
+#endif
+    reload(0);
+}
+
+// Signals are turned into bytes on a pipe, so the event loop can handle
+// them synchronously.
+static int signalPipe[2];
+
+static void catchSignal(int sig)
+{
+    int saved_errno = errno;
+    char c = (sig == SIGHUP) ? 'H' : 'T';
+    if (write(signalPipe[1], &c, 1) < 0) { /* pipe full; signal is pending anyway */ }
+    errno = saved_errno;
+}
+
+static void setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+	throw runtime_error(string("fcntl: ") + strerror(errno));
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+}
+
+static void makePipe(int fds[2])
+{
+    if (pipe(fds) < 0)
+	throw runtime_error(string("pipe: ") + strerror(errno));
+    setNonBlocking(fds[0]);
+    setNonBlocking(fds[1]);
+}
+
+// Readiness notification for a set of descriptors:  level-triggered epoll
+// on Linux, poll() elsewhere.
+class Poller {
+#ifdef __linux__
+    int epfd;
+    vector<epoll_event> evbuf;
+#else
+    vector<pollfd> fds;
+    vector<pollfd>::iterator find(int fd) {
+	vector<pollfd>::iterator p = fds.begin();
+	while (p != fds.end() && p->fd != fd) ++p;
+	return p;
+    }
+#endif
+    Poller(const Poller&); // no copying
+    Poller &operator=(const Poller&);
+public:
+    struct Event { int fd; bool in, out; };
+#ifdef __linux__
+    Poller() : epfd(epoll_create(64)), evbuf(256) {
+	if (epfd < 0)
+	    throw runtime_error(string("epoll_create: ") + strerror(errno));
+    }
+    ~Poller() { ::close(epfd); }
+    void add(int fd, bool in, bool out) { ctl(EPOLL_CTL_ADD, fd, in, out); }
+    void modify(int fd, bool in, bool out) { ctl(EPOLL_CTL_MOD, fd, in, out); }
+    void remove(int fd) { ctl(EPOLL_CTL_DEL, fd, false, false); }
+    void wait(vector<Event> &events) {
+	events.clear();
+	int n = epoll_wait(epfd, &evbuf[0], int(evbuf.size()), -1);
+	if (n < 0 && errno != EINTR)
+	    throw runtime_error(string("epoll_wait: ") + strerror(errno));
+	for (int i = 0; i < n; ++i) {
+	    uint32_t e = evbuf[i].events;
+	    Event ev = { evbuf[i].data.fd,
+		(e & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+		(e & (EPOLLOUT | EPOLLERR)) != 0 };
+	    events.push_back(ev);
+	}
+    }
+private:
+    void ctl(int op, int fd, bool in, bool out) {
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (in ? uint32_t(EPOLLIN) : 0) | (out ? uint32_t(EPOLLOUT) : 0);
+	ev.data.fd = fd;
+	if (epoll_ctl(epfd, op, fd, &ev) < 0)
+	    throw runtime_error(string("epoll_ctl: ") + strerror(errno));
+    }
+#else
+    Poller() {}
+    void add(int fd, bool in, bool out) {
+	pollfd p = { fd, 0, 0 };
+	fds.push_back(p);
+	modify(fd, in, out);
+    }
+    void modify(int fd, bool in, bool out) {
+	find(fd)->events = short((in ? POLLIN : 0) | (out ? POLLOUT : 0));
+    }
+    void remove(int fd) { fds.erase(find(fd)); }
+    void wait(vector<Event> &events) {
+	events.clear();
+	int n = poll(&fds[0], nfds_t(fds.size()), -1);
+	if (n < 0 && errno != EINTR)
+	    throw runtime_error(string("poll: ") + strerror(errno));
+	for (size_t i = 0; n > 0 && i < fds.size(); ++i) {
+	    short e = fds[i].revents;
+	    if (!e) continue;
+	    Event ev = { fds[i].fd, (e & (POLLIN | POLLHUP | POLLERR)) != 0,
+		(e & (POLLOUT | POLLERR)) != 0 };
+	    events.push_back(ev);
+	}
+    }
+#endif
+};
+
+class Client {
+public:
+    int fd;
+    vector<char> in;		// received, not yet processed
+    size_t inpos;		// start of unprocessed data in in
+    vector<char> out;		// replies not yet sent
+    size_t outpos;		// start of unsent data in out
+    bool reading;		// polling for input?
+    bool writing;		// polling for output?
+    bool closing;		// close after sending out?
+    Client(int fd_) : fd(fd_), in(), inpos(0), out(), outpos(0),
+	reading(true), writing(false), closing(false) {}
+    size_t pending() const { return out.size() - outpos; }
+};
+
+class Server {
+    Poller poller;
+    int listenfd;
+    map<int, Client*> clients;
+    const KaparTopology *topo;
+    uint32_t generation;
+    bool reloading, reloadAgain;
+    vector<uint32_t> args;	// arguments of the current request
+    vector<uint32_t> words, tmp; // reply under construction
+    Server(const Server&); // no copying
+    Server &operator=(const Server&);
+
+    void put(uint32_t w) { words.push_back(w); }
+    void answer(const QueryHeader &req, const uint32_t *args, Client *c);
+    void process(Client *c);
+    void readFrom(Client *c);
+    bool writeTo(Client *c);
+    void update(Client *c);
+    void accept();
+    void drop(Client *c);
+public:
+    Server(int listenfd_, const KaparTopology *topo_);
+    ~Server();
+    void run();
+};
+
+Server::Server(int listenfd_, const KaparTopology *topo_) :
+    poller(), listenfd(listenfd_), clients(), topo(topo_), generation(1),
+    reloading(false), reloadAgain(false), args(), words(), tmp()
+{
+    poller.add(listenfd, true, false);
+    poller.add(signalPipe[0], true, false);
+    poller.add(reloadPipe[0], true, false);
+}
+
+Server::~Server()
+{
+    for (map<int, Client*>::iterator it = clients.begin(); it != clients.end(); ++it) {
+	::close(it->first);
+	delete it->second;
+    }
+    delete topo;
+}
+
+// Append the reply to req to c->out.
+void Server::answer(const QueryHeader &req, const uint32_t *args, Client *c)
+{
+    const KaparTopology &t = *topo;
+    QueryHeader rep = req;
+    rep.status = QUERY_OK;
+    words.clear();
+    switch (req.op) {
+    case QUERY_INFO:
+	put(generation); put(t.n_ifaces()); put(t.n_nodes()); put(t.n_links());
+	break;
+    case QUERY_NODE_OF:
+    case QUERY_LINK_OF:
+	for (uint32_t k = 0; k < req.n; ++k) {
+	    uint32_t i = t.findIface(args[k]);
+	    put(i == KaparTopology::NONE ? 0 :
+		req.op == QUERY_NODE_OF ? t.iface(i).nodeid : t.iface(i).linkid);
+	}
+	break;
+    case QUERY_NODE_IFACES:
+    case QUERY_NODE_LINKS:
+	for (uint32_t k = 0; k < req.n; ++k) {
+	    uint32_t n = t.findNode(args[k]);
+	    if (n == KaparTopology::NONE) { put(0); continue; }
+	    KaparTopology::Range r = req.op == QUERY_NODE_IFACES ?
+		t.nodeIfaces(n) : t.nodeLinks(n);
+	    put(uint32_t(r.size()));
+	    for (const uint32_t *p = r.begin; p != r.end; ++p)
+		put(req.op == QUERY_NODE_IFACES ? t.iface(*p).addr : t.linkId(*p));
+	}
+	break;
+    case QUERY_NODE_NEIGHBORS:
+	for (uint32_t k = 0; k < req.n; ++k) {
+	    uint32_t n = t.findNode(args[k]);
+	    tmp.clear();
+	    if (n != KaparTopology::NONE) {
+		KaparTopology::Range links = t.nodeLinks(n);
+		for (const uint32_t *l = links.begin; l != links.end; ++l) {
+		    KaparTopology::Range r = t.linkIfaces(*l);
+		    for (const uint32_t *p = r.begin; p != r.end; ++p)
+			tmp.push_back(t.iface(*p).nodeid);
+		    r = t.linkNodes(*l);
+		    tmp.insert(tmp.end(), r.begin, r.end);
+		}
+		sort(tmp.begin(), tmp.end());
+		tmp.erase(unique(tmp.begin(), tmp.end()), tmp.end());
+		tmp.erase(std::remove(tmp.begin(), tmp.end(), args[k]), tmp.end());
+		tmp.erase(std::remove(tmp.begin(), tmp.end(), 0u), tmp.end());
+	    }
+	    put(uint32_t(tmp.size()));
+	    words.insert(words.end(), tmp.begin(), tmp.end());
+	}
+	break;
+    case QUERY_LINK_MEMBERS:
+	for (uint32_t k = 0; k < req.n; ++k) {
+	    uint32_t l = t.findLink(args[k]);
+	    if (l == KaparTopology::NONE) { put(0); continue; }
+	    KaparTopology::Range r = t.linkIfaces(l), imp = t.linkNodes(l);
+	    put(uint32_t(r.size() + imp.size()));
+	    for (const uint32_t *p = r.begin; p != r.end; ++p) {
+		put(t.iface(*p).nodeid); put(t.iface(*p).addr);
+	    }
+	    for (const uint32_t *p = imp.begin; p != imp.end; ++p) {
+		put(*p); put(0);
+	    }
+	}
+	break;
+    default:
+	rep.status = QUERY_BAD_OP;
+	break;
+    }
+    rep.n = uint32_t(words.size());
+    const char *h = reinterpret_cast<const char*>(&rep);
+    const char *w = reinterpret_cast<const char*>(words.data());
+    c->out.insert(c->out.end(), h, h + sizeof(rep));
+    c->out.insert(c->out.end(), w, w + words.size() * sizeof(uint32_t));
+}
+
+// Answer the complete requests in c->in, until output backs up.
+void Server::process(Client *c)
+{
+    while (!c->closing && c->pending() < OUT_HIGH) {
+	size_t avail = c->in.size() - c->inpos;
+	if (avail < sizeof(QueryHeader)) break;
+	QueryHeader req;
+	memcpy(&req, &c->in[c->inpos], sizeof(req));
+	if (req.n > QUERY_MAX_ARGS) {
+	    QueryHeader rep = req;
+	    rep.status = QUERY_TOO_BIG;
+	    rep.n = 0;
+	    const char *h = reinterpret_cast<const char*>(&rep);
+	    c->out.insert(c->out.end(), h, h + sizeof(rep));
+	    c->closing = true;
+	    break;
+	}
+	size_t len = sizeof(req) + size_t(req.n) * sizeof(uint32_t);
+	if (avail < len) break;
+	// copy the arguments for alignment
+	args.resize(req.n);
+	if (req.n)
+	    memcpy(&args[0], &c->in[c->inpos + sizeof(req)], req.n * sizeof(uint32_t));
+	answer(req, args.data(), c);
+	c->inpos += len;
+    }
+    if (c->inpos == c->in.size()) {
+	c->in.clear();
+	c->inpos = 0;
+    } else if (c->inpos > c->in.size() / 2) {
+	c->in.erase(c->in.begin(), c->in.begin() + c->inpos);
+	c->inpos = 0;
+    }
+}
+
+void Server::readFrom(Client *c)
+{
+    size_t old = c->in.size();
+    c->in.resize(old + READ_SIZE);
+    ssize_t n = read(c->fd, &c->in[old], READ_SIZE);
+    c->in.resize(old + (n > 0 ? size_t(n) : 0));
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+	drop(c);
+	return;
+    }
+    process(c);
+    if (writeTo(c)) update(c);
+}
+
+// Send as much of c->out as possible.  Returns false if c was dropped.
+bool Server::writeTo(Client *c)
+{
+    while (c->pending() > 0) {
+	ssize_t n = write(c->fd, &c->out[c->outpos], c->pending());
+	if (n < 0) {
+	    if (errno == EINTR) continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+	    drop(c);
+	    return false;
+	}
+	c->outpos += size_t(n);
+    }
+    if (c->pending() == 0) {
+	c->out.clear();
+	c->outpos = 0;
+	if (c->closing) {
+	    drop(c);
+	    return false;
+	}
+    }
+    return true;
+}
+
+// Poll for input unless output has backed up, and for output if any is
+// waiting.
+void Server::update(Client *c)
+{
+    if (!c->closing && c->pending() < OUT_HIGH && c->inpos < c->in.size()) {
+	// output drained enough to resume buffered requests
+	process(c);
+	if (!writeTo(c)) return;
+    }
+    bool reading = !c->closing && c->pending() < OUT_HIGH;
+    bool writing = c->pending() > 0;
+    if (reading != c->reading || writing != c->writing) {
+	poller.modify(c->fd, reading, writing);
+	c->reading = reading;
+	c->writing = writing;
+    }
+}
+
+void Server::accept()
+{
+    while (true) {
+	int fd = ::accept(listenfd, NULL, NULL);
+	if (fd < 0) {
+	    if (errno == EINTR || errno == ECONNABORTED) continue;
+	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+		cerr << progname << ": accept: " << strerror(errno) << endl;
+	    return;
+	}
+	setNonBlocking(fd);
+	clients[fd] = new Client(fd);
+	poller.add(fd, true, false);
+    }
+}
+
+void Server::drop(Client *c)
+{
+    poller.remove(c->fd);
+    ::close(c->fd);
+    clients.erase(c->fd);
+    delete c;
+}
+
+void Server::run()
+{
+    vector<Poller::Event> events;
+    while (true) {
+	poller.wait(events);
+	for (size_t i = 0; i < events.size(); ++i) {
+	    const Poller::Event &ev = events[i];
+	    if (ev.fd == listenfd) {
+		accept();
+	    } else if (ev.fd == signalPipe[0]) {
+		char c;
+		while (read(signalPipe[0], &c, 1) == 1) {
+		    if (c == 'T') return;
+		    if (reloading) {
+			reloadAgain = true;
+		    } else {
+			reloading = true;
+			startReload();
+		    }
+		}
+	    } else if (ev.fd == reloadPipe[0]) {
+		KaparTopology *newtopo;
+		if (read(reloadPipe[0], &newtopo, sizeof(newtopo)) != sizeof(newtopo))
+		    continue;
+		if (newtopo) {
+		    // no request is in progress, so the old topology is unused
+		    delete topo;
+		    topo = newtopo;
+		    ++generation;
+		    cerr << progname << ": serving generation " << generation << endl;
+		}
+		reloading = false;
+		if (reloadAgain) {
+		    reloadAgain = false;
+		    reloading = true;
+		    startReload();
+		}
+	    } else {
+		map<int, Client*>::iterator it = clients.find(ev.fd);
+		if (it == clients.end()) continue;
+		Client *c = it->second;
+		if (ev.out && !writeTo(c)) continue;
+		if (ev.in && c->reading) {
+		    readFrom(c);
+		} else {
+		    update(c);
+		}
+	    }
+	}
+    }
+}
+
+static int listenOn(const char *path)
+{
+    struct sockaddr_un sun;
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun.sun_path))
+	throw runtime_error(string("socket path too long: ") + path);
+    strcpy(sun.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	throw runtime_error(string("socket: ") + strerror(errno));
+    // remove a stale socket, but not one that a live server is using
+    if (connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == 0)
+	throw runtime_error(string(path) + " is in use by another server");
+    ::close(fd);
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+	throw runtime_error(string("socket: ") + strerror(errno));
+    if (bind(fd, (struct sockaddr*)&sun, sizeof(sun)) < 0 || listen(fd, 128) < 0)
+	throw runtime_error(string(path) + ": " + strerror(errno));
+    setNonBlocking(fd);
+    return fd;
+}
+
+static void usageExit(int status)
+{
+    cerr << "Usage: " << progname << " -s <socket> [-l <links>] <topology>\n"
+	"Answer alias queries about a kapar topology over a Unix socket.\n"
+	"<topology> is a binary topology file (from kapar -ob), or a text\n"
+	"aliases file (from kapar -oa).\n"
+	"-s <socket>  path of the Unix domain socket to listen on\n"
+	"-l <links>   text links file (from kapar -ol), with a text <topology>\n"
+	"SIGHUP reloads the files without interrupting service.\n";
+    exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+    progname = argv[0];
+    int opt;
+    while ((opt = getopt(argc, argv, "s:l:?")) != -1) {
+	switch (opt) {
+	case 's': cfg_socket = optarg; break;
+	case 'l': cfg_links = optarg; break;
+	default: usageExit(opt == '?' && optopt == '?' ? 0 : 1);
+	}
+    }
+    if (!cfg_socket || optind != argc - 1) usageExit(1);
+    cfg_topo = argv[optind];
+
+    try {
+	const KaparTopology *topo = loadTopology();
+	makePipe(signalPipe);
+	makePipe(reloadPipe);
+	int listenfd = listenOn(cfg_socket);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = catchSignal;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	{
+	    Server server(listenfd, topo);
+	    cerr << progname << ": listening on " << cfg_socket << endl;
+	    server.run();
+	}
+	::close(listenfd);
+	unlink(cfg_socket);
+    } catch (const std::exception &e) {
+	cerr << progname << ": " << e.what() << endl;
+	return 1;
+    }
+    return 0;
+}
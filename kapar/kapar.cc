@@ -36,32 +36,12 @@ static const char *cvsID = "$Id: kapar.cc,v 1.175 2017/08/31 17:24:33 kkeys Exp
 #include "../lib/config.h"
 #include "config.h"
 
-#define debugpath sink
-// #define debugpath out_log
-
-#define debugsubnet sink
-// #define debugsubnet out_log
-
-#define debugalias sink
-// #define debugalias out_log
-
-#define debuglink sink
-// #define debuglink out_log
-
-#define debuganon sink
-// #define debuganon out_log
-
-#define debugttl sink
-// #define debugttl out_log
-
-// #define debugbrief sink
-#define debugbrief out_log
-
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <dirent.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 
 #include <netinet/in.h>
@@ -70,6 +50,7 @@ static const char *cvsID = "$Id: kapar.cc,v 1.175 2017/08/31 17:24:33 kkeys Exp
 #include <errno.h>
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <stdlib.h>
 #include <cstdio>
@@ -83,6 +64,7 @@ static const char *cvsID = "$Id: kapar.cc,v 1.175 2017/08/31 17:24:33 kkeys Exp
 #include <vector>
 #include <set>
 #include <map>
+#include <queue>
 
 #include "../lib/unordered_set.h"
 
@@ -93,10 +75,21 @@ static const char *cvsID = "$Id: kapar.cc,v 1.175 2017/08/31 17:24:33 kkeys Exp
 #include <stdexcept>
 
 #include "../lib/infile.h"
+#include "../lib/outfile.h"
+#include "../lib/TopoFile.h"
+#include "../lib/StateFile.h"
 #include "../lib/ip4addr.h"
 #include "../lib/ivector.h"
 #include "../lib/Pool.h"
+#include "../lib/PathSeg.h"
+#include "../lib/CompactIDSet.h"
+#include "../lib/SpillArena.h"
+#include "../lib/AnonSeg.h"
 #include "../lib/NetPrefix.h"
+#include "../lib/DstFilter.h"
+#include "../lib/Parallel.h"
+#include "../lib/AddrBitmap.h"
+#include "../lib/Progress.h"
 
 #ifdef HAVE_SCAMPER
 extern "C" {
@@ -109,24 +102,61 @@ extern "C" {
 
 using namespace std;
 
+#include "../lib/ScamperInput.h"
+#include "../lib/PathLoader.h"
+#include "libkapar.h"
+
 #define NO_DEBUG_MEMORY 0
 #include "../lib/MemoryInfo.h"
-MemoryInfo memoryInfo;
-
-ofstream out_log;
-ofstream out_aliases;
-ofstream out_links;
-ofstream out_ifaces;
-ofstream out_subnets;
-ofstream out_addrs;
-ofstream out_missing;
-#if 0
-ofstream out_ptp;
-#endif
 
-const class Sink : public ostream { public: Sink() {} } sink;
-template<class T>
-inline const Sink& operator<< (const Sink& out, const T&) { return out; }
+// Debug output categories, selected at run time with -v for each context.
+// The macros may be used in classes with debugEnabled() and debugChannel()
+// members (KaparContext and its helpers).  A statement like
+//     debugalias << "merging " << *dead << " into " << *keep << "\n";
+// costs only a test of a flag when the category is disabled; the operands
+// are not evaluated.
+enum DebugCategory {
+    DEBUG_PATH, DEBUG_SUBNET, DEBUG_ALIAS, DEBUG_LINK, DEBUG_ANON, DEBUG_TTL,
+    DEBUG_BRIEF, N_DEBUG_CATEGORIES
+};
+static const char debugCategoryOpts[] = "psalntb"; // -v letters, in order
+
+#define debugOn(cat)	__builtin_expect(debugEnabled(cat), 0)
+#define debugStream(cat) if (!debugOn(cat)) {} else debugChannel()
+#define debugpath	debugStream(DEBUG_PATH)
+#define debugsubnet	debugStream(DEBUG_SUBNET)
+#define debugalias	debugStream(DEBUG_ALIAS)
+#define debuglink	debugStream(DEBUG_LINK)
+#define debuganon	debugStream(DEBUG_ANON)
+#define debugttl	debugStream(DEBUG_TTL)
+#define debugbrief	debugStream(DEBUG_BRIEF)
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t debugMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Debug output of a thread inside KaparContext::parallelFor(), which is
+// appended to the log of a context, under debugMutex, at the end of each
+// slice (or in chunks of FLUSHSIZE), so threads don't contend for the log.
+class DebugBuffer : public ostringstream {
+public:
+    static const std::streamoff FLUSHSIZE = 1 << 16;
+    ostream *log; // log to which the buffered text belongs
+    DebugBuffer() : log(0) {}
+    static DebugBuffer &current() {
+	static thread_local DebugBuffer buf;
+	return buf;
+    }
+    void flushToLog() {
+	string text = str();
+	if (text.empty()) return;
+	pthread_mutex_lock(&debugMutex);
+	*log << text;
+	pthread_mutex_unlock(&debugMutex);
+	str("");
+    }
+    ~DebugBuffer() { flushToLog(); }
+};
+#endif
 
 
 struct Cfg {
@@ -138,6 +168,8 @@ struct Cfg {
 #endif
     vector<const char*> ifaceFiles;
     vector<const char*> traceFiles;
+    vector<const char*> dstFiles;
+    vector<ip4addr_t> grep_dsts; // destinations given with -g
     char filetype;
     int n_ttls;			// number of TTL vantage points
     int min_subnet_middle_required; // min pfx len for which middles are req'd
@@ -172,6 +204,8 @@ struct Cfg {
     bool output_links;
     bool output_ifaces;
     bool output_subnets;
+    bool output_topo;
+    bool output_gzip;		// gzip the aliases, links, and ifaces output
     bool include_dst;
     bool include_dst_explicit;
     bool need_traceids;
@@ -180,9 +214,19 @@ struct Cfg {
     bool setFile(const char *filename);
     int pfxlen;
     float mincompleteness;
+    int n_threads;		// number of worker threads
+    int progress_interval;	// seconds between progress reports
+    const char *progress_endpoint; // file or unix socket for progress
+    const char *save_state;	// file to save state to after loading
+    const char *load_state;	// file to load state from instead of inputs
+    const char *sweep_file;	// file of configurations to run after loading
+    size_t memory_budget;	// bytes of spilled data to keep resident, or 0
+    const char *spill_dir;	// directory for spill files
+    const char *dst_index_dir;	// directory of iPlane destination indexes
+    bool debugEnabled[N_DEBUG_CATEGORIES]; // categories selected with -v
 private:
     void setOneFile(const char *filename);
-} cfg;
+};
 
 void Cfg::setOneFile(const char *filename)
 {
@@ -205,6 +249,9 @@ void Cfg::setOneFile(const char *filename)
     case 'P':
 	this->traceFiles.push_back(filename);
 	break;
+    case 'G':
+	this->dstFiles.push_back(filename);
+	break;
     default:
 	break;
     }
@@ -215,9 +262,9 @@ bool Cfg::setFile(const char *filename)
     if (!this->filetype) return false;
     if (filename[0] == '@') {
 	InFile filelist(filename+1);
-	char buf[PATH_MAX];
+	char buf[PATH_MAX], *saveptr;
 	while (filelist.gets(buf, sizeof(buf))) {
-	    strtok(buf, "\n");
+	    strtok_r(buf, "\n", &saveptr);
 	    setOneFile(strdup(buf));
 	}
 	filelist.close();
@@ -230,8 +277,8 @@ bool Cfg::setFile(const char *filename)
 static const int MINSUBNETLEN = 24;
 static const float MINCOMPLETENESS = 0.5;
 static const int MAX_DISTANCE = 1;
-
-typedef uint32_t TraceID;
+// More slices than threads evens out the load when some slices are heavier.
+static const int PARALLEL_SLICES_PER_THREAD = 8;
 
 struct Iface; // forward declaration
 
@@ -242,23 +289,6 @@ bool addr_less_than(const ip4addr_t &a, const ip4addr_t &b) {
     return (isAnon(a) == isAnon(b)) ? (a < b) : isAnon(a);
 }
 
-// an N-hop segment of a path (trace)
-template <int N>
-class PathSeg {
-public:
-    ip4addr_t hops[N];		// N sequential interface addrs seen in a path
-    PathSeg(const ip4addr_t &a, const ip4addr_t &b) { hops[0]=a; hops[1]=b; }
-    explicit PathSeg(const ip4addr_t &a) { hops[0]=a; }
-    ip4addr_t const &hop(int i) const { return hops[i]; }
-    bool operator== (const PathSeg& b) const {
-	if (this->hop(0) != b.hop(0)) return false;
-	if (N > 1)
-	    if (this->hop(1) != b.hop(1)) return false;
-	return true;
-    }
-    bool operator!= (const PathSeg& b) const { return !(*this == b); }
-};
-
 template <int N>
 struct pathseg_less_than {
     bool operator()(const PathSeg<N> &a, const PathSeg<N> &b) const {
@@ -268,9 +298,6 @@ struct pathseg_less_than {
     }
 };
 
-template <int N>
-class PathSegVec : public ivector<uint32_t, PathSeg<N> > { };
-
 #ifdef ENABLE_TTL
 // an array of TTL values
 class ttlVec {
@@ -279,16 +306,19 @@ class ttlVec {
     // actually set and valid.
     static const uint8_t SET = 0x1, VALID = 0x2;
     uint8_t *data;
-    int flagssize() const { return (cfg.n_ttls*2+7)/8; }
-    uint8_t &flagdata(const int &i) const { return data[cfg.n_ttls + i/4]; }
+    int flagssize() const { return (n_ttls*2+7)/8; }
+    uint8_t &flagdata(const int &i) const { return data[n_ttls + i/4]; }
     uint8_t mask(int i, uint8_t value) const { return (value << ((i%4)*2)); }
-    int datasize() const { return cfg.n_ttls + flagssize(); }
+    int datasize() const { return n_ttls + flagssize(); }
     ttlVec(const ttlVec &that); // copy ctor - private to prevent accidental use
 public:
+    // Number of TTL vantage points.  ttlVecs don't record their own size, so
+    // this is shared by all contexts in the process.
+    static int n_ttls;
     ttlVec() : data(0) {}
     ~ttlVec() { if (data) delete[] data; }
     void clear()
-	{ for (int i = cfg.n_ttls; i < datasize(); ++i) data[i] = 0; }
+	{ for (int i = n_ttls; i < datasize(); ++i) data[i] = 0; }
     void free() { if (data) delete[] data; data = 0; }
     bool empty() const { return !data; }
     void alloc() { data = new uint8_t[datasize()](); clear(); }
@@ -313,28 +343,44 @@ public:
 	return *this;
     }
     void mergeMin(const ttlVec &b) {
-	for (int i = 0; i < cfg.n_ttls; ++i) { // set TTLs
+	for (int i = 0; i < n_ttls; ++i) { // set TTLs
 	    if (this->isValid(i) && b.isValid(i)) {
 		if (b.data[i] < this->data[i]) this->data[i] = b.data[i];
 	    } else if (b.isValid(i)) {
 		this->data[i] = b.data[i];
 	    }
 	}
-	for (int i = cfg.n_ttls; i < datasize(); ++i) // set flags
+	for (int i = n_ttls; i < datasize(); ++i) // set flags
 	    this->data[i] |= b.data[i];
     }
     void mergeMax(const ttlVec &b) {
-	for (int i = 0; i < cfg.n_ttls; ++i) { // set TTLs
+	for (int i = 0; i < n_ttls; ++i) { // set TTLs
 	    if (this->isValid(i) && b.isValid(i)) {
 		if (b.data[i] > this->data[i]) this->data[i] = b.data[i];
 	    } else if (b.isValid(i)) {
 		this->data[i] = b.data[i];
 	    }
 	}
-	for (int i = cfg.n_ttls; i < datasize(); ++i) // set flags
+	for (int i = n_ttls; i < datasize(); ++i) // set flags
 	    this->data[i] |= b.data[i];
     }
-    void swap(ttlVec &that) { std::swap(this->data, that.data); debugttl << "# swap ttls\n"; }
+    void swap(ttlVec &that) { std::swap(this->data, that.data); }
+    // raw data, for saving and restoring state
+    int rawsize() const { return datasize(); }
+    const uint8_t *raw() const { return data; }
+    void setRaw(const uint8_t *raw)
+	{ alloc_if_needed(); copy(raw, raw + datasize(), data); }
+};
+
+int ttlVec::n_ttls = 0;
+
+// a TTL of a reply from addr, read from a TTL file
+struct TTLReading {
+    ip4addr_t addr;
+    uint8_t ttl;
+    TTLReading(ip4addr_t a, uint8_t t) : addr(a), ttl(t) {}
+    // by address only, so that a stable sort keeps file order
+    bool operator<(const TTLReading &b) const { return addr < b.addr; }
 };
 
 inline void swap(ttlVec &a, ttlVec &b) { a.swap(b); }
@@ -343,245 +389,12 @@ ostream& operator<< (ostream& out, const ttlVec& ttlvec) { // for debugging
     if (ttlvec.empty()) {
 	out << "\t(empty)";
     } else {
-	for (int i = 0; i < cfg.n_ttls; ++i) { out << "\t" << ttlvec.get(i); }
+	for (int i = 0; i < ttlVec::n_ttls; ++i) { out << "\t" << ttlvec.get(i); }
     }
     return out;
 }
 #endif
 
-// A set of nonnegative integers with a vector-like interface, but more
-// compact storage of clusters of nearby values.
-#define TEST_TRACEIDSET 0
-class CompactIDSet {
-    // Storage is basically a vector of integers, but if an element has FLAG
-    // set, it is a bitvector of 31 possible values following the previous
-    // element.  There can be up to MAX bitvectors in a row.
-    typedef ivector<uint32_t, TraceID> idvector;
-    idvector data;
-#if TEST_TRACEIDSET
-    vector<TraceID> backup;
-#endif
-    static int64_t _totalSize;
-    static int64_t _totalSlots;
-    static const uint32_t FLAG = 0x80000000;
-    static const uint32_t MASK = 0x7fffffff;
-    static const int MAX = 33;
-public:
-    CompactIDSet() : data(0) {}
-    static int64_t totalSize() { return _totalSize; }
-    static int64_t totalSlots() { return _totalSlots; }
-    void append(TraceID id) {
-#if TEST_TRACEIDSET
-	backup.push_back(id);
-#endif
-	++_totalSize;
-	int sz = data.size();
-	if (sz > 1) {
-	    int dist;
-	    if (data[sz-1] & FLAG) {
-		int start = sz-2;
-		// search back for initial integer element
-		while (data[start] & FLAG)
-		    --start;
-		dist = id - data[start];
-		if (dist <= 31 * (sz - start - 1)) {
-		    // add id to existing bitvector
-		    data[sz-1] |= 1 << ((dist-1) % 31);
-		    return;
-		} else if ((sz - start < MAX) && (dist < 31 * (sz - start))) {
-		    // add id to new bitvector
-		    data.push_back(FLAG | (1 << ((dist-1) % 31)));
-		    ++_totalSlots;
-		    return;
-		}
-	    } else if (!(data[sz-2] & FLAG)) {
-		// last two entries are not bitvectors
-		dist = id - data[sz-2];
-		if (dist <= 31) {
-		    // convert last element to bitvector and add id
-		    uint32_t bits = 1 << (dist-1);
-		    dist = data[sz-1] - data[sz-2];
-		    bits |= 1 << (dist-1);
-		    data[sz-1] = FLAG | bits;
-		    return;
-		}
-	    }
-	}
-	data.push_back(id);
-	++_totalSlots;
-#if TEST_TRACEIDSET
-	{
-	    int val = 0, start = 0;
-	    size_t bi = 0;
-	    TraceID n;
-	    static int call = 0;
-	    call++;
-	    for (size_t i = 0; i < data.size(); ++i) {
-		if (!(data[i] & FLAG)) {
-		    start = i;
-		    val = data[i];
-		    n = data[i];
-		    if (backup[bi++] != n)
-			out_log << "# ERROR mismatch in call " << call << endl;
-		} else {
-		    uint32_t bits = data[i] & MASK;
-		    for (int j = 0; bits; ++j, bits = bits>>1) {
-			if (bits & 0x1) {
-			    n = (val + (i-start-1) * 31 + j + 1);
-			    if (backup[bi++] != n)
-				out_log << "# ERROR mismatch in call " << call << endl;
-			}
-		    }
-		}
-	    }
-	    if (bi != backup.size())
-		out_log << "# ERROR mismatch in call " << call << endl;
-	}
-#endif
-    }
-    uint32_t rawsize() const {
-	return data.size();
-    }
-    bool empty() const {
-	return data.empty();
-    }
-    uint32_t size() const {
-	if (data.empty()) return 0;
-	idvector::const_iterator i;
-	uint32_t n = 0;
-	for (i = data.begin(); i != data.end(); ++i) {
-	    if (*i & FLAG) {
-		for (uint32_t bits = *i & MASK; bits; bits = bits >> 1) {
-		    n += (bits & 0x1);
-		}
-	    } else {
-		++n;
-	    }
-	}
-	return n;
-    }
-    bool overlaps(const CompactIDSet &b) const;
-    void free(bool corrupt = false) {
-	data.free(corrupt);
-    }
-
-    struct IdvectorWalker {
-	const idvector &vec;
-	size_t i; // position of current element
-	size_t start; // position of last integer element
-	TraceID val; // value of last integer element
-	bool is_int;
-	IdvectorWalker(const idvector &_vec) : vec(_vec), i(0), start(0), val(_vec[0]), is_int(true) {}
-	void increment() {
-	    i++;
-	    if (i < vec.size() && (is_int = !(vec[i] & FLAG))) {
-		start = i;
-		val = vec[i];
-	    }
-	}
-    };
-};
-int64_t CompactIDSet::_totalSize = 0;
-int64_t CompactIDSet::_totalSlots = 0;
-
-bool CompactIDSet::overlaps(const CompactIDSet &that) const
-{
-    bool result = false;
-#if TEST_TRACEIDSET
-    static int call = 0;
-    bool backup_result = false;
-    call++;
-    {
-	const vector<TraceID> &a = this->backup, &b = that.backup;
-	size_t ai = 0, bi = 0;
-	while (ai < a.size() && bi < b.size()) {
-	    if (a[ai] < b[bi]) {
-		ai++;
-	    } else if (b[bi] < a[ai]) {
-		bi++;
-	    } else {
-		backup_result = true;
-		break;
-	    }
-	}
-    }
-#endif
-
-    IdvectorWalker a(this->data);
-    IdvectorWalker b(that.data);
-    while (a.i < a.vec.size() && b.i < b.vec.size()) {
-	if (a.val == b.val) { result = true; break; }
-	if (a.is_int && b.is_int) {
-	    // neither is a bitvector
-	    if (a.val < b.val) a.increment();
-	    else /* b.val < a.val */ b.increment();
-	} else if (a.is_int) {
-	    // b is a bitvector
-	    if (a.val < b.val) {
-		a.increment();
-	    } else /* a.val > b.val */ {
-		size_t dist = a.val - b.val;
-		if (dist-1 < 31 * (b.i - b.start - 1)) {
-		    // a.val is before b.vec[b.i]'s range
-		    a.increment();
-		} else if (dist-1 >= 31 * (b.i - b.start)) {
-		    // a.val is after b.vec[b.i]'s range
-		    b.increment();
-		} else {
-		    // a.val is in b.vec[b.i]'s range
-		    if (b.vec[b.i] & (1 << ((dist-1)%31))) { result = true; break; }
-		    a.increment();
-		}
-	    }
-	} else if (b.is_int) {
-	    // a is a bitvector
-	    if (b.val < a.val) {
-		b.increment();
-	    } else /* b.val > a.val */ {
-		size_t dist = b.val - a.val;
-		if (dist-1 < 31 * (a.i - a.start - 1)) {
-		    // b.val is before a.vec[a.i]'s range
-		    b.increment();
-		} else if (dist-1 >= 31 * (a.i - a.start)) {
-		    // b.val is after a.vec[a.i]'s range
-		    a.increment();
-		} else {
-		    // b.val is in a.vec[a.i]'s range
-		    if (a.vec[a.i] & (1 << ((dist-1)%31))) { result = true; break; }
-		    b.increment();
-		}
-	    }
-	} else {
-	    // both are bitvectors
-	    int dist = (b.val + 31*(b.i-b.start)) - (a.val + 31*(a.i-a.start));
-	    if (dist >= 0) {
-		// a's range starts before b's range
-		if (dist <= 31) { // the ranges overlap
-		    if (a.vec[a.i] & (b.vec[b.i] << dist) & MASK) { result = true; break; }
-		}
-		a.increment();
-	    } else {
-		// b's range starts before a's range
-		if (-dist <= 31) { // the ranges overlap
-		    if (b.vec[b.i] & (a.vec[a.i] << -dist) & MASK) { result = true; break; }
-		}
-		b.increment();
-	    }
-	}
-    }
-
-#if TEST_TRACEIDSET
-    if (result != backup_result) {
-	out_log << "# ERROR in call #" << call << ";" <<
-	    " ai=" << a.i << " astart=" << a.start << " aval=" << a.val << " a[ai]=" << hex << a.vec[a.i] << dec <<
-	    " bi=" << b.i << " bstart=" << b.start << " bval=" << b.val << " b[bi]=" << hex << b.vec[b.i] << dec <<
-	    endl;
-	exit(1);
-    }
-#endif
-    return result;
-}
-
 // a network interface
 struct Iface {
     const ip4addr_t addr;	// interface's address
@@ -619,12 +432,14 @@ struct NamedIface : public ExplicitIface {
 	, ttl()
 #endif
 	{ preAliased() = false; }
-    static void * operator new(size_t size) { return pool.alloc(size); }
-    static void operator delete(void *p, size_t size) { pool.free(p, size); }
+    // allocated from the pool of a context:  new (pool) NamedIface(addr)
+    static void * operator new(size_t size, Pool<NamedIface> &pool)
+	{ return pool.alloc(size); }
+    static void operator delete(void *p, Pool<NamedIface> &pool)
+	{ pool.free(p, sizeof(NamedIface)); } // if constructor throws
 private:
-    static Pool<NamedIface> pool;
+    static void operator delete(void *p, size_t size); // not from the heap
 };
-Pool<NamedIface> NamedIface::pool;
 
 // an interface without a known routable address (e.g., a non-responding hop
 // in a trace)
@@ -633,26 +448,17 @@ struct AnonIface : public ExplicitIface {
     static const uint32_t PREFIX  = 0xE0000000;
     static const uint32_t MASKLEN = 4;
     static const uint32_t NETMASK = 0xFFFFFFFF << (32-MASKLEN);
-    static uint32_t maxid;
     ip4addr_t redundant; // another iface that is equivalent to this one
     PathSegVec<1> prev;	// list of previous hops
-    AnonIface() : ExplicitIface(ip4addr_t(++maxid | PREFIX))
-    {
-	if (maxid & NETMASK) {
-	    cerr << "ERROR: anonymous addresses exceed " <<
-		ip4addr_t(PREFIX) << "/" << MASKLEN << endl;
-	    abort();
-	}
-	redundant = ip4addr_t(0);
-    }
-    explicit AnonIface(ip4addr_t a) : ExplicitIface(a) {}
-    static void * operator new(size_t size) { return pool.alloc(size); }
-    static void operator delete(void *p, size_t size) { pool.free(p, size); }
+    explicit AnonIface(ip4addr_t a) : ExplicitIface(a), redundant(0) {}
+    // allocated from the pool of a context:  new (pool) AnonIface(addr)
+    static void * operator new(size_t size, Pool<AnonIface> &pool)
+	{ return pool.alloc(size); }
+    static void operator delete(void *p, Pool<AnonIface> &pool)
+	{ pool.free(p, sizeof(AnonIface)); } // if constructor throws
 private:
-    static Pool<AnonIface> pool;
+    static void operator delete(void *p, size_t size); // not from the heap
 };
-Pool<AnonIface> AnonIface::pool;
-uint32_t AnonIface::maxid = 0;
 
 ostream& operator<< (ostream& out, const Iface& iface) {
     return out << iface.addr; 
@@ -685,9 +491,14 @@ public:
 };
 
 struct NodeSet : public map<uint32_t, Node> {
-    static uint32_t nextid;
+    uint32_t nextid;		// id of next node to be added
+    NodeSet() : nextid(1) {}
     iterator get(uint32_t nodeid) { return this->find(nodeid); }
-    iterator add() { return insert(value_type(nextid++, Node())).first; }
+    // construct the Node in place; with ENABLE_TTL, Nodes can't be copied
+    iterator add() {
+	return emplace(piecewise_construct, forward_as_tuple(nextid++),
+	    forward_as_tuple()).first;
+    }
     uint32_t n_ifaces;
     uint32_t n_anon_ifaces;
     uint32_t n_redundant_ifaces;
@@ -712,16 +523,19 @@ struct NodeSet : public map<uint32_t, Node> {
 	}
     }
 };
-uint32_t NodeSet::nextid = 1;
-
-ostream& operator<< (ostream& out, const NodeSet::value_type& node) {
+static void format(OutBuf &out, const NodeSet::value_type& node) {
     IfaceVector::const_iterator i;
-    out << "node N" << node.first << ":  ";
+    out.put("node N").put(node.first).put(":  ");
     for (i = node.second.ifaces.begin(); i != node.second.ifaces.end(); ++i) {
 	if (isNamed(*i) || (isAnon(*i) && static_cast<AnonIface*>(*i)->redundant == 0))
-	    out << *(*i) << " "; 
+	    out.putAddr((*i)->addr).put(' ');
     }
-    return out;
+}
+
+ostream& operator<< (ostream& out, const NodeSet::value_type& node) {
+    OutBuf buf;
+    format(buf, node);
+    return out.write(buf.data(), buf.size());
 }
 
 typedef ivector<uint32_t, uint32_t> IdVector;
@@ -735,7 +549,8 @@ public:
 };
 
 struct LinkSet : public map<uint32_t, Link> {
-    static uint32_t nextid;
+    uint32_t nextid;		// id of next link to be added
+    LinkSet() : nextid(1) {}
     iterator get(uint32_t linkid) { return this->find(linkid); }
     iterator add() { return insert(value_type(nextid++, Link())).first; }
     uint32_t n_ifaces;
@@ -765,40 +580,41 @@ struct LinkSet : public map<uint32_t, Link> {
 	}
     }
 };
-uint32_t LinkSet::nextid = 1;
-
 struct AnonIfaceSet : public vector<AnonIface*> {
+    uint32_t maxid;		// id of last anonymous iface created
+    AnonIfaceSet() : maxid(0) {}
     uint32_t n_redundant_ifaces;
     uint32_t n_kept_ifaces;
     void calculateStats();
 };
 
-ostream& operator<< (ostream& out, const LinkSet::value_type& link) {
+static void format(OutBuf &out, const LinkSet::value_type& link) {
     IfaceVector::const_iterator i;
-    out << "link L" << link.first << ":  ";
+    out.put("link L").put(link.first).put(":  ");
     for (i = link.second.ifaces.begin(); i != link.second.ifaces.end(); ++i) {
 	if (isAnon(*i) && static_cast<AnonIface*>(*i)->redundant != 0)
 	    continue; // omit redundant anonymous iface
-	out << "N" << (*i)->nodeid << ":" << *(*i) << " "; 
+	out.put('N').put((*i)->nodeid).put(':').putAddr((*i)->addr).put(' ');
     }
     IdVector::const_iterator n;
     for (n = link.second.nodes.begin(); n != link.second.nodes.end(); ++n) {
-	out << "N" << (*n) << " "; 
+	out.put('N').put(*n).put(' ');
     }
-    return out;
 }
 
-typedef set<NamedIface*, iface_less_than> NamedIfaceSet;
+ostream& operator<< (ostream& out, const LinkSet::value_type& link) {
+    OutBuf buf;
+    format(buf, link);
+    return out.write(buf.data(), buf.size());
+}
 
-static NamedIfaceSet namedIfaces;	// set of observed named interfaces
-static NodeSet nodes;
-static LinkSet links;
-static AnonIfaceSet anonIfaces;		// set of observed anonymous interfaces
+typedef set<NamedIface*, iface_less_than> NamedIfaceSet;
 
 struct OrderedAddrPair {
     ip4addr_t addr[2];
-    OrderedAddrPair(ip4addr_t a, ip4addr_t b) {
-	if (!cfg.bug_swap_dstlink || a < b) {
+    // If ordered, the lower address goes first; otherwise a goes first.
+    OrderedAddrPair(ip4addr_t a, ip4addr_t b, bool ordered) {
+	if (!ordered || a < b) {
 	    addr[0] = a; addr[1] = b;
 	} else {
 	    addr[0] = b; addr[1] = a;
@@ -808,10 +624,32 @@ struct OrderedAddrPair {
 	return this->addr[0] != b.addr[0] ? addr_less_than(this->addr[0], b.addr[0]) :
 	    addr_less_than(this->addr[1], b.addr[1]);
     }
+    bool operator== (const OrderedAddrPair &b) const {
+	return this->addr[0] == b.addr[0] && this->addr[1] == b.addr[1];
+    }
 };
 
-typedef set<OrderedAddrPair> OrderedAddrPairSet;
-static OrderedAddrPairSet dstlinks;	// set of hop pairs where 2nd is dest
+// A set of OrderedAddrPairs, stored more compactly than a std::set.  Pairs
+// are appended to a flat array, which is sorted and deduplicated in batches
+// whenever it doubles in size.  After compact(), it is a sorted array of
+// unique pairs.
+class OrderedAddrPairVec : public vector<OrderedAddrPair> {
+    static const size_t MINBATCH = 65536;
+    size_t n_sorted; // number of sorted unique pairs at start of array
+public:
+    OrderedAddrPairVec() : n_sorted(0) {}
+    void append(const OrderedAddrPair &p) {
+	push_back(p);
+	if (size() >= 2 * n_sorted + MINBATCH) compact();
+    }
+    void compact() {
+	sort(begin() + n_sorted, end());
+	inplace_merge(begin(), begin() + n_sorted, end());
+	erase(unique(begin(), end()), end());
+	n_sorted = size();
+    }
+    void free() { vector<OrderedAddrPair>().swap(*this); n_sorted = 0; }
+};
 
 // An inferred subnet, with its range of observed addresses
 struct InfSubnet {
@@ -823,16 +661,18 @@ public:
     bool used_right; // true if this was used to make an alias inference
     bool used_left; // true if this was used to make an alias inference
     NamedIfaceSet::const_iterator begin;
+    NamedIfaceSet::const_iterator end; // no iface at or after end is in subnet
     unsigned n_traces;
     float cmpltness; // completeness
     InfSubnet(ip4addr_t _addr, uint8_t _len) :
-	prefix(netPrefix(_addr, _len)), len(_len), pointToPoint(_len>=30), n_traces(0) { }
+	prefix(netPrefix(_addr, _len)), len(_len), pointToPoint(_len>=30),
+	used_right(false), used_left(false), n_traces(0) { }
     InfSubnet(NamedIfaceSet::const_iterator _begin, NamedIfaceSet::const_iterator _end,
 	uint8_t _len, float _cmpltness);
     ip4addr_t addr() const { return prefix; }
     bool contains(ip4addr_t _addr) const { return netPrefix(_addr, len) == prefix; }
     bool contains(NamedIfaceSet::const_iterator next) const {
-	return next != namedIfaces.end() && this->contains((*next)->addr);
+	return next != end && this->contains((*next)->addr);
     }
     NamedIfaceSet::const_iterator last() const {
 	NamedIfaceSet::const_iterator i = begin;
@@ -853,9 +693,8 @@ ostream& operator<< (ostream &out, const InfSubnet &s) {
 inline InfSubnet::InfSubnet(NamedIfaceSet::const_iterator _begin,
     NamedIfaceSet::const_iterator _end, uint8_t _len, float _cmpltness) :
     prefix(netPrefix((*_begin)->addr, _len)), len(_len), pointToPoint(_len>=30),
-    begin(_begin), n_traces(0), cmpltness(_cmpltness)
+    used_right(false), used_left(false), begin(_begin), end(_end), n_traces(0), cmpltness(_cmpltness)
 {
-    debugsubnet << "# found subnet at " << *this << '\n';
 }
 
 struct infsubnet_less_than {
@@ -867,6 +706,9 @@ struct infsubnet_less_than {
 };
 
 struct infsubnet_rank {
+    bool s30_beats_s31;		// cfg.s30_beats_s31
+    explicit infsubnet_rank(bool s30_beats_s31_) :
+	s30_beats_s31(s30_beats_s31_) {}
     bool operator()(const InfSubnet * const &a, const InfSubnet * const &b)
     const {
 	if (a->len == 31 && b->len == 31) {
@@ -879,7 +721,7 @@ struct infsubnet_rank {
 		a->n_traces != b->n_traces ? a->n_traces > b->n_traces :
 		a->len != b->len ? a->len > b->len :
 		a->addr() < b->addr(); // just to make this a total ordering
-	} else if (cfg.s30_beats_s31 && (a->len == 30 || b->len == 30)) {
+	} else if (s30_beats_s31 && (a->len == 30 || b->len == 30)) {
 	    // one subnet is a /31 and the other is /30
 	    return a->len == 30;
 	} else {
@@ -892,53 +734,237 @@ struct infsubnet_rank {
 typedef set<InfSubnet*, infsubnet_less_than> SubnetSet;
 typedef vector<InfSubnet*> SubnetVec;
 
-struct AnonSeg {	// anonymous trace segment
-    const ip4addr_t lo;	// addr of lower neighboring named iface
-    const ip4addr_t hi;	// addr of higher neighboring named iface
-    const short length;	// number of anonymous hops
-    const uint32_t loAnon;	// index of anonIfaces entry of anonymous hop next to lo
-    AnonSeg(ip4addr_t lo_, ip4addr_t hi_, int length_, uint32_t idx = 0xFFFFFFFF) :
-	lo(lo_), hi(hi_), length(length_), loAnon(idx) { }
-    static void * operator new(size_t size) { return pool.alloc(size); }
-    static void operator delete(void *p, size_t size) { pool.free(p, size); }
-    static void freeall() { pool.freeall(); }
-private:
-    static Pool<AnonSeg> pool;
+
+struct IfaceAddrHash {
+    size_t operator()(const Iface * const i) const { return i->addr; }
 };
-Pool<AnonSeg> AnonSeg::pool;
 
-struct AnonSegHash {
-    size_t operator()(const AnonSeg * const s) const {
-	return ((s->lo >> 16) | (s->lo << 16)) ^ s->hi ^ s->length;
+struct IfaceAddrEqual {
+    bool operator()(const Iface * const a, const Iface * const b) const {
+	return a->addr == b->addr;
     }
 };
 
-struct AnonSegEqual {
-    bool operator()(const AnonSeg * const a, const AnonSeg * const b) const {
-	return a->lo == b->lo && a->hi == b->hi && a->length == b->length;
-    }
+typedef UNORDERED_NAMESPACE::unordered_set<Iface*, IfaceAddrHash, IfaceAddrEqual> IfaceAddrIndex;
+
+// A line of an alias file (unlike AddrPair, keeps the addresses' order)
+struct AliasLine {
+    ip4addr_t addr[2];
+    AliasLine(ip4addr_t a, ip4addr_t b) { addr[0] = a; addr[1] = b; }
+};
+
+// The lines of a piece of an alias file, parsed by one thread
+struct AliasSlice {
+    vector<AliasLine> pairs;	// pairs of non-bogon addresses, in file order
+    vector<ip4addr_t> singles;	// first addresses of pairs with a bogon second
+    size_t n_lines;		// number of lines in the piece
+    size_t error_line;		// line (in the piece) of the first error
+    string error;		// the first error, if any
+    AliasSlice() : n_lines(0), error_line(0) {}
 };
 
-typedef UNORDERED_NAMESPACE::unordered_set<AnonSeg*, AnonSegHash, AnonSegEqual> AnonSegSet;
+// The state of one run of kapar:  its configuration, the loaded and inferred
+// topology, the pools from which its interfaces and anonymous segments are
+// allocated, its id counters, and its output files.  Contexts are independent
+// of each other, so one process can hold several (e.g., to analyze different
+// regions or configurations); each may be used by only one thread at a time.
+class KaparContext {
+    friend class MyPathLoaderHandler;
+    friend class ExtractHandler;
+    friend class Kapar;
+public:
+    Cfg cfg;
+    PathLoader pathLoader;
+    ofstream out_log;
+    MemoryInfo memoryInfo;	// resource usage at the end of each phase
+    ostream *out_warn;		// warnings: cerr, or the log in the library
+private:
+    OutFile out_aliases;
+    OutFile out_links;
+    OutFile out_ifaces;
+    OutFile out_topo;
+    ofstream out_subnets;
+    ofstream out_addrs;
+    ofstream out_missing;
+#if 0
+    ofstream out_ptp;
+#endif
+#ifdef HAVE_PTHREAD
+    pthread_t ownerThread;	// thread that created the context
+    bool inParallel;		// the owner is running parallelFor()
+#endif
+    Pool<NamedIface> namedIfacePool;
+    Pool<AnonIface> anonIfacePool;
+    Pool<AnonSeg> anonSegPool;
+    SpillArena *spillArena;	// arena for --memory-budget, or NULL; made
+				// current by the public entry points
+    NamedIfaceSet namedIfaces;	// set of observed named interfaces
+    NodeSet nodes;
+    LinkSet links;
+    AnonIfaceSet anonIfaces;	// set of observed anonymous interfaces
+    OrderedAddrPairVec dstlinks; // set of hop pairs where 2nd is dest
+    NetPrefixSet *badSubnets;	// set of subnets that can't exist
+    DstFilter dstFilter;	// destinations of traces to load, if any given
+    NetPrefixSet bogons;	// set of nonroutable prefixes
+    SubnetSet *subnets;		// set of inferred subnets
+    SubnetVec *rankedSubnets;	// inferred subnets, ranked
+    AnonSegSet anonSegs;	// anonymous trace segments
+    vector<ip4addr_t> subnetMids; // missing addrs in middle of subnets
+    IfaceAddrIndex *nodeMembers; // named ifaces that belong to a node
+				// (maintained until aliases are found)
+    vector<pair<uint32_t, const Iface*> > subnetNodeIds; // for verifySubnet()
+#ifdef ENABLE_TTL
+    ttlVec subnet_min_ttl, subnet_max_ttl; // for verifySubnet()
+#endif
+    unsigned n_anon;		// number of anonymous hops
+    unsigned n_total_hops;
+    uint64_t n_traceids;	// number of ids added to ifaces' trace id sets
+    // progress of loadTraces, for the progress reporter
+    ProgressCounter progressHops, progressIfaces, progressAnonSegs;
+    unsigned n_bad_31_traces;
+    unsigned n_not_min_mask;
+    unsigned n_not_min_net;
+    unsigned n_same_min_net;
+    unsigned n_named_prev;	// number of objects in NamedIface.prev
+    unsigned n_named_next;	// number of objects in NamedIface.next
+    unsigned n_anon_prev;	// number of objects in AnonIface.prev
+    KaparContext(const KaparContext&); // no copying
+    KaparContext &operator=(const KaparContext&);
+
+public:
+    KaparContext();
+    ~KaparContext();
+    // Run kapar with the command line argv; returns the exit status.
+    int run(int argc, char *argv[]);
+    string outfileName(const string &suffix);
+    // Log the loading counters, when memory has run out.
+    void logOutOfMemory();
 
+private:
+    ostream &debugChannel();
+    // ::parallelFor() with cfg.n_threads threads.  While it runs, the debug
+    // output of every thread, including the owner, is buffered, and each
+    // slice's output is in the log by the time its slice is done.
+    template<class Fn>
+    void parallelFor(size_t n, size_t n_slices, Fn fn) {
+#ifdef HAVE_PTHREAD
+	inParallel = true;
+	::parallelFor(cfg.n_threads, n, n_slices,
+	    [&](size_t begin, size_t end, size_t slice) {
+		fn(begin, end, slice);
+		DebugBuffer::current().flushToLog();
+	    });
+	inParallel = false;
+#else
+	::parallelFor(cfg.n_threads, n, n_slices, fn);
+#endif
+    }
+    bool debugEnabled(DebugCategory cat) const { return cfg.debugEnabled[cat]; }
+    AnonIface *newAnonIface();
+    bool isBogus(const ip4addr_t addr);
+    ExplicitIface *findIface(ip4addr_t addr);
+    NamedIface *findOrInsertNamedIface(ip4addr_t addr);
+    inline const Iface *findNodeMember(ip4addr_t addr);
+    inline bool areKnownAliases(const Iface *a, const Iface *b);
+    inline bool areKnownAliases(const Iface *a, ip4addr_t b);
+    void markRedundantAnon(vector<pair<uint32_t, uint32_t> > &bylink,
+	vector<uint32_t> &eligible, vector<bool> &removed, const Node &node);
+    void markRedundantAnon();
+    void loadTraces(const char *filename);
+    void addTraces(const KaparTrace *traces, size_t n);
+    void logLoadedTraces(int n_traces);
+    void matchAnonymousIfaces();
+    void packSpilled();
+    bool verifySubnet(NamedIfaceSet::const_iterator begin, int len);
+    void findSmallerSubnets(
+	NamedIfaceSet::const_iterator begin, NamedIfaceSet::const_iterator end,
+	int len, bool verified);
+    void findSubnets();
+#ifdef ENABLE_TTL
+    inline void getTTLArrays(const NamedIface *iface,
+	const ttlVec **min_ttl, const ttlVec **max_ttl);
+    bool aliasDistanceCondition(const Iface * const a, const Iface * const b);
+#endif
+    inline void getAliasArrays(const ExplicitIface * const &iface,
+	const Iface *const * &aliases, int &size);
+    bool aliasNoLoopCondition(const ExplicitIface * const a, const ExplicitIface * const b);
+    InfSubnet *commonSubnet(ip4addr_t a, ip4addr_t b, InfSubnet * const base);
+    inline bool sameSubnet(ip4addr_t a, ip4addr_t b, InfSubnet * base);
+    void addIfaceToNode(NodeSet::iterator node, Iface *iface);
+    void setAlias(Iface * const a, Iface * const b);
+    void addIfaceToLink(LinkSet::iterator &link, Iface *iface);
+    void setLink(Iface * const a, Iface * const b);
+    void setLink(InfSubnet *s);
+    void setLink(Iface * const a, const NodeSet::const_iterator &n);
+    void markNonP2P(InfSubnet *s);
+    void findAliases(bool pointToPoint);
+    void link_i1_to_n2(Iface *i1, Iface *i2);
+    void findLinks(void);
+    void fixOrphans(void);
+    void printNodeLinkCounts(const char *label);
+    void loadIfaces(const char *filename);
+    void parseAliases(char *begin, char *end, AliasSlice &slice);
+    void loadAliases(const char *filename);
+#ifdef ENABLE_TTL
+    void updateTTL(int srcId, NamedIface *iface, short ttl);
+    void readTTLs(const char *filename, vector<TTLReading> &readings);
+    void loadTTLs();
+#endif
+    void printHeader(ostream &out, char *argv[]);
+    void printLoadOptions(ostream &out);
+    void openOutfile(ofstream &out, const string &suffix, char *argv[]);
+    void openOutfile(OutFile &out, const string &suffix, char *argv[]);
+    void openResultFiles(char *argv[]);
+    void buildTopology(KaparTopology &topo);
+    void writeTopology(OutFile &out, char *argv[]);
+    void writeState(const char *filename, char *argv[]);
+    void loadState(const char *filename);
+    template<class It> void writeLines(OutFile &out, It begin, It end);
+    bool needTraceIDs();
+    size_t countInputFiles();
+    void runSweep(char *argv[]);
+    bool canExtractFast();
+    void findMissingMiddles(const ip4addr_t *begin, const ip4addr_t *end,
+	int len, vector<ip4addr_t> &mids) const;
+    void loadTracesFast(AddrBitmap *addrs);
+    void writeExtracted(const AddrBitmap *addrs);
+    void parseOptions(int argc, char *argv[]);
+    void setup(int argc, char *argv[]);
+    void loadInputs();
+    void finishLoading(char *argv[]);
+    void analyze(char *argv[]);
+};
 
-static NetPrefixSet *badSubnets = 0;	// set of subnets that can't exist
-static NetPrefixSet bogons;		// set of nonroutable prefixes
-static SubnetSet *subnets = 0;		// set of inferred subnets
-static SubnetVec *rankedSubnets = 0;	// inferred subnets, ranked
-static AnonSegSet anonSegs;		// anonymous trace segments
-static vector<ip4addr_t> subnetMids;	// missing addrs in middle of subnets
-static unsigned n_anon = 0;		// number of anonymous hops
-static unsigned n_total_hops = 0;
-static unsigned n_bad_31_traces = 0;
-static unsigned n_not_min_mask = 0;
-static unsigned n_not_min_net = 0;
-static unsigned n_same_min_net = 0;
-static unsigned n_named_prev = 0;	// number of objects in NamedIface.prev
-static unsigned n_named_next = 0;	// number of objects in NamedIface.next
-static unsigned n_anon_prev = 0;	// number of objects in AnonIface.prev
+// Debug output channel of the current thread.  Outside of parallelFor(), the
+// thread that owns the context writes directly to its out_log, so its debug
+// output stays in order with the rest of the log.
+ostream &KaparContext::debugChannel()
+{
+#ifdef HAVE_PTHREAD
+    if (inParallel || !pthread_equal(pthread_self(), ownerThread)) {
+	DebugBuffer &buf = DebugBuffer::current();
+	if (buf.log != &out_log) {
+	    if (buf.log) buf.flushToLog();
+	    buf.log = &out_log;
+	}
+	if (buf.tellp() >= DebugBuffer::FLUSHSIZE)
+	    buf.flushToLog();
+	return buf;
+    }
+#endif
+    return out_log;
+}
 
-static void addIfaceToNode(NodeSet::iterator node, Iface *iface);
+AnonIface *KaparContext::newAnonIface()
+{
+    uint32_t id = ++anonIfaces.maxid;
+    if (id & AnonIface::NETMASK) {
+	cerr << "ERROR: anonymous addresses exceed " <<
+	    ip4addr_t(AnonIface::PREFIX) << "/" << AnonIface::MASKLEN << endl;
+	abort();
+    }
+    return new (anonIfacePool) AnonIface(ip4addr_t(id | AnonIface::PREFIX));
+}
 
 static inline bool samePrefix(const ip4addr_t &a, const ip4addr_t &b, const int &len)
 {
@@ -946,12 +972,9 @@ static inline bool samePrefix(const ip4addr_t &a, const ip4addr_t &b, const int
 }
 
 
-static bool isBogus(const ip4addr_t addr)
+bool KaparContext::isBogus(const ip4addr_t addr)
 {
-    // assumes that bogons contains only the largest prefixes
-    NetPrefix key(addr, 32);
-    NetPrefixSet::const_iterator it = bogons.upper_bound(key);
-    return (it != bogons.begin() && (*--it).contains(addr));
+    return bogons.covers(addr);
 }
 
 static inline int commonPrefixLen(const ip4addr_t &a, const ip4addr_t &b)
@@ -979,7 +1002,7 @@ static int maxSubnetLen(ip4addr_t a, ip4addr_t b)
     return len;
 }
 
-static ExplicitIface *findIface(ip4addr_t addr)
+ExplicitIface *KaparContext::findIface(ip4addr_t addr)
 {
     if (isAnon(addr))
 	return anonIfaces[(addr & ~AnonIface::NETMASK) - 1];
@@ -1006,28 +1029,27 @@ void AnonIfaceSet::calculateStats() {
     }
 }
 
-static void dump(ostream &out, const ExplicitIface *iface)
+static void format(OutBuf &out, const ExplicitIface *iface)
 {
-    out << iface->addr;
+    out.putAddr(iface->addr);
     if (iface->nodeid)
-	out << " N" << iface->nodeid;
+	out.put(" N").put(iface->nodeid);
     if (iface->linkid)
-	out << " L" << iface->linkid;
+	out.put(" L").put(iface->linkid);
     if (iface->seen_as_transit)
-	out << " T";
+	out.put(" T");
     if (iface->seen_as_dest)
-	out << " D";
-    out << endl;
+	out.put(" D");
 }
 
-static NamedIface *findOrInsertNamedIface(ip4addr_t addr)
+NamedIface *KaparContext::findOrInsertNamedIface(ip4addr_t addr)
 {
     NamedIface key(addr);
     NamedIface *iface;
 
     NamedIfaceSet::const_iterator iit = namedIfaces.lower_bound(&key);
     if (iit == namedIfaces.end() || (*iit)->addr != key.addr) {
-	iface = new NamedIface(addr); // new interface
+	iface = new (namedIfacePool) NamedIface(addr); // new interface
 	namedIfaces.insert(iit, iface);
     } else {
 	iface = (*iit); // known interface
@@ -1035,7 +1057,20 @@ static NamedIface *findOrInsertNamedIface(ip4addr_t addr)
     return iface;
 }
 
-static inline bool areKnownAliases(const Iface *a, const Iface *b)
+// Find the interface with address addr, if it belongs to a node.
+inline const Iface *KaparContext::findNodeMember(ip4addr_t addr)
+{
+    if (isAnon(addr)) {
+	if (addr == 0) return 0; // dummy
+	const Iface *iface = anonIfaces[(addr & ~AnonIface::NETMASK) - 1];
+	return iface->nodeid ? iface : 0;
+    }
+    Iface key(addr);
+    IfaceAddrIndex::const_iterator it = nodeMembers->find(&key);
+    return it != nodeMembers->end() ? *it : 0;
+}
+
+inline bool KaparContext::areKnownAliases(const Iface *a, const Iface *b)
 {
     if (a == b || (a->nodeid != 0 && a->nodeid == b->nodeid)) {
 	return true;
@@ -1043,51 +1078,109 @@ static inline bool areKnownAliases(const Iface *a, const Iface *b)
     return false;
 }
 
-static inline bool areKnownAliases(const Iface *a, ip4addr_t b)
+inline bool KaparContext::areKnownAliases(const Iface *a, ip4addr_t b)
 {
     if (a->addr == b) {
 	return true;
     } else if (a->nodeid) {
-	IfaceVector::const_iterator i;
-	NodeSet::const_iterator node = nodes.get(a->nodeid);
-	for (i = node->second.ifaces.begin(); i != node->second.ifaces.end(); ++i) {
-	    if ((*i)->addr == b) {
-		return true;
-	    }
-	}
+	// b can only be an alias of a if b belongs to a's node.
+	const Iface *ib = findNodeMember(b);
+	return ib && ib->nodeid == a->nodeid;
     }
     return false;
 }
 
+// Split a container into n_slices contiguous slices whose boundaries match
+// those of parallelBounds(c.size(), n_slices), and return an iterator to the
+// start of each slice, plus c.end().
+template<class C>
+static vector<typename C::iterator> sliceIterators(C &c, size_t n_slices)
+{
+    vector<size_t> bounds = parallelBounds(c.size(), n_slices);
+    vector<typename C::iterator> result;
+    result.reserve(n_slices + 1);
+    typename C::iterator it = c.begin();
+    size_t pos = 0;
+    for (size_t i = 0; i <= n_slices; ++i) {
+	for ( ; pos < bounds[i]; ++pos) ++it;
+	result.push_back(it);
+    }
+    return result;
+}
+
 // If an anonymous interface shares a link and a node with another (anonymous
 // or named) interface, we can assume that the interfaces are equivalent.  
-static void markRedundantAnon()
+// Each anonymous interface is marked as redundant with the first interface
+// (in node order) on the same link that is named or not (yet) redundant.
+void KaparContext::markRedundantAnon(vector<pair<uint32_t, uint32_t> > &bylink,
+    vector<uint32_t> &eligible, vector<bool> &removed, const Node &node)
 {
-    NodeSet::const_iterator n;
-    IfaceVector::const_iterator i, j;
-    for (n = nodes.begin(); n != nodes.end(); ++n) {
-	for (i = n->second.ifaces.begin(); i != n->second.ifaces.end(); ++i) {
-	    if (!isAnon(*i)) continue;
-	    for (j = n->second.ifaces.begin(); j != n->second.ifaces.end(); ++j) {
-		if (*i == *j) continue;
-		if ((*i)->linkid != (*j)->linkid) continue;
-		if ((isNamed(*j) || (isAnon(*j) && static_cast<AnonIface*>(*j)->redundant == 0))) {
-		    static_cast<AnonIface*>(*i)->redundant = (*j)->addr;
-		    break;
-		}
-	    }
+    const IfaceVector &ifaces = node.ifaces;
+    size_t n = ifaces.size();
+    size_t i;
+    for (i = 0; i < n && isNamed(ifaces[i]); ++i) { }
+    if (i == n) return; // no anonymous ifaces
+
+    // Group the node's ifaces by link, keeping node order within each group.
+    bylink.clear();
+    for (i = 0; i < n; ++i)
+	bylink.push_back(pair<uint32_t, uint32_t>(ifaces[i]->linkid, i));
+    sort(bylink.begin(), bylink.end());
+
+    size_t gstart, gend;
+    for (gstart = 0; gstart < n; gstart = gend) {
+	for (gend = gstart + 1; gend < n && bylink[gend].first == bylink[gstart].first; ++gend) { }
+	if (gend - gstart < 2) continue;
+	// Members of this group that are acceptable as the equivalent of
+	// another member, in node order.  A member becomes unacceptable only
+	// when it is marked redundant on its own turn, so every member after
+	// the current one is still acceptable if it was initially.
+	eligible.clear();
+	for (size_t k = gstart; k < gend; ++k) {
+	    Iface *iface = ifaces[bylink[k].second];
+	    if (isNamed(iface) || static_cast<AnonIface*>(iface)->redundant == 0)
+		eligible.push_back(bylink[k].second);
+	}
+	removed.assign(eligible.size(), false);
+	size_t first = 0; // position of first acceptable member
+	size_t self = 0;  // position of current member, if acceptable
+	for (size_t k = gstart; k < gend; ++k) {
+	    uint32_t idx = bylink[k].second;
+	    while (self < eligible.size() && eligible[self] < idx) ++self;
+	    if (!isAnon(ifaces[idx])) continue;
+	    AnonIface *anon = static_cast<AnonIface*>(ifaces[idx]);
+	    while (first < eligible.size() && removed[first]) ++first;
+	    size_t e = first;
+	    if (e < eligible.size() && eligible[e] == idx)
+		++e; // anon is the first acceptable member; use the next one
+	    if (e >= eligible.size()) continue; // no equivalent
+	    anon->redundant = ifaces[eligible[e]]->addr;
+	    if (self < eligible.size() && eligible[self] == idx)
+		removed[self] = true;
 	}
     }
 }
 
-#include "../lib/ScamperInput.h"
-#include "../lib/PathLoader.h"
-
-PathLoader pathLoader;
-
-AnonIface anonIface(ip4addr_t(0));	// dummy anonymous interface
+void KaparContext::markRedundantAnon()
+{
+    // Nodes are independent, so they can be processed in parallel.
+    size_t n_slices = cfg.n_threads * PARALLEL_SLICES_PER_THREAD;
+    vector<NodeSet::iterator> sliceIt = sliceIterators(nodes, n_slices);
+    parallelFor(nodes.size(), n_slices,
+	[&](size_t, size_t, size_t slice)
+    {
+	vector<pair<uint32_t, uint32_t> > bylink;
+	vector<uint32_t> eligible;
+	vector<bool> removed;
+	NodeSet::const_iterator n;
+	for (n = sliceIt[slice]; n != sliceIt[slice+1]; ++n)
+	    markRedundantAnon(bylink, eligible, removed, n->second);
+    });
+}
 
 class MyPathLoaderHandler : public PathLoaderHandler {
+    KaparContext &ctx;
+    AnonIface anonIface; // dummy anonymous interface
     const ip4addr_t *cached_hops; // hops in prev iteration of preprocessHops
     int n_cached_hops; // # of hops in prev iteration of preprocessHops
     int n_repeated_hops; // # of repeated hops from prev preprocessHops
@@ -1095,9 +1188,12 @@ class MyPathLoaderHandler : public PathLoaderHandler {
     int firstAnon;
     ExplicitIface *ihops[MAXHOPS];
 public:
-    MyPathLoaderHandler() :
-	PathLoaderHandler(out_log, &debugpath != &sink), cached_hops(0),
+    explicit MyPathLoaderHandler(KaparContext &ctx_) :
+	PathLoaderHandler(ctx_.out_log, ctx_.debugEnabled(DEBUG_PATH)), ctx(ctx_),
+	anonIface(ip4addr_t(0)), cached_hops(0),
 	n_cached_hops(0), n_repeated_hops(0), n_stored_hops(0) {};
+    ostream &debugChannel() { return ctx.debugChannel(); }
+    bool debugEnabled(DebugCategory cat) const { return ctx.debugEnabled(cat); }
 
     bool isBadHop(const ip4addr_t *hops, int n_hops, int i)
     {
@@ -1108,13 +1204,13 @@ public:
 	// forwards the packet to the router at hop i+1, which responds with
 	// TTL expired.  Then at TTL=i+1, the router at i+1 responds
 	// correctly.  So the real router at i+1 appears at both i and i+1.)
-	return isBogus(hops[i]) ||
-	    (cfg.oneloop_anon && i < n_hops - 1 && hops[i] == hops[i+1]);
+	return ctx.isBogus(hops[i]) ||
+	    (ctx.cfg.oneloop_anon && i < n_hops - 1 && hops[i] == hops[i+1]);
     }
 
     bool hopsAreEqual(const ip4addr_t *hops, int n_hops, int i, int j)
     {
-	return (areKnownAliases(ihops[i], ihops[j]) && ihops[i] != &anonIface);
+	return (ctx.areKnownAliases(ihops[i], ihops[j]) && ihops[i] != &anonIface);
     }
 
     void preprocessHops(const ip4addr_t *hops, int n_hops, void *strace)
@@ -1127,7 +1223,7 @@ public:
 	for (int i = 0; i < n_hops; ++i) {
 	    // note: first & last were already checked
 	    if (i > 0 && i < n_hops - 1 && isBadHop(hops, n_hops, i)) {
-		n_anon++;
+		ctx.n_anon++;
 		ihops[i] = &anonIface;
 		if (firstAnon < 0)
 		    firstAnon = i;
@@ -1140,7 +1236,7 @@ public:
 		// the first few hops from the same monitor).
 		continue;
 	    }
-	    ihops[i] = findOrInsertNamedIface(hops[i]);
+	    ihops[i] = ctx.findOrInsertNamedIface(hops[i]);
 	}
 	cached_hops = hops;
 	n_cached_hops = n_hops;
@@ -1148,8 +1244,8 @@ public:
 
     int processHops(const ip4addr_t *hops, int n_hops, ip4addr_t src, ip4addr_t dst, void *strace)
     {
-	if (&debugpath != &sink) {
-	    debugpath << "### " << pathLoader.n_good_traces << " ihops:";
+	if (debugOn(DEBUG_PATH)) {
+	    debugpath << "### " << ctx.pathLoader.n_good_traces << " ihops:";
 	    for (int j = 0; j < n_hops; ++j)
 		debugpath << " " << *ihops[j];
 	    debugpath << "\n";
@@ -1164,15 +1260,15 @@ public:
 		if (ihops[j] == &anonIface) continue; // anonymous
 		if ((hops[j] & mask31) == prefix31) {
 		    // shouldn't happen
-		    ++n_bad_31_traces;
+		    ++ctx.n_bad_31_traces;
 		    return 0;
 		}
 	    }
 	}
 
 	// test /MIN - /30 subnets
-	if (!cfg.mode_extract || cfg.min_subnet_middle_required < 30) {
-	    static const ip4addr_t mask_min(netPrefix(ip4addr_t(0xFFFFFFFF), cfg.minsubnetlen));
+	if (!ctx.cfg.mode_extract || ctx.cfg.min_subnet_middle_required < 30) {
+	    const ip4addr_t mask_min(netPrefix(ip4addr_t(0xFFFFFFFF), ctx.cfg.minsubnetlen));
 	    for (int i = 0; i < n_hops; ++i) {
 		if (ihops[i] == &anonIface) continue; // anonymous
 		ip4addr_t prefix_min(hops[i] & mask_min);
@@ -1180,40 +1276,40 @@ public:
 		    if (ihops[j] == &anonIface) continue; // anonymous
 		    // quick test: addrs don't have same first MIN bits?
 		    if ((hops[j] & mask_min) != prefix_min) {
-			++n_not_min_mask;
+			++ctx.n_not_min_mask;
 			continue; // can't be in same /MIN
 		    }
 		    // slower test: either addr would be a broadcast addr in a /MIN?
 		    int len = maxSubnetLen(hops[i], hops[j]);
-		    if (len < cfg.minsubnetlen) {
-			++n_not_min_net; // development
+		    if (len < ctx.cfg.minsubnetlen) {
+			++ctx.n_not_min_net; // development
 			continue; // not in same /MIN
 		    }
-		    ++n_same_min_net; // development
+		    ++ctx.n_same_min_net; // development
 
 		    NetPrefix key(hops[i], len);
-		    NetPrefixSet::const_iterator it = badSubnets->upper_bound(key);
+		    NetPrefixSet::const_iterator it = ctx.badSubnets->upper_bound(key);
 		    // Mark this and all larger subnets (up to /MIN) as bad, for use
 		    // in subnet accuracy condition.
 		    do {
 			NetPrefixSet::const_iterator hint = it;
-			if (it != badSubnets->begin() && (*(--it)) == key) {
+			if (it != ctx.badSubnets->begin() && (*(--it)) == key) {
 			    debugsubnet << "#     "<< key << " already known bad\n";
 			    break; // this subnet and larger are already known bad
 			}
 			debugsubnet << "#     " << key << " marked as bad\n";
 			// insert-with-hint runs in O(1) time
-			it = badSubnets->insert(hint, key);
+			it = ctx.badSubnets->insert(hint, key);
 			key.enlarge();
-		    } while (key.len >= cfg.minsubnetlen);
+		    } while (key.len >= ctx.cfg.minsubnetlen);
 		}
 	    }
 	}
 
 	// Analysis mode
-	if (!cfg.mode_extract) {
+	if (!ctx.cfg.mode_extract) {
 	    // merge duplicate anonymous ifaces
-	    if (cfg.anon_dups && firstAnon >= 0) {
+	    if (ctx.cfg.anon_dups && firstAnon >= 0) {
 		// For each sequence of anonymous interfaces with the same length
 		// and neighbors, assume the corresponding interfaces are aliases
 		// for each other, and give each a unique anonymous id.  E.g.,
@@ -1228,7 +1324,7 @@ public:
 		for (int i = firstAnon; i < n_hops; ) {
 		    int len;
 		    for (len = 1; ihops[i+len] == &anonIface; ++len);
-		    bool reversed = cfg.bug_rev_anondup && (ihops[i-1]->addr > ihops[i+len]->addr);
+		    bool reversed = ctx.cfg.bug_rev_anondup && (ihops[i-1]->addr > ihops[i+len]->addr);
 		    debuganon << "# anon seg: " << *ihops[i-1] <<
 			" (" << len << ") " << *ihops[i+len];
 		    ip4addr_t lo, hi;
@@ -1242,42 +1338,42 @@ public:
 			start = i;  inc = +1;  stop = i+len;
 		    }
 		    AnonSeg key(lo, hi, len);
-		    AnonSegSet::iterator sit = anonSegs.find(&key);
-		    if (sit != anonSegs.end()) {
+		    AnonSegSet::iterator sit = ctx.anonSegs.find(&key);
+		    if (sit != ctx.anonSegs.end()) {
 			debuganon << " (repeat)\n";
 			// found existing matching segment.
 			// anonIfaces are allocated and numbered sequentially.
 			uint32_t idx = (*sit)->loAnon;
 			for (int j = start; j != stop; j += inc) {
-			    ihops[j] = anonIfaces[idx++];
+			    ihops[j] = ctx.anonIfaces[idx++];
 			}
 		    } else {
 			// This is a new anonymous segment
-			uint32_t total_anon = AnonIface::maxid + len;
+			uint32_t total_anon = ctx.anonIfaces.maxid + len;
 			if (total_anon & AnonIface::NETMASK) {
-			    cerr << "Error: too many anonymous hops (" <<
-				total_anon << ")" << endl;
-			    exit(1);
+			    throw runtime_error("Error: too many anonymous hops (" +
+				to_string(total_anon) + ")");
 			}
-			AnonSeg *seg = new AnonSeg(lo, hi, len, AnonIface::maxid);
-			AnonIface *anon = new AnonIface();
+			AnonSeg *seg = new (ctx.anonSegPool)
+			    AnonSeg(lo, hi, len, ctx.anonIfaces.maxid);
+			AnonIface *anon = ctx.newAnonIface();
 			debuganon << " (new) " << *anon << "\n";
 			ihops[start] = anon;
-			anonIfaces.push_back(anon);
+			ctx.anonIfaces.push_back(anon);
 			if (len > 1) {
 			    for (int j = start + inc; j != stop; j += inc) {
-				ihops[j] = anon = new AnonIface();
-				anonIfaces.push_back(anon);
+				ihops[j] = anon = ctx.newAnonIface();
+				ctx.anonIfaces.push_back(anon);
 			    }
 			}
-			anonSegs.insert(seg);
+			ctx.anonSegs.insert(seg);
 		    }
 		    // find next anonymous segment in this trace
 		    for (i += len + 1; i < n_hops && ihops[i] != &anonIface; ++i);
 		}
 	    }
 
-	    int firstTransit = (pathLoader.include_src && hops[0] == src) ? 1 : 0;
+	    int firstTransit = (ctx.pathLoader.include_src && hops[0] == src) ? 1 : 0;
 	    for (int i = firstTransit; i < n_hops - (badTail==0); i++) {
 		ihops[i]->seen_as_transit = true;
 	    }
@@ -1285,15 +1381,16 @@ public:
 	    // if last hop is the destination...
 	    if (n_hops > 0 && badTail == 0 && hops[n_hops-1] == dst) {
 		ihops[n_hops-1]->seen_as_dest = true;
-		if (!cfg.infer_links) {
+		if (!ctx.cfg.infer_links) {
 		    // create Node now
 		    if (ihops[n_hops-1]->nodeid == 0)
-			addIfaceToNode(nodes.add(), ihops[n_hops-1]);
+			ctx.addIfaceToNode(ctx.nodes.add(), ihops[n_hops-1]);
 		} else if (n_hops > 1 /*&& ihops[n_hops-2] != &anonIface*/) {
 		    // Store info needed to create Link and Node in findLinks().
 		    // This is more compact than actually creating Links and Nodes
 		    // now, leaving more memory free for findAliases().
-		    dstlinks.insert(OrderedAddrPair(ihops[n_hops-2]->addr, ihops[n_hops-1]->addr));
+		    ctx.dstlinks.append(OrderedAddrPair(ihops[n_hops-2]->addr,
+			ihops[n_hops-1]->addr, ctx.cfg.bug_swap_dstlink));
 		}
 		// Don't use destination in normal alias/link inference,
 		// because destinations are not necessarily on the interface
@@ -1322,7 +1419,7 @@ public:
 			if (it == iface->prev.end() || (*it) != psKey) {
 			    // if (iface->prev.capacity() == 0) iface->prev.reserve(2);
 			    iface->prev.insert(it, psKey);
-			    ++n_anon_prev;
+			    ++ctx.n_anon_prev;
 			}
 		    }
 		    continue;
@@ -1331,16 +1428,16 @@ public:
 		if (i > 0 && i >= n_repeated_stores) {
 		    // store previous 2 hops in ihops[i].prev, if not already stored
 		    PathSegVec<2>::iterator it;
-		    PathSeg<2> psKey(ihops[i-1]->addr, i>1 && cfg.infer_aliases ? ihops[i-2]->addr : ip4addr_t(0));
+		    PathSeg<2> psKey(ihops[i-1]->addr, i>1 && ctx.cfg.infer_aliases ? ihops[i-2]->addr : ip4addr_t(0));
 		    it = lower_bound(iface->prev.begin(), iface->prev.end(),
 			psKey, pathseg_less_than<2>());
 		    if (it == iface->prev.end() || (*it) != psKey) {
 			// if (iface->prev.capacity() == 0) iface->prev.reserve(2);
 			iface->prev.insert(it, psKey);
-			++n_named_prev;
+			++ctx.n_named_prev;
 		    }
 		}
-		if (i < n_hops - 1 && i >= n_repeated_stores - 1 && cfg.infer_aliases) {
+		if (i < n_hops - 1 && i >= n_repeated_stores - 1 && ctx.cfg.infer_aliases) {
 		    // store next hop in iface.next, if not already stored
 		    PathSegVec<1>::iterator it;
 		    PathSeg<1> psKey(ihops[i+1]->addr);
@@ -1349,31 +1446,134 @@ public:
 		    if (it == iface->next.end() || (*it) != psKey) {
 			// if (iface->next.capacity() == 0) iface->next.reserve(2);
 			iface->next.insert(it, psKey);
-			++n_named_next;
+			++ctx.n_named_next;
 		    }
 		}
 	    }
 	    n_stored_hops = (hops == cached_hops) ? n_hops : 0;
 	}
 
-	++pathLoader.n_good_traces;
-	if (cfg.need_traceids) {
+	++ctx.pathLoader.n_good_traces;
+	if (ctx.cfg.need_traceids) {
 	    for (int i = 0; i < n_hops; i++) {
 		if (ihops[i]->addr == 0) continue; // dummy
-		ihops[i]->traces.append(pathLoader.n_good_traces);
+		ihops[i]->traces.append(ctx.pathLoader.n_good_traces);
+		++ctx.n_traceids;
 	    }
 	}
 
+	ctx.n_total_hops += n_hops;
+	ctx.progressHops.set(ctx.n_total_hops);
+	ctx.progressIfaces.set(ctx.namedIfaces.size() + ctx.anonIfaces.size());
+	ctx.progressAnonSegs.set(ctx.anonSegs.size());
+	return 1;
+    }
+};
+
+// Handler for the fast path of -x (see loadTracesFast()), which records only the
+// addresses of the hops, in a bitmap shared by the loaders of all files.  It
+// accepts and discards the same hops and traces as MyPathLoaderHandler.
+class ExtractHandler : public PathLoaderHandler {
+    KaparContext &ctx;
+    PathLoader &loader;
+    AddrBitmap &addrs;
+    const ip4addr_t *firstHop;	// hops of the current trace
+    bool anon[MAXHOPS];		// is hop treated as anonymous?
+    uint64_t sentTraces, sentBytes, sentHops; // progress added to ctx's
+public:
+    unsigned n_anon, n_total_hops, n_bad_31_traces;
+    ExtractHandler(KaparContext &ctx_, PathLoader &loader_, AddrBitmap &addrs_,
+	ostream &warn_) :
+	PathLoaderHandler(warn_), ctx(ctx_), loader(loader_), addrs(addrs_),
+	firstHop(0), sentTraces(0), sentBytes(0), sentHops(0),
+	n_anon(0), n_total_hops(0), n_bad_31_traces(0) {}
+
+    // Add this loader's progress to the context's progress counters, which
+    // are shared by the loaders of all files.
+    void sendProgress()
+    {
+	uint64_t traces = loader.progress_traces.get();
+	uint64_t bytes = loader.progress_bytes.get();
+	ctx.pathLoader.progress_traces.addShared(traces - sentTraces);
+	ctx.pathLoader.progress_bytes.addShared(bytes - sentBytes);
+	ctx.progressHops.addShared(n_total_hops - sentHops);
+	sentTraces = traces;
+	sentBytes = bytes;
+	sentHops = n_total_hops;
+    }
+
+    bool isBadHop(const ip4addr_t *hops, int n_hops, int i)
+    {
+	return ctx.isBogus(hops[i]) ||
+	    (ctx.cfg.oneloop_anon && i < n_hops - 1 && hops[i] == hops[i+1]);
+    }
+
+    void preprocessHops(const ip4addr_t *hops, int n_hops, void *)
+    {
+	firstHop = hops;
+	for (int i = 0; i < n_hops; ++i) {
+	    // note: first & last were already checked
+	    anon[i] = (i > 0 && i < n_hops - 1 && isBadHop(hops, n_hops, i));
+	    if (anon[i])
+		++n_anon;
+	    else
+		addrs.add(hops[i]);
+	}
+    }
+
+    bool hopsAreEqual(const ip4addr_t *hops, int, int i, int j)
+    {
+	return hops[i] == hops[j] && !anon[i] && !anon[j];
+    }
+
+    int processHops(const ip4addr_t *hops, int n_hops, ip4addr_t, ip4addr_t, void *)
+    {
+	// check for non-neighboring hops with the same /31 prefix
+	const bool *hanon = anon + (hops - firstHop);
+	const ip4addr_t mask31(0xFFFFFFFE);
+	for (int i = 0; i < n_hops - 2; i++) {
+	    if (hanon[i]) continue;
+	    ip4addr_t prefix31(hops[i] & mask31);
+	    for (int j = i + 2; j < n_hops; ++j) {
+		if (!hanon[j] && (hops[j] & mask31) == prefix31) {
+		    ++n_bad_31_traces;
+		    return 0;
+		}
+	    }
+	}
+	++loader.n_good_traces;
 	n_total_hops += n_hops;
+	if ((loader.n_good_traces & 0xFFF) == 0)
+	    sendProgress();
 	return 1;
     }
 };
 
-static void loadTraces(const char *filename)
+void KaparContext::loadTraces(const char *filename)
 {
     out_log << "# loadTraces: " << filename << endl;
-    int n_traces = pathLoader.load(filename);
+    logLoadedTraces(pathLoader.load(filename));
+}
+
+// Load a batch of traces given through the library API.
+void KaparContext::addTraces(const KaparTrace *traces, size_t n)
+{
+    out_log << "# loadTraces: batch of " << n << " traces" << endl;
+    int n_traces = 0;
+    ip4addr_t hops[MAXHOPS];
+    for (size_t i = 0; i < n; ++i) {
+	const KaparTrace &t = traces[i];
+	for (int j = 0; j < t.n_hops && j < MAXHOPS; ++j)
+	    hops[j] = ip4addr_t(t.hops[j]);
+	// (loadTrace discards a trace with too many hops)
+	n_traces += pathLoader.loadTrace(ip4addr_t(t.src), ip4addr_t(t.dst),
+	    hops, t.n_hops);
+    }
+    logLoadedTraces(n_traces);
+}
 
+void KaparContext::logLoadedTraces(int n_traces)
+{
     out_log << "# traces=" << n_traces <<
 	"/" << pathLoader.n_good_traces <<
 	"/" << pathLoader.n_raw_traces <<
@@ -1381,16 +1581,18 @@ static void loadTraces(const char *filename)
 	" discarded=" << pathLoader.n_discarded_traces <<
 	" namedIfaces=" << namedIfaces.size() <<
 	" anon=" << n_anon <<
-	" uniq_anon=" << AnonIface::maxid <<
+	" uniq_anon=" << anonIfaces.maxid <<
 	" hops=" << n_total_hops <<
 	" anonSegs=" << anonSegs.size() <<
 	endl;
 #if 1
     uint64_t mem_named_prev = 0, mem_named_next = 0, mem_anon_prev = 0;
     uint64_t idsetsize[5] = {0,0,0,0,0};
+    uint64_t idslots = 0;
     for (NamedIfaceSet::iterator it = namedIfaces.begin(); it != namedIfaces.end(); ++it) {
 	mem_named_next += (*it)->next.memory();
 	mem_named_prev += (*it)->prev.memory();
+	idslots += (*it)->traces.rawsize();
 	if ((*it)->traces.rawsize() < 4)
 	    idsetsize[(*it)->traces.rawsize()]++;
 	else
@@ -1398,6 +1600,7 @@ static void loadTraces(const char *filename)
     }
     for (AnonIfaceSet::iterator it = anonIfaces.begin(); it != anonIfaces.end(); ++it) {
 	mem_anon_prev += (*it)->prev.memory();
+	idslots += (*it)->traces.rawsize();
 	if ((*it)->traces.rawsize() < 4)
 	    idsetsize[(*it)->traces.rawsize()]++;
 	else
@@ -1406,8 +1609,8 @@ static void loadTraces(const char *filename)
     out_log << "# named_prev: n=" << n_named_prev << " mem=" << mem_named_prev << " eff=" << double(n_named_prev) * sizeof(PathSeg<2>) / mem_named_prev << endl;
     out_log << "# named_next: n=" << n_named_next << " mem=" << mem_named_next << " eff=" << double(n_named_next) * sizeof(PathSeg<1>) / mem_named_next << endl;
     out_log << "# anon_prev: n=" << n_anon_prev << " mem=" << mem_anon_prev << " eff=" << double(n_anon_prev) * sizeof(PathSeg<1>) / mem_anon_prev << endl;
-    out_log << "# TraceIDSet totalSize=" << CompactIDSet::totalSize() <<
-	" totalSlots=" << CompactIDSet::totalSlots() << endl;
+    out_log << "# TraceIDSet totalSize=" << n_traceids <<
+	" totalSlots=" << idslots << endl;
     out_log << "# TraceIDSets: " <<
 	" 0:" << idsetsize[0] <<
 	" 1:" << idsetsize[1] <<
@@ -1434,8 +1637,6 @@ void freevec(vector<T, Alloc> &v)
     tmp.clear();
 }
 
-static void setAlias(Iface * const a, Iface * const b);
-
 // For each path sequence A,*,C where the middle iface is anonymous, if there
 // are any sequences A,X,C or A,Y,C with matching endpoints, assume that * is
 // an alias for X or Y, and is thus redundant.
@@ -1443,48 +1644,91 @@ static void setAlias(Iface * const a, Iface * const b);
 // require much more memory and computation time, and would provide
 // diminishing returns.  (This 3-hop version can use the NamedIface.prev structures
 // that are already needed by findAliases().)
-static void matchAnonymousIfaces()
+void KaparContext::matchAnonymousIfaces()
 {
-    int matches = 0;
-    NamedIfaceSet::iterator iit;
-    // for each iface C
-    for (iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
-	NamedIface *ifaceC = (*iit);
-	PathSegVec<2>::iterator pit1, pit2;
-	// for each 3-hop sequence ending with C
-	for (pit1 = ifaceC->prev.begin(); pit1 != ifaceC->prev.end(); ++pit1) {
-	    if (isAnon((*pit1).hop(0)) && !isAnon((*pit1).hop(1))) {
-		// found an A,*,C sequence
-		ip4addr_t anon = (*pit1).hop(0);
-		ip4addr_t addrA = (*pit1).hop(1);
-		// for each 3-hop sequence ending with C
+    // an A,*,C sequence and the matching A,B,C sequence
+    struct AnonMatch {
+	ip4addr_t anon, addrA, addrB;
+	const NamedIface *ifaceC;
+	AnonMatch(ip4addr_t anon_, ip4addr_t a, ip4addr_t b, const NamedIface *c) :
+	    anon(anon_), addrA(a), addrB(b), ifaceC(c) {}
+    };
+    // (A, B) of a 3-hop sequence A,B,C ending with some C
+    typedef pair<ip4addr_t, ip4addr_t> PrevPair;
+    struct prevpair_less_than {
+	bool operator()(const PrevPair &a, const PrevPair &b) const
+	    { return a.first < b.first; }
+    };
+
+    size_t n_slices = cfg.n_threads * PARALLEL_SLICES_PER_THREAD;
+    vector<NamedIfaceSet::iterator> sliceIt = sliceIterators(namedIfaces, n_slices);
+    vector<vector<AnonMatch> > sliceMatches(n_slices);
+
+    // Join the anonymous-middle and named-middle sequences ending with each
+    // C on A.  Each C is independent, so Cs are processed in parallel.
+    parallelFor(namedIfaces.size(), n_slices,
+	[&](size_t, size_t, size_t slice)
+    {
+	vector<PrevPair> named; // A,B,C sequences, grouped by A
+	vector<AnonMatch> &matches = sliceMatches[slice];
+	NamedIfaceSet::iterator iit;
+	for (iit = sliceIt[slice]; iit != sliceIt[slice+1]; ++iit) {
+	    NamedIface *ifaceC = (*iit);
+	    PathSegVec<2>::iterator pit, firstNamed;
+	    // ifaceC->prev is sorted by middle hop, and anonymous addrs sort
+	    // before named addrs, so A,*,C sequences come first.
+	    for (firstNamed = ifaceC->prev.begin();
+		firstNamed != ifaceC->prev.end() && isAnon((*firstNamed).hop(0));
+		++firstNamed)
+		{ }
+	    if (firstNamed == ifaceC->prev.begin() || firstNamed == ifaceC->prev.end())
+		continue; // no A,*,C or no A,B,C
+	    // Within each A group, the B's stay in ascending order, so the
+	    // first B of a group is the same one a sequential scan of
+	    // ifaceC->prev would have found.
+	    named.clear();
+	    for (pit = firstNamed; pit != ifaceC->prev.end(); ++pit)
+		named.push_back(PrevPair((*pit).hop(1), (*pit).hop(0)));
+	    stable_sort(named.begin(), named.end(), prevpair_less_than());
+	    // for each A,*,C sequence
+	    for (pit = ifaceC->prev.begin(); pit != firstNamed; ++pit) {
+		ip4addr_t addrA = (*pit).hop(1);
+		if (isAnon(addrA)) continue;
 		// TODO: check sequences ending with any apriori aliases of C
-		for (pit2 = ifaceC->prev.begin(); pit2 != ifaceC->prev.end(); ++pit2) {
-		    ip4addr_t addrB = (*pit2).hop(0);
-		    // TODO: check equality with any apriori aliases of A
-		    if ((*pit2).hop(1) == addrA && !isAnon(addrB)) {
-			// found a matching A,B,C sequence
-			debuganon << "# anon match for " << anon << ": " <<
-			    addrA << " " << addrB << " " << *ifaceC << "\n";
-			// We can't easily find all references to anon to
-			// remove them.
-			matches++;
+		// TODO: check equality with any apriori aliases of A
+		vector<PrevPair>::const_iterator group = lower_bound(
+		    named.begin(), named.end(), PrevPair(addrA, ip4addr_t(0)),
+		    prevpair_less_than());
+		if (group == named.end() || group->first != addrA)
+		    continue;
+		// found a matching A,B,C sequence
+		matches.push_back(AnonMatch((*pit).hop(0), addrA, group->second, ifaceC));
+	    }
+	}
+    });
+
+    // Report the matches in the same order a sequential scan would find them.
+    int matches = 0;
+    for (size_t slice = 0; slice < n_slices; ++slice) {
+	vector<AnonMatch>::const_iterator mit;
+	for (mit = sliceMatches[slice].begin(); mit != sliceMatches[slice].end(); ++mit) {
+	    debuganon << "# anon match for " << mit->anon << ": " <<
+		mit->addrA << " " << mit->addrB << " " << *mit->ifaceC << "\n";
+	    // We can't easily find all references to anon to
+	    // remove them.
+	    matches++;
 #if 0
-			AnonIface *anonIface = static_cast<AnonIface*>(findIface(anon));
-			anonIface->redundant = addrB;
-			Iface *ifaceB = findIface(addrB);
-			setAlias(ifaceB, anonIface);
+	    AnonIface *anonIface = static_cast<AnonIface*>(findIface(mit->anon));
+	    anonIface->redundant = mit->addrB;
+	    Iface *ifaceB = findIface(mit->addrB);
+	    setAlias(ifaceB, anonIface);
 #endif
-			break;
-		    }
-		}
-	    }
 	}
     }
     out_log << "# found " << matches << " redundant anonymous matches" << endl;
 }
 
-static bool verifySubnet(NamedIfaceSet::const_iterator begin, int len)
+bool KaparContext::verifySubnet(NamedIfaceSet::const_iterator begin, int len)
 {
     // Accuracy condition
     // Fail if any two addrs in subnet appear as non-neighbors in any trace.
@@ -1500,7 +1744,6 @@ static bool verifySubnet(NamedIfaceSet::const_iterator begin, int len)
     // Distance condition
     // Fail if TTLs of any two addrs in subnet differ by more than 1.
     if (cfg.ttl_beats_subnet && cfg.n_ttls > 0) {
-	static ttlVec subnet_min_ttl, subnet_max_ttl;
 	subnet_min_ttl.alloc_if_needed(); // allocate once, use many times
 	subnet_max_ttl.alloc_if_needed(); // allocate once, use many times
 	subnet_min_ttl.clear();
@@ -1508,10 +1751,10 @@ static bool verifySubnet(NamedIfaceSet::const_iterator begin, int len)
 	NamedIfaceSet::iterator it;
 	for (it = begin; it != namedIfaces.end() && (*it)->addr < maxaddr; ++it) {
 	    ttlVec *iface_min_ttl, *iface_max_ttl;
-	    NodeSet::const_iterator node = nodes.get((*it)->nodeid);
-	    if (node) {
-		iface_min_ttl = &node->min_ttl;
-		iface_max_ttl = &node->max_ttl;
+	    NodeSet::iterator node = nodes.get((*it)->nodeid);
+	    if (node != nodes.end()) {
+		iface_min_ttl = &node->second.min_ttl;
+		iface_max_ttl = &node->second.max_ttl;
 	    } else {
 		iface_min_ttl = iface_max_ttl = &(*it)->ttl;
 	    }
@@ -1536,14 +1779,24 @@ static bool verifySubnet(NamedIfaceSet::const_iterator begin, int len)
 #endif
 
     // Two interfaces can't be in the same subnet if they're already aliases.
-    NamedIfaceSet::iterator i, j;
-    i = begin;
-    for (++i; i != namedIfaces.end() && (*i)->addr < maxaddr; ++i) {
-	for (j = begin; j != i; ++j) {
-	    if (areKnownAliases((*i), (*j))) {
+    // Distinct interfaces are known aliases iff they have the same nonzero
+    // nodeid, so instead of comparing every pair, we collect the nodeids
+    // and look for a duplicate.
+    typedef pair<uint32_t, const Iface*> NodeMember;
+    vector<NodeMember> &members = subnetNodeIds; // allocate once, use many times
+    members.clear();
+    NamedIfaceSet::const_iterator i;
+    for (i = begin; i != namedIfaces.end() && (*i)->addr < maxaddr; ++i) {
+	if ((*i)->nodeid)
+	    members.push_back(NodeMember((*i)->nodeid, *i));
+    }
+    if (members.size() > 1) {
+	sort(members.begin(), members.end());
+	for (size_t k = 1; k < members.size(); ++k) {
+	    if (members[k].first == members[k-1].first) {
 		debugsubnet << "# subnet " << key <<
 		    " addrs are already aliases: " <<
-		    **i << ", " << **j << "\n";
+		    *members[k-1].second << ", " << *members[k].second << "\n";
 		return false;
 	    }
 	}
@@ -1552,7 +1805,7 @@ static bool verifySubnet(NamedIfaceSet::const_iterator begin, int len)
     return true;
 }
 
-static void findSmallerSubnets(
+void KaparContext::findSmallerSubnets(
     NamedIfaceSet::const_iterator begin, NamedIfaceSet::const_iterator end,
     int len, bool verified)
 {
@@ -1572,6 +1825,7 @@ static void findSmallerSubnets(
 	    ++j; ++n;
 	}
 	if (n > 1) {
+	    bool subverified = verified;
 	    k = j; --k;
 	    debugsubnet << "# possible /" << int(len) << " subnets at " << *(*i) << " - " << *(*k) << '\n';
 	    // subnet len may be longer than common prefix len if suffix is
@@ -1612,20 +1866,31 @@ static void findSmallerSubnets(
 
 		if (good) {
 		    // don't need to verify if parent was already verified
-		    if (verified) debugsubnet << "# parent already verified\n";
-		    if (verified || verifySubnet(i, sublen))
-			subnets->insert(new InfSubnet(i, j, sublen, complt));
+		    if (verified) {
+			debugsubnet << "# parent already verified\n";
+		    }
+		    if (verified || verifySubnet(i, sublen)) {
+			InfSubnet *s = new InfSubnet(i, j, sublen, complt);
+			debugsubnet << "# found subnet at " << *s << '\n';
+			subnets->insert(s);
+			// Every condition checked by verifySubnet() that holds
+			// for this prefix also holds for all of its
+			// subprefixes (badSubnets marks all larger prefixes of
+			// a bad prefix, and nodes don't change during
+			// findSubnets()), so children need not verify again.
+			subverified = true;
+		    }
 		} else {
 		    debugsubnet << "# /" << sublen << " incomplete (" << complt << ")\n";
 		}
 	    }
 	    if (n > 2) // might contain smaller subnets
-		findSmallerSubnets(i, j, max(sublen,len) + 1, verified);
+		findSmallerSubnets(i, j, max(sublen,len) + 1, subverified);
 	}
     }
 }
 
-static void findSubnets()
+void KaparContext::findSubnets()
 {
     findSmallerSubnets(namedIfaces.begin(), namedIfaces.end(), cfg.minsubnetlen, false);
 
@@ -1643,9 +1908,9 @@ static void findSubnets()
 
     // rank subnets
     rankedSubnets = new SubnetVec(subnets->begin(), subnets->end());
-    sort(rankedSubnets->begin(), rankedSubnets->end(), infsubnet_rank());
+    sort(rankedSubnets->begin(), rankedSubnets->end(), infsubnet_rank(cfg.s30_beats_s31));
 
-    if (&debugsubnet != &sink) {
+    if (debugOn(DEBUG_SUBNET)) {
 	debugsubnet << "# sorted rankedSubnets\n";
 	SubnetVec::const_iterator rit;
 	for (rit = rankedSubnets->begin(); rit != rankedSubnets->end(); ++rit) {
@@ -1655,13 +1920,13 @@ static void findSubnets()
 }
 
 #ifdef ENABLE_TTL
-static inline void getTTLArrays(const NamedIface *iface,
+inline void KaparContext::getTTLArrays(const NamedIface *iface,
     const ttlVec **min_ttl, const ttlVec **max_ttl)
 {
     NodeSet::iterator node = nodes.get(iface->nodeid);
-    if (node) {
-	*min_ttl = &node->min_ttl;
-	*max_ttl = &node->max_ttl;
+    if (node != nodes.end()) {
+	*min_ttl = &node->second.min_ttl;
+	*max_ttl = &node->second.max_ttl;
     } else {
 	*min_ttl = *max_ttl = &iface->ttl;
     }
@@ -1669,7 +1934,7 @@ static inline void getTTLArrays(const NamedIface *iface,
 
 // False if interface a or any of its aliases is too far from interface
 // b or any of its aliases.
-static bool aliasDistanceCondition(const Iface * const a, const Iface * const b)
+bool KaparContext::aliasDistanceCondition(const Iface * const a, const Iface * const b)
 {
     if (cfg.ttl_beats_inferred_alias && cfg.n_ttls > 0) {
 	if (!isNamed(a) || !isNamed(b)) return true;
@@ -1703,7 +1968,7 @@ static bool aliasDistanceCondition(const Iface * const a, const Iface * const b)
 }
 #endif
 
-static inline void getAliasArrays(const ExplicitIface * const &iface,
+inline void KaparContext::getAliasArrays(const ExplicitIface * const &iface,
     const Iface *const * &aliases, int &size)
 {
     NodeSet::iterator node = nodes.get(iface->nodeid);
@@ -1719,7 +1984,7 @@ static inline void getAliasArrays(const ExplicitIface * const &iface,
 
 // False if interface a or any of its aliases ever appears in the same
 // trace as interface b or any of its aliases.
-static bool aliasNoLoopCondition(const ExplicitIface * const a, const ExplicitIface * const b)
+bool KaparContext::aliasNoLoopCondition(const ExplicitIface * const a, const ExplicitIface * const b)
 {
     const Iface *const *a_aliases;
     const Iface *const *b_aliases;
@@ -1755,7 +2020,7 @@ static inline bool sameSubnet(const Iface *a, const Iface *b,
 }
 #endif
 
-static InfSubnet *commonSubnet(ip4addr_t a, ip4addr_t b,
+InfSubnet *KaparContext::commonSubnet(ip4addr_t a, ip4addr_t b,
     InfSubnet * const base)
 {
     int minLen = cfg.subnet_len ? base->len : cfg.minsubnetlen;
@@ -1808,7 +2073,7 @@ static InfSubnet *commonSubnet(ip4addr_t a, ip4addr_t b,
 	    // This could be the one.
 	    if (cfg.subnet_len && (*s)->len < base->len) {
 		debugalias << "##### sameSubnet " << a << ", " << b << ": no (" << *(*s) << " larger than " << int(base->len) << ")\n";
-	    } else if (!cfg.bug_rank && cfg.subnet_rank && infsubnet_rank()(base, *s)) {
+	    } else if (!cfg.bug_rank && cfg.subnet_rank && infsubnet_rank(cfg.s30_beats_s31)(base, *s)) {
 		debugalias << "##### sameSubnet " << a << ", " << b << ": no (" << *(*s) << " worse than " << *base << ")\n";
 	    } else if (cfg.bug_rank && cfg.subnet_rank && infsubnet_less_than()(base, *s)) {
 		debugalias << "##### sameSubnet " << a << ", " << b << ": no (BUG " << *(*s) << " worse than " << *base << ")\n";
@@ -1825,17 +2090,18 @@ static InfSubnet *commonSubnet(ip4addr_t a, ip4addr_t b,
     return 0;
 }
 
-inline static bool sameSubnet(ip4addr_t a, ip4addr_t b,
+inline bool KaparContext::sameSubnet(ip4addr_t a, ip4addr_t b,
     InfSubnet * base)
 {
     return !!commonSubnet(a, b, base);
 }
 
-static void addIfaceToNode(NodeSet::iterator node, Iface *iface)
+void KaparContext::addIfaceToNode(NodeSet::iterator node, Iface *iface)
 {
     node->second.ifaces.push_back(iface);
     iface->nodeid = node->first;
     if (!isNamed(iface)) return;
+    if (nodeMembers) nodeMembers->insert(iface);
 #ifdef ENABLE_TTL
     NamedIface *niface = static_cast<NamedIface*>(iface);
     if (!node->second.min_ttl.empty() && !niface->ttl.empty()) {
@@ -1854,7 +2120,7 @@ static void addIfaceToNode(NodeSet::iterator node, Iface *iface)
 #endif
 }
 
-static void setAlias(Iface * const a, Iface * const b)
+void KaparContext::setAlias(Iface * const a, Iface * const b)
 {
     debugalias << "##### setAlias(" << *a << ", " << *b << "):  ";
     if (a->nodeid && b->nodeid) {
@@ -1918,13 +2184,13 @@ static void setAlias(Iface * const a, Iface * const b)
     }
 }
 
-static void addIfaceToLink(LinkSet::iterator &link, Iface *iface)
+void KaparContext::addIfaceToLink(LinkSet::iterator &link, Iface *iface)
 {
     link->second.ifaces.push_back(iface);
     iface->linkid = link->first;
 }
 
-static void setLink(Iface * const a, Iface * const b)
+void KaparContext::setLink(Iface * const a, Iface * const b)
 {
     debuglink << "# setLink(" << *a << ", " << *b << "):  ";
     if (a->linkid && b->linkid) {
@@ -1976,7 +2242,7 @@ static void setLink(Iface * const a, Iface * const b)
 }
 
 // Link all interfaces on the inferred subnet
-static void setLink(InfSubnet *s)
+void KaparContext::setLink(InfSubnet *s)
 {
     NamedIfaceSet::const_iterator i1, i2;
 
@@ -1992,7 +2258,7 @@ static void setLink(InfSubnet *s)
     }
 }
 
-static void setLink(Iface * const a, const NodeSet::const_iterator &n)
+void KaparContext::setLink(Iface * const a, const NodeSet::const_iterator &n)
 {
     debuglink << "# setLink(" << *a << ", " << *n << "):  ";
     if (a->linkid) {
@@ -2010,7 +2276,7 @@ static void setLink(Iface * const a, const NodeSet::const_iterator &n)
 }
 
 // Mark all subnets of an InfSubnet as NON-point-to-point
-static void markNonP2P(InfSubnet *s)
+void KaparContext::markNonP2P(InfSubnet *s)
 {
     if (!cfg.markNonP2P) return;
     ip4addr_t maxaddr = maxAddr(s->addr(), s->len);
@@ -2030,7 +2296,7 @@ static void markNonP2P(InfSubnet *s)
 // (C,D) are in the anchor subnet; (B,D) are the alias candidates.
 // Neighbor condition is either (B,E) in a subnet, or (A,E) are aliases.
 //
-static void findAliases(bool pointToPoint)
+void KaparContext::findAliases(bool pointToPoint)
 {
     SubnetVec::const_iterator s;
     NamedIfaceSet::const_iterator i1, i2;
@@ -2286,7 +2552,7 @@ static void findAliases(bool pointToPoint)
 
 // Make a link between iface i1 and an implicit iface on i2's node, unless a
 // link already exists between i1 and some iface on i2's node.
-static void link_i1_to_n2(Iface *i1, Iface *i2)
+void KaparContext::link_i1_to_n2(Iface *i1, Iface *i2)
 {
     NodeSet::iterator n2 = nodes.get(i2->nodeid);
     if (n2 == nodes.end()) {
@@ -2311,7 +2577,7 @@ static void link_i1_to_n2(Iface *i1, Iface *i2)
 }
 
 // create links that exist in paths but were missed by findAliases()
-static void findLinks(void)
+void KaparContext::findLinks(void)
 {
     // Create B->C links for each named iface C.
     for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end();
@@ -2340,24 +2606,20 @@ static void findLinks(void)
 
     // Create links for destination hops (which were omitted from iface->prev).
     if (!dstlinks.empty()) {
-	// create map: nodeid -> set of link ids the node is already on
-	map<uint32_t, CompactIDSet> node2linkset;
+	// make sure every linked iface has a node
 	LinkSet::iterator lit;
 	for (lit = links.begin(); lit != links.end(); ++lit) {
-	    uint32_t linkid = lit->first;
 	    Link *link = &lit->second;
 	    for (size_t i = 0; i < link->ifaces.size(); ++i) {
-		// first, make sure iface has a node
 		Iface *iface = link->ifaces[i];
 		if (iface->nodeid == 0) addIfaceToNode(nodes.add(), iface);
-		node2linkset[iface->nodeid].append(linkid);
-	    }
-	    for (size_t i = 0; i < link->nodes.size(); ++i) {
-		node2linkset[link->nodes[i]].append(linkid);
 	    }
 	}
-	// for each dest hop pair, create nodes and implicit links if needed
-	OrderedAddrPairSet::iterator dlit;
+	// find the nodes of each dest hop pair, creating them if needed
+	vector<pair<uint32_t, uint32_t> > dstnodes;
+	dstnodes.reserve(dstlinks.size());
+	dstlinks.compact();
+	OrderedAddrPairVec::const_iterator dlit;
 	for (dlit = dstlinks.begin(); dlit != dstlinks.end(); ++dlit) {
 	    // iface0 can be named or anonymous, but must already exist
 	    Iface *iface0 = findIface(dlit->addr[0]);
@@ -2365,22 +2627,87 @@ static void findLinks(void)
 	    Iface *iface1 = findOrInsertNamedIface(dlit->addr[1]);
 	    if (iface0->nodeid == 0) addIfaceToNode(nodes.add(), iface0);
 	    if (iface1->nodeid == 0) addIfaceToNode(nodes.add(), iface1);
-	    CompactIDSet &linkset0 = node2linkset[iface0->nodeid];
-	    CompactIDSet &linkset1 = node2linkset[iface1->nodeid];
-	    if (!linkset0.overlaps(linkset1)) {
-		// create implicit link between nodes
-		LinkSet::iterator link = links.add();
-		link->second.nodes.push_back(iface0->nodeid);
-		link->second.nodes.push_back(iface1->nodeid);
-		linkset0.append(link->first);
-		linkset1.append(link->first);
+	    dstnodes.push_back(make_pair(iface0->nodeid, iface1->nodeid));
+	}
+	dstlinks.free(); // no longer needed
+
+	// Index the links each node is already on:  the ids of node n's
+	// links are linkids[linkoff[n]] ... linkids[linkoff[n+1]-1], in
+	// ascending order (possibly with repeats).
+	vector<uint32_t> linkoff(nodes.nextid + 1, 0);
+	vector<uint32_t> linkids;
+	for (lit = links.begin(); lit != links.end(); ++lit) {
+	    Link *link = &lit->second;
+	    for (size_t i = 0; i < link->ifaces.size(); ++i)
+		++linkoff[link->ifaces[i]->nodeid + 1];
+	    for (size_t i = 0; i < link->nodes.size(); ++i)
+		++linkoff[link->nodes[i] + 1];
+	}
+	for (size_t n = 1; n < linkoff.size(); ++n)
+	    linkoff[n] += linkoff[n-1];
+	linkids.resize(linkoff.back());
+	{
+	    vector<uint32_t> fill(linkoff.begin(), linkoff.end() - 1);
+	    for (lit = links.begin(); lit != links.end(); ++lit) {
+		Link *link = &lit->second;
+		for (size_t i = 0; i < link->ifaces.size(); ++i)
+		    linkids[fill[link->ifaces[i]->nodeid]++] = lit->first;
+		for (size_t i = 0; i < link->nodes.size(); ++i)
+		    linkids[fill[link->nodes[i]]++] = lit->first;
+	    }
+	}
+
+	// For each dest hop pair, test whether the nodes already share a
+	// link.  The pairs are independent, so they are tested in parallel.
+	vector<bool> linked(dstnodes.size());
+	vector<vector<uint32_t> > linkedSlices(cfg.n_threads * PARALLEL_SLICES_PER_THREAD);
+	parallelFor(dstnodes.size(), linkedSlices.size(),
+	    [&](size_t begin, size_t end, size_t slice)
+	{
+	    for (size_t d = begin; d < end; ++d) {
+		const uint32_t *a = &linkids[0] + linkoff[dstnodes[d].first];
+		const uint32_t *aend = &linkids[0] + linkoff[dstnodes[d].first + 1];
+		const uint32_t *b = &linkids[0] + linkoff[dstnodes[d].second];
+		const uint32_t *bend = &linkids[0] + linkoff[dstnodes[d].second + 1];
+		while (a < aend && b < bend && *a != *b) {
+		    if (*a < *b) ++a; else ++b;
+		}
+		if (a < aend && b < bend)
+		    linkedSlices[slice].push_back(d); // vector<bool> isn't thread safe
+	    }
+	});
+	for (size_t slice = 0; slice < linkedSlices.size(); ++slice) {
+	    for (size_t i = 0; i < linkedSlices[slice].size(); ++i)
+		linked[linkedSlices[slice][i]] = true;
+	}
+	freevec(linkedSlices);
+	freevec(linkids);
+
+	// Create implicit links, in dstlinks order.  An implicit link created
+	// here is on exactly two nodes, so it can only make a later pair
+	// "already linked" if that pair has the same two nodes, or if that
+	// pair's two nodes are the same node.
+	vector<bool> newlyLinked(nodes.nextid, false);
+	UNORDERED_NAMESPACE::unordered_set<uint64_t> newLinks;
+	for (size_t d = 0; d < dstnodes.size(); ++d) {
+	    uint32_t n0 = dstnodes[d].first, n1 = dstnodes[d].second;
+	    if (linked[d]) continue;
+	    if (n0 == n1) {
+		if (newlyLinked[n0]) continue;
+	    } else {
+		uint64_t key = n0 < n1 ? (uint64_t(n0) << 32 | n1) : (uint64_t(n1) << 32 | n0);
+		if (!newLinks.insert(key).second) continue;
 	    }
+	    // create implicit link between nodes
+	    LinkSet::iterator link = links.add();
+	    link->second.nodes.push_back(n0);
+	    link->second.nodes.push_back(n1);
+	    newlyLinked[n0] = newlyLinked[n1] = true;
 	}
-	node2linkset.clear();
     }
 }
 
-static void fixOrphans(void)
+void KaparContext::fixOrphans(void)
 {
     // make sure all linked interfaces have a node
     Iface *iface;
@@ -2402,17 +2729,17 @@ static void fixOrphans(void)
     }
 }
 
-static void printNodeLinkCounts(const char *label)
+void KaparContext::printNodeLinkCounts(const char *label)
 {
     nodes.calculateStats();
     links.calculateStats();
     out_log << "# after " << label << ": found " <<
-	nodes.size() << " nodes (max id " << (NodeSet::nextid - 1) <<
+	nodes.size() << " nodes (max id " << (nodes.nextid - 1) <<
 	"), containing " << nodes.n_ifaces - nodes.n_redundant_ifaces << " interfaces (" <<
 	nodes.n_redundant_ifaces << " redundant (omitted), " <<
 	nodes.n_anon_ifaces << " anonymous, " <<
 	nodes.n_named_ifaces << " named); and " <<
-	links.size() << " links (max id " << (LinkSet::nextid - 1) <<
+	links.size() << " links (max id " << (links.nextid - 1) <<
 	"), containing " << links.n_ifaces - links.n_redundant_ifaces << " interfaces (" <<
 	links.n_implicit_ifaces << " implicit, " <<
 	links.n_redundant_ifaces << " redundant (omitted), " <<
@@ -2421,18 +2748,18 @@ static void printNodeLinkCounts(const char *label)
 	endl;
 }
 
-static void loadIfaces(const char *filename)
+void KaparContext::loadIfaces(const char *filename)
 {
     out_log << "# loadIfaces: " << filename << endl;
-    char buf[8192];
+    char buf[8192], *saveptr;
     const char *ifstr;
 
     InFile in(filename);
     while (in.gets(buf, sizeof(buf))) {
 	try {
 	    if (buf[0] == '#' || buf[0] == '\n') continue; // comment or empty
-	    ifstr = strtok(buf, " \t\n");
-	    if (!ifstr || strtok(NULL, "")) {
+	    ifstr = strtok_r(buf, " \t\n", &saveptr);
+	    if (!ifstr || strtok_r(NULL, "", &saveptr)) {
 		throw std::runtime_error("syntax error; expected \"<IPaddr>\"");
 	    }
 	    ip4addr_t addr(ifstr);
@@ -2446,49 +2773,157 @@ static void loadIfaces(const char *filename)
     memoryInfo.print("loaded ifaces");
 }
 
-static void loadAliases(const char *filename)
+// Parse the complete lines of an alias file in [begin, end) into slice.
+// Doesn't touch the interfaces, so pieces can be parsed in parallel.
+void KaparContext::parseAliases(char *begin, char *end, AliasSlice &slice)
 {
-    out_log << "# loadAliases: " << filename << endl;
-    char buf[8192];
+    char *saveptr;
     const char *ifstr[2];
-    NamedIface *iface[2];
-
-    size_t old_nodes = nodes.size();
-    size_t old_ifaces = namedIfaces.size();
-    unsigned n_fail_distance = 0;
-    unsigned n_fail_noloop = 0;
+    ip4addr_t addr[2];
 
-    InFile in(filename);
-    while (in.gets(buf, sizeof(buf))) {
+    for (char *buf = begin; buf < end; ) {
+	char *eol = static_cast<char*>(memchr(buf, '\n', end - buf));
+	*eol = '\0';
+	char *line = buf;
+	buf = eol + 1;
+	++slice.n_lines;
 	try {
-	    if (buf[0] == '#' || buf[0] == '\n') continue; // comment or empty
-	    ifstr[0] = strtok(buf, " \t");
-	    ifstr[1] = strtok(NULL, " \t\n");
-	    char *end = strtok(NULL, "");
-	    if (end) while (isspace(*end)) ++end;
-	    if (!ifstr[0] || !ifstr[1] || (end && *end)) {
+	    if (line[0] == '#' || line[0] == '\0') continue; // comment or empty
+	    ifstr[0] = strtok_r(line, " \t", &saveptr);
+	    ifstr[1] = strtok_r(NULL, " \t\n", &saveptr);
+	    char *rest = strtok_r(NULL, "", &saveptr);
+	    if (rest) while (isspace(*rest)) ++rest;
+	    if (!ifstr[0] || !ifstr[1] || (rest && *rest)) {
 		throw std::runtime_error("syntax error; expected \"<IPaddr> <IPaddr>\"");
 	    }
-	    for (int i = 0; i < 2; ++i) {
-		ip4addr_t addr(ifstr[i]);
-		if (isBogus(addr)) goto nextline;
-		iface[i] = findOrInsertNamedIface(addr);
-		iface[i]->preAliased() = true;
-	    }
-#ifdef ENABLE_TTL
-	    if (cfg.ttl_beats_loaded_alias && !aliasDistanceCondition(iface[0],iface[1])) {
-		n_fail_distance++;
-	    } else
-#endif
-	    if (pathLoader.n_good_traces > 0 && !aliasNoLoopCondition(iface[0], iface[1])) {
-		n_fail_noloop++;
-	    } else if (cfg.pfxlen == 0 || samePrefix(iface[0]->addr, iface[1]->addr, cfg.pfxlen)) {
-		setAlias(iface[0], iface[1]);
+	    int i;
+	    for (i = 0; i < 2; ++i) {
+		addr[i] = ip4addr_t(ifstr[i]);
+		if (isBogus(addr[i])) break;
 	    }
-	    nextline: continue;
-	} catch (const std::runtime_error &e) { throw InFile::Error(in, e); }
+	    if (i == 2)
+		slice.pairs.push_back(AliasLine(addr[0], addr[1]));
+	    else if (i == 1)
+		slice.singles.push_back(addr[0]);
+	} catch (const std::runtime_error &e) {
+	    slice.error_line = slice.n_lines;
+	    slice.error = e.what();
+	    return;
+	}
+    }
+}
+
+// Load an alias file.  Pieces of the file are parsed in parallel; all of the
+// addresses are then sorted and resolved to interfaces in one merge with
+// namedIfaces.  Finally the pairs are applied in file order, so the same
+// pairs are rejected, and the same nodes created, as when the lines were
+// handled one at a time.
+void KaparContext::loadAliases(const char *filename)
+{
+    out_log << "# loadAliases: " << filename << endl;
+
+    size_t old_nodes = nodes.size();
+    size_t old_ifaces = namedIfaces.size();
+    unsigned n_fail_distance = 0;
+    unsigned n_fail_noloop = 0;
+
+    // parse the file, in chunks
+    vector<AliasLine> pairs;
+    vector<ip4addr_t> addrs;
+    {
+	static const size_t CHUNKSIZE = 1 << 24;
+	size_t n_slices = cfg.n_threads * PARALLEL_SLICES_PER_THREAD;
+	vector<char> buf;
+	size_t carry = 0;	// bytes of an incomplete line at start of buf
+	size_t linenum = 0;	// lines before buf
+	bool eof = false;
+	InFile in(filename);
+	while (!eof) {
+	    buf.resize(carry + CHUNKSIZE + 1);
+	    size_t n = in.read(&buf[carry], 1, CHUNKSIZE);
+	    eof = (n == 0);
+	    size_t len = carry + n;
+	    if (eof && len > 0 && buf[len-1] != '\n')
+		buf[len++] = '\n'; // complete the last line
+	    // parse the complete lines, split into pieces at line boundaries
+	    size_t end = len;
+	    while (end > 0 && buf[end-1] != '\n') --end;
+	    vector<size_t> bounds = parallelBounds(end, n_slices);
+	    for (size_t k = 1; k < n_slices; ++k) {
+		while (bounds[k] > bounds[k-1] && buf[bounds[k]-1] != '\n')
+		    --bounds[k];
+	    }
+	    vector<AliasSlice> slices(n_slices);
+	    parallelFor(n_slices, n_slices,
+		[&](size_t, size_t, size_t k) {
+		    parseAliases(&buf[bounds[k]], &buf[bounds[k+1]], slices[k]);
+		});
+	    for (size_t k = 0; k < n_slices; ++k) {
+		AliasSlice &slice = slices[k];
+		if (!slice.error.empty()) {
+		    throw std::runtime_error(string(filename) + " line " +
+			to_string(linenum + slice.error_line) + ": " + slice.error);
+		}
+		linenum += slice.n_lines;
+		pairs.insert(pairs.end(), slice.pairs.begin(), slice.pairs.end());
+		addrs.insert(addrs.end(), slice.singles.begin(), slice.singles.end());
+	    }
+	    carry = len - end;
+	    memmove(&buf[0], &buf[end], carry);
+	}
+	in.close();
+    }
+
+    // resolve the addresses to interfaces by merging them with namedIfaces
+    for (size_t k = 0; k < pairs.size(); ++k) {
+	addrs.push_back(pairs[k].addr[0]);
+	addrs.push_back(pairs[k].addr[1]);
+    }
+    parallelSort(cfg.n_threads, addrs.begin(), addrs.end(), addr_less_than);
+    addrs.erase(unique(addrs.begin(), addrs.end()), addrs.end());
+    vector<NamedIface*> ifaces(addrs.size());
+    NamedIfaceSet::iterator it = namedIfaces.begin();
+    for (size_t i = 0; i < addrs.size(); ++i) {
+	while (it != namedIfaces.end() && addr_less_than((*it)->addr, addrs[i]))
+	    ++it;
+	if (it == namedIfaces.end() || (*it)->addr != addrs[i]) {
+	    NamedIface *iface = new (namedIfacePool) NamedIface(addrs[i]);
+	    it = namedIfaces.insert(it, iface);
+	}
+	ifaces[i] = *it;
+	ifaces[i]->preAliased() = true;
+    }
+    vector<uint32_t> pairIdx(2 * pairs.size());
+    parallelFor(pairs.size(),
+	cfg.n_threads * PARALLEL_SLICES_PER_THREAD,
+	[&](size_t begin, size_t end, size_t) {
+	    for (size_t k = begin; k < end; ++k) {
+		for (int j = 0; j < 2; ++j) {
+		    pairIdx[2*k+j] = uint32_t(lower_bound(addrs.begin(),
+			addrs.end(), pairs[k].addr[j], addr_less_than) -
+			addrs.begin());
+		}
+	    }
+	});
+    vector<ip4addr_t>().swap(addrs);
+    vector<AliasLine>().swap(pairs);
+
+    // Apply the pairs in file order.  Aliases are loaded before any traces,
+    // so the no-loop condition can't fail yet; it's tested anyway in case
+    // that changes, and then a pair's result depends on the pairs before it.
+    for (size_t k = 0; k < pairIdx.size() / 2; ++k) {
+	NamedIface *iface[2] = { ifaces[pairIdx[2*k]], ifaces[pairIdx[2*k+1]] };
+#ifdef ENABLE_TTL
+	if (cfg.ttl_beats_loaded_alias && !aliasDistanceCondition(iface[0],iface[1])) {
+	    n_fail_distance++;
+	} else
+#endif
+	if (pathLoader.n_good_traces > 0 && !aliasNoLoopCondition(iface[0], iface[1])) {
+	    n_fail_noloop++;
+	} else if (cfg.pfxlen == 0 || samePrefix(iface[0]->addr, iface[1]->addr, cfg.pfxlen)) {
+	    setAlias(iface[0], iface[1]);
+	}
     }
-    in.close();
 
     out_log << "# loaded aliases: sets=" << (nodes.size() - old_nodes) << "/" << nodes.size() <<
 	", good ifaces=" << (namedIfaces.size() - old_ifaces) << "/" << namedIfaces.size() <<
@@ -2499,10 +2934,10 @@ static void loadAliases(const char *filename)
 }
 
 #ifdef ENABLE_TTL
-void updateTTL(int srcId, ip4addr_t addr, short ttl)
+// Apply a TTL from vantage point srcId to iface.  A TTL that differs from one
+// already set invalidates it, and later TTLs are ignored.
+void KaparContext::updateTTL(int srcId, NamedIface *iface, short ttl)
 {
-    if (isBogus(addr)) return;
-    NamedIface *iface = findOrInsertNamedIface(addr);
     if (iface->ttl.isSet(srcId) && !iface->ttl.isValid(srcId)) {
 	out_log << "# warning: ignoring TTL " << short(ttl) <<
 	    " for " << *iface << "\n";
@@ -2516,10 +2951,10 @@ void updateTTL(int srcId, ip4addr_t addr, short ttl)
     }
 }
 
-static void loadTTLs(int srcId, const char *filename)
+// Read the TTLs of one vantage point's file into readings, in file order.
+// Doesn't touch the interfaces, so files can be read in parallel.
+void KaparContext::readTTLs(const char *filename, vector<TTLReading> &readings)
 {
-    out_log << "# loadTTLs " << srcId << " " << filename << endl;
-
     InFile in(filename);
 
 #ifdef HAVE_SCAMPER
@@ -2531,19 +2966,20 @@ static void loadTTLs(int srcId, const char *filename)
 	while (sin.read(&type, (void **)&sping) == 0) {
 	    if (!sping) break; /* EOF */
 	    ip4addr_t dst = scamper_to_ip4addr(sping->dst);
-	    if (isBogus(dst)) continue;
+	    if (isBogus(dst)) {
+		scamper_ping_free(sping);
+		continue;
+	    }
 	    debugttl << "# " << sping->ping_sent << " ping from " << sping->src << " to " << sping->dst << "\n";
 	    scamper_ping_reply_t *reply;
 	    for (int i = 0; i < sping->ping_sent; ++i) {
-		int j = 0;
 		for (reply = sping->ping_replies[i]; reply; reply = reply->next) {
 		    if (SCAMPER_PING_REPLY_IS_ICMP_ECHO_REPLY(reply) &&
 			scamper_addr_cmp(reply->addr, sping->dst) == 0 &&
 			(reply->flags & SCAMPER_PING_REPLY_FLAG_REPLY_TTL))
 		    {
-			updateTTL(srcId, dst, reply->reply_ttl);
+			readings.push_back(TTLReading(dst, reply->reply_ttl));
 		    }
-		    ++j;
 		}
 	    }
 	    scamper_ping_free(sping);
@@ -2556,42 +2992,93 @@ static void loadTTLs(int srcId, const char *filename)
 	// text file
 	char buf[8192];
 	const char *addrStr, *ttlStr;
-	char *end;
+	char *end, *saveptr;
 	long ttl;
 	while (in.gets(buf, sizeof(buf))) {
 	  try {
 	    if (buf[0] == '#' || buf[0] == '\n') continue; // comment or empty
-	    addrStr = strtok(buf, " \t");
-	    ttlStr = strtok(NULL, " \t\n");
+	    addrStr = strtok_r(buf, " \t", &saveptr);
+	    ttlStr = strtok_r(NULL, " \t\n", &saveptr);
 	    if (!addrStr || !ttlStr) {
 		throw std::runtime_error("syntax error; expected \"<IPaddr> <TTL>\"");
 	    }
 	    ip4addr_t dst(addrStr);
 	    ttl = strtol(ttlStr, &end, 10);
 	    if (end == ttlStr || *end || ttl < 0 || ttl > 255) {
-		throw std::runtime_error("invalid TTL \"" + ttlStr + "\"");
+		throw std::runtime_error(string("invalid TTL \"") + ttlStr + "\"");
 	    }
-	    updateTTL(srcId, dst, ttl);
+	    if (!isBogus(dst))
+		readings.push_back(TTLReading(dst, uint8_t(ttl)));
 	  } catch (const std::runtime_error &e) { throw InFile::Error(in, e); }
 	}
     }
     in.close();
+}
+
+// Load the TTL files, each of which is the vantage point (srcId) of its
+// position in cfg.ttlFiles.  The files are read and sorted by address in
+// parallel, then merged by address, so that each interface is looked up once
+// and all of its TTLs are applied together.  An interface's TTLs from one
+// file are applied in file order, so the same TTLs are invalidated as by
+// loading the files one at a time.
+void KaparContext::loadTTLs()
+{
+    size_t n_files = cfg.ttlFiles.size();
+    vector<vector<TTLReading> > readings(n_files);
+    vector<string> errors(n_files);
+    parallelFor(n_files, n_files,
+	[&](size_t, size_t, size_t k) {
+	    try {
+		readTTLs(cfg.ttlFiles[k], readings[k]);
+		stable_sort(readings[k].begin(), readings[k].end());
+	    } catch (const std::exception &e) {
+		errors[k] = e.what();
+		vector<TTLReading>().swap(readings[k]);
+	    }
+	});
+    for (size_t k = 0; k < n_files; ++k) {
+	out_log << "# loadTTLs " << k << " " << cfg.ttlFiles[k] << endl;
+	if (!errors[k].empty())
+	    throw runtime_error(errors[k]);
+    }
+
+    // merge:  the queue holds the next address of each file, and the file's
+    // srcId, lowest address (then srcId) first
+    typedef pair<uint32_t, uint32_t> Head;
+    priority_queue<Head, vector<Head>, greater<Head> > heads;
+    vector<size_t> pos(n_files, 0);
+    for (size_t k = 0; k < n_files; ++k) {
+	if (!readings[k].empty())
+	    heads.push(Head(readings[k][0].addr, uint32_t(k)));
+    }
+    NamedIface *iface = 0;
+    while (!heads.empty()) {
+	Head h = heads.top();
+	heads.pop();
+	const vector<TTLReading> &r = readings[h.second];
+	size_t &i = pos[h.second];
+	if (!iface || iface->addr != h.first)
+	    iface = findOrInsertNamedIface(ip4addr_t(h.first));
+	for ( ; i < r.size() && r[i].addr == iface->addr; ++i)
+	    updateTTL(int(h.second), iface, r[i].ttl);
+	if (i < r.size())
+	    heads.push(Head(r[i].addr, h.second));
+    }
 
     out_log << "# loaded distances: ifaces=" << namedIfaces.size() << endl;
     memoryInfo.print("loaded TTLs");
 }
 #endif
 
-static void outOfMemory()
+void KaparContext::logOutOfMemory()
 {
-    memoryInfo.print("OUT OF MEMORY");
     out_log << "# OUT OF MEMORY" << endl;
     out_log << "# traces=" << pathLoader.n_good_traces << "/" << pathLoader.n_raw_traces <<
 	" loops=" << pathLoader.n_loops <<
 	" discarded=" << pathLoader.n_discarded_traces <<
 	" namedIfaces=" << namedIfaces.size() <<
 	" anon=" << n_anon <<
-	" uniq_anon=" << AnonIface::maxid <<
+	" uniq_anon=" << anonIfaces.maxid <<
 	" hops=" << n_total_hops <<
 	endl;
     out_log << "# bad_31_traces=" << n_bad_31_traces <<
@@ -2600,12 +3087,33 @@ static void outOfMemory()
 	" same_min_net=" << n_same_min_net <<
 	" badSubnets=" << (badSubnets ? badSubnets->size() : 0) <<
 	endl;
+}
+
+static KaparContext *mainContext = 0; // context of the command line run
+
+static void outOfMemory()
+{
+    if (mainContext) {
+	mainContext->memoryInfo.print("OUT OF MEMORY");
+	mainContext->logOutOfMemory();
+    }
     abort();
 }
 
-static void usageExit(const char *name, const char *badoption, int status) {
-    if (badoption)
-	cerr << "invalid option " << badoption << endl;
+// An error in the options.  kaparMain() reports it with the usage message;
+// the library reports it like any other error.
+class UsageError : public runtime_error {
+public:
+    explicit UsageError(const string &msg) : runtime_error(msg) {}
+};
+
+static UsageError badOption(const char *option, const char *why = 0)
+{
+    return UsageError(string("invalid option ") + option +
+	(why ? string(": ") + why : string()));
+}
+
+static void printUsage(const char *name) {
     cerr << endl;
     cerr << "Alias resolution usage:" << endl;
     cerr << name << " [behavior-options] [file-options] -P <pathfile>..." << endl;
@@ -2660,15 +3168,67 @@ static void usageExit(const char *name, const char *badoption, int status) {
     cerr << "    l    links, to \"<outfile>.links\"" << endl;
     cerr << "    i    interfaces, to \"<outfile>.ifaces\"" << endl;
     cerr << "    s    subnets, to \"<outfile>.subnets\"" << endl;
+    cerr << "    b    binary topology, to \"<outfile>.topo\" (see lib/TopoFile.h)" << endl;
+    cerr << "-Z       gzip the aliases, links, and interfaces output (adds \".gz\" to" << endl;
+    cerr << "         their names)" << endl;
     cerr << "-z<n>    infer subnets with prefix length >= n only (default " << MINSUBNETLEN << ")" << endl;
     cerr << "-X<n>    during -A loading, require <n> bit shared prefix (default 0)" << endl;
     cerr << "-N       make negative inferences for aliases absent in -A" << endl;
+    cerr << "-R<n>    report trace loading progress every <n> seconds (default 60; 0" << endl;
+    cerr << "         disables)" << endl;
+    cerr << "-S <endpoint>" << endl;
+    cerr << "         Publish loading progress at <endpoint>:  a file that is rewritten" << endl;
+    cerr << "         at each report, or \"unix:<path>\" for a Unix socket that sends the" << endl;
+    cerr << "         current values to each client that connects" << endl;
+    cerr << "-v<arg>  write debugging information for any combination of these to the" << endl;
+    cerr << "         log (default \"b\"):" << endl;
+    cerr << "    p    paths" << endl;
+    cerr << "    s    subnet inference" << endl;
+    cerr << "    a    alias inference" << endl;
+    cerr << "    l    link inference" << endl;
+    cerr << "    n    anonymous interfaces" << endl;
+    cerr << "    t    TTLs" << endl;
+    cerr << "    b    brief summary of alias inferences" << endl;
+    cerr << "    0    none" << endl;
+    cerr << "-H       include hardware counters (cycles, instructions, LLC misses) in" << endl;
+    cerr << "         the performance report, \"<outfile>.perf.json\"" << endl;
+    cerr << "-j<n>    use <n> threads for parallel phases (default: number of CPUs)" << endl;
     cerr << "-O <outfile>" << endl;
     cerr << "         The base name for result output files (default: \"kapar\")" << endl;
+    cerr << "--save-state <statefile>" << endl;
+    cerr << "         After loading the input files, save everything loaded to" << endl;
+    cerr << "         <statefile> (see lib/StateFile.h)" << endl;
+    cerr << "--load-state <statefile>" << endl;
+    cerr << "         Load the state saved by --save-state instead of input files.  The" << endl;
+    cerr << "         options that affect loading (-i, -a, -d, -l, -1, -z, ...) must" << endl;
+    cerr << "         match those of the saving run; the others may differ.  Trace" << endl;
+    cerr << "         files given with -P are loaded on top of the state, with the same" << endl;
+    cerr << "         result as a run over all of the traces; with --save-state, this" << endl;
+    cerr << "         updates a saved state with a new set of traces.  Use the same -B" << endl;
+    cerr << "         files as the saving run." << endl;
+    cerr << "--sweep <sweepfile>" << endl;
+    cerr << "         Load the inputs once, then run the inferences once for each line" << endl;
+    cerr << "         of <sweepfile>, in a forked process.  Each line holds options" << endl;
+    cerr << "         that are applied on top of the command line options, and may" << endl;
+    cerr << "         not change the options that affect loading.  The outputs of line" << endl;
+    cerr << "         <n> are named \"<outfile>.<n>.*\", unless the line has -O." << endl;
+    cerr << "--memory-budget <MB>" << endl;
+    cerr << "         Keep the path segments and trace id sets of interfaces in files" << endl;
+    cerr << "         mapped into memory, and keep only about <MB> megabytes of them" << endl;
+    cerr << "         resident, so that a large input runs slower instead of running" << endl;
+    cerr << "         out of memory.  The files need as much disk space as the data." << endl;
+    cerr << "--spill-dir <dir>" << endl;
+    cerr << "         Directory for the files of --memory-budget (default: \".\")" << endl;
+    cerr << "--dst-index <dir>" << endl;
+    cerr << "         With -g or -G, keep an index of the destinations of each iPlane" << endl;
+    cerr << "         pathfile in \"<dir>/<file>.dstidx\", and use it to skip blocks of" << endl;
+    cerr << "         traces to other destinations without reading them.  A missing or" << endl;
+    cerr << "         out of date index is built while reading the file." << endl;
     cerr << "-d0      Do not include destination addrs (default with -x)" << endl;
     cerr << "-d1      Include destination addrs, but do not use in alias inference (default" << endl;
     cerr << "         without -x)" << endl;
-    cerr << "-g<addr> use only traces to destination <addr>" << endl;
+    cerr << "-g<addr> use only traces to destination <addr>; may be repeated, and combined" << endl;
+    cerr << "         with -G" << endl;
     cerr << "-b<arg>  emulate any combination of bugs:" << endl;
     cerr << "    a    -ad also applies to REVERSED sequences (in APAR.c and kapar < 1.160," << endl;
     cerr << "         2012-03-09)" << endl;
@@ -2696,6 +3256,9 @@ static void usageExit(const char *name, const char *badoption, int status) {
     cerr << "-D <ttlfile>..." << endl;
     cerr << "   Warts files of ICMP echo probes from which TTLs are extracted," << endl;
     cerr << "   or text file of lines with the format \"<IPaddr> <TTL>\"." << endl;
+    cerr << "-G <dstfile>..." << endl;
+    cerr << "   Text files of trace destinations, one address or CIDR prefix per line;" << endl;
+    cerr << "   only traces to these destinations are used" << endl;
     cerr << "-P <pathfile>..." << endl;
     cerr << "   Files containing path traces: \"*.warts\" for warts files; \"trace.out.*\" for" << endl;
     cerr << "   iPlane files; otherwise text.  In text files, each trace starts with a \"#\"" << endl;
@@ -2718,16 +3281,17 @@ static void usageExit(const char *name, const char *badoption, int status) {
     cerr << "-d       Also extract destination addrs (if reached)" << endl;
     cerr << "         (default: source and intermediate addrs only)" << endl;
     cerr << "-l<arg>  loop handling (same as above)" << endl;
+    cerr << "-R<n>, -S <endpoint>  progress reporting (same as above)" << endl;
     cerr << endl;
     cerr << "File options:  each is an option followed by a list of filenames." << endl;
     cerr << "-I <ifacefile>...    same as above" << endl;
     cerr << "-B <bogonfile>...    same as above" << endl;
+    cerr << "-G <dstfile>...      same as above" << endl;
     cerr << "-P <pathfile>...     same as above" << endl;
     cerr << "-O <outfile>         same as above" << endl;
-    exit(status);
 }
 
-static void printFileOptions(ofstream &out, const char &option,
+static void printFileOptions(ostream &out, const char &option,
     vector<const char*> files)
 {
     vector<const char*>::const_iterator fit;
@@ -2737,16 +3301,13 @@ static void printFileOptions(ofstream &out, const char &option,
     }
 }
 
-static void openOutfile(ofstream &out, const string &suffix, char *argv[])
+string KaparContext::outfileName(const string &suffix)
 {
-    string name =
-	string(cfg.output_basename ? cfg.output_basename : "kapar") + suffix;
-    out.open(name.c_str());
-    if (!out) {
-	cerr << "can't open " << name << ": " << strerror(errno) << endl;
-	exit(1);
-    }
+    return string(cfg.output_basename ? cfg.output_basename : "kapar") + suffix;
+}
 
+void KaparContext::printHeader(ostream &out, char *argv[])
+{
     out << "# version: " << ::cvsID << endl;
     out << "# version: " << PathLoader::cvsID << endl;
     char timebuf[80];
@@ -2768,8 +3329,8 @@ static void openOutfile(ofstream &out, const string &suffix, char *argv[])
 	    if (cfg.bug_broadcast) out << "b";
 	    if (cfg.bug_BE_link) out << "l";
 	}
-	if (pathLoader.grep_dst)
-	    out << " -g" << pathLoader.grep_dst;
+	for (size_t i = 0; i < cfg.grep_dsts.size(); ++i)
+	    out << " -g" << cfg.grep_dsts[i];
 	out << " -p" << (cfg.markNonP2P ? 'y' : 'n');
 #ifdef ENABLE_TTL
 	if (cfg.ttlFiles.size() > 0) {
@@ -2806,7 +3367,10 @@ static void openOutfile(ofstream &out, const string &suffix, char *argv[])
 	    if (cfg.output_links) out << "l";
 	    if (cfg.output_ifaces) out << "i";
 	    if (cfg.output_subnets) out << "s";
+	    if (cfg.output_topo) out << "b";
     }
+    if (cfg.output_gzip)
+	out << " -Z";
     if (cfg.output_basename)
 	out << " -O " << cfg.output_basename;
     if (cfg.pfxlen)
@@ -2815,75 +3379,1028 @@ static void openOutfile(ofstream &out, const string &suffix, char *argv[])
 	out << " -z " << cfg.minsubnetlen;
     if (cfg.negativeAlias)
 	out << " -N ";
+    if (cfg.load_state)
+	out << " --load-state " << cfg.load_state;
+    if (cfg.save_state)
+	out << " --save-state " << cfg.save_state;
+    if (cfg.sweep_file)
+	out << " --sweep " << cfg.sweep_file;
+    if (cfg.memory_budget)
+	out << " --memory-budget " << (cfg.memory_budget >> 20) <<
+	    " --spill-dir " << cfg.spill_dir;
+    if (cfg.dst_index_dir)
+	out << " --dst-index " << cfg.dst_index_dir;
     printFileOptions(out, 'B', cfg.bogonFiles);
     printFileOptions(out, 'A', cfg.aliasFiles);
 #ifdef ENABLE_TTL
     printFileOptions(out, 'D', cfg.ttlFiles);
 #endif
     printFileOptions(out, 'I', cfg.ifaceFiles);
+    printFileOptions(out, 'G', cfg.dstFiles);
     printFileOptions(out, 'P', cfg.traceFiles);
     out << endl << "#" << endl;
 }
 
+// Print the options that affect the state built while loading the inputs.
+// A run that loads a saved state must have the same loading options as the
+// run that saved it.
+void KaparContext::printLoadOptions(ostream &out)
+{
+    if (cfg.mode_extract) {
+	out << " -x -m" << cfg.min_subnet_middle_required;
+    } else {
+	out << " -i";
+	    if (cfg.infer_aliases) out << "a";
+	    if (cfg.infer_links) out << "l";
+	out << " -a";
+	    if (cfg.anon_ignore) out << "i";
+	    if (cfg.anon_dups) out << "d";
+	    if (cfg.anon_match) out << "m";
+	if (cfg.bug_rev_anondup || cfg.bug_swap_dstlink) {
+	    out << " -b";
+	    if (cfg.bug_rev_anondup) out << "a";
+	    if (cfg.bug_swap_dstlink) out << "d";
+	}
+    }
+    for (size_t i = 0; i < cfg.grep_dsts.size(); ++i)
+	out << " -g" << cfg.grep_dsts[i];
+    // the -G files' contents matter, not their names (and the filter is
+    // compiled before the state is saved or loaded)
+    if (!cfg.dstFiles.empty())
+	out << " -G" << dstFilter.size() << ":" << dstFilter.digest();
+    out << " -d" << (cfg.include_dst ? '1' : '0');
+    out << " -l" << (pathLoader.loop_discard ? "d" : pathLoader.loop_after ? "ba" : "b");
+    out << " -1" << (cfg.oneloop_anon ? "a" : "l");
+    out << " -z" << cfg.minsubnetlen;
+    out << " -X" << cfg.pfxlen;
+#ifdef ENABLE_TTL
+    if (cfg.ttl_beats_loaded_alias)
+	out << " -tl";
+#endif
+}
+
+void KaparContext::openOutfile(ofstream &out, const string &suffix, char *argv[])
+{
+    string name = outfileName(suffix);
+    out.open(name.c_str());
+    if (!out)
+	throw runtime_error("can't open " + name + ": " + strerror(errno));
+    printHeader(out, argv);
+}
+
+void KaparContext::openOutfile(OutFile &out, const string &suffix, char *argv[])
+{
+    string name = outfileName(suffix);
+    if (cfg.output_gzip) name += ".gz";
+    out.open(name, cfg.output_gzip);
+    ostringstream header;
+    printHeader(header, argv);
+    out.write(header.str());
+}
+
+// Open the result output files selected by the configuration.
+void KaparContext::openResultFiles(char *argv[])
+{
+    if (cfg.mode_extract) {
+	openOutfile(out_addrs, ".addrs", argv);
+	openOutfile(out_missing, ".missing", argv);
+#if 0
+	openOutfile(out_ptp, ".ptp", argv);
+#endif
+    } else {
+	if (cfg.output_aliases)
+	    openOutfile(out_aliases, ".aliases", argv);
+	if (cfg.output_links)
+	    openOutfile(out_links, ".links", argv);
+	if (cfg.output_ifaces)
+	    openOutfile(out_ifaces, ".ifaces", argv);
+	if (cfg.output_subnets)
+	    openOutfile(out_subnets, ".subnets", argv);
+	if (cfg.output_topo)
+	    out_topo.open(outfileName(".topo"));
+    }
+}
+
+// Pad a binary file from the current position pos to the start of a section
+// at offset off.
+static void padSection(OutFile &out, uint64_t &pos, uint64_t off)
+{
+    static const char zeros[8] = {};
+    out.write(zeros, off - pos);
+    pos = off;
+}
+
+// Append data to a binary file at the current position pos.
+static void writeData(OutFile &out, uint64_t &pos, const void *data, size_t len)
+{
+    out.write(static_cast<const char*>(data), len);
+    pos += len;
+}
+
+template<class T>
+static inline void writeValue(OutFile &out, uint64_t &pos, const T &val)
+{
+    writeData(out, pos, &val, sizeof(T));
+}
+
+// Append a section of a binary file at offset off, padding from the
+// current position pos.
+static void writeSection(OutFile &out, uint64_t &pos, uint64_t off,
+    const void *data, size_t len)
+{
+    padSection(out, pos, off);
+    writeData(out, pos, data, len);
+}
+
+template<class T>
+static void writeSection(OutFile &out, uint64_t &pos, uint64_t off,
+    const vector<T> &vec)
+{
+    writeSection(out, pos, off, vec.data(), vec.size() * sizeof(T));
+}
+
+// Write the binary topology file (see TopoFile.h).
+// Build the topology of the inferred nodes and links, in the form of the
+// binary topology file.
+void KaparContext::buildTopology(KaparTopology &topo)
+{
+    vector<TopoIface> &ifaces = topo.ifaces;
+    ifaces.reserve(namedIfaces.size() + anonIfaces.size());
+    for (NamedIfaceSet::const_iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
+	const NamedIface *i = *iit;
+	TopoIface ti = { i->addr, i->nodeid, i->linkid,
+	    (i->seen_as_transit ? TOPO_TRANSIT : 0u) |
+	    (i->seen_as_dest ? TOPO_DEST : 0u) };
+	ifaces.push_back(ti);
+    }
+    for (AnonIfaceSet::const_iterator iit = anonIfaces.begin(); iit != anonIfaces.end(); ++iit) {
+	const AnonIface *i = *iit;
+	TopoIface ti = { i->addr, i->nodeid, i->linkid,
+	    (i->seen_as_transit ? TOPO_TRANSIT : 0u) |
+	    (i->seen_as_dest ? TOPO_DEST : 0u) | TOPO_ANON |
+	    (i->redundant != 0 ? TOPO_REDUNDANT : 0u) };
+	ifaces.push_back(ti);
+    }
+    sort(ifaces.begin(), ifaces.end(),
+	[](const TopoIface &a, const TopoIface &b) { return a.addr < b.addr; });
+
+    auto ifaceIndex = [&](const Iface *iface) -> uint32_t {
+	vector<TopoIface>::const_iterator it = lower_bound(ifaces.begin(),
+	    ifaces.end(), uint32_t(iface->addr),
+	    [](const TopoIface &a, uint32_t b) { return a.addr < b; });
+	if (it == ifaces.end() || it->addr != iface->addr)
+	    throw runtime_error("interface " + string(iface->addr) +
+		" is missing from interface list");
+	return uint32_t(it - ifaces.begin());
+    };
+    // Like the text output, omit redundant anonymous interfaces.
+    auto omit = [](const Iface *iface) {
+	return isAnon(iface) && static_cast<const AnonIface*>(iface)->redundant != 0;
+    };
+    IfaceVector::const_iterator i;
+
+    vector<uint32_t> &node_ids = topo.node_ids;
+    vector<uint32_t> &node_ifaces_idx = topo.node_ifaces_idx;
+    vector<uint32_t> &node_ifaces = topo.node_ifaces;
+    node_ids.reserve(nodes.size());
+    node_ifaces_idx.reserve(nodes.size() + 1);
+    node_ifaces_idx.push_back(0);
+    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n) {
+	node_ids.push_back(n->first);
+	for (i = n->second.ifaces.begin(); i != n->second.ifaces.end(); ++i) {
+	    if (!omit(*i))
+		node_ifaces.push_back(ifaceIndex(*i));
+	}
+	node_ifaces_idx.push_back(uint32_t(node_ifaces.size()));
+    }
+
+    vector<uint32_t> &link_ids = topo.link_ids;
+    vector<uint32_t> &link_ifaces_idx = topo.link_ifaces_idx;
+    vector<uint32_t> &link_ifaces = topo.link_ifaces;
+    vector<uint32_t> &link_nodes_idx = topo.link_nodes_idx;
+    vector<uint32_t> &link_nodes = topo.link_nodes;
+    link_ids.reserve(links.size());
+    link_ifaces_idx.reserve(links.size() + 1);
+    link_ifaces_idx.push_back(0);
+    link_nodes_idx.reserve(links.size() + 1);
+    link_nodes_idx.push_back(0);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l) {
+	link_ids.push_back(l->first);
+	for (i = l->second.ifaces.begin(); i != l->second.ifaces.end(); ++i) {
+	    if (!omit(*i))
+		link_ifaces.push_back(ifaceIndex(*i));
+	}
+	link_ifaces_idx.push_back(uint32_t(link_ifaces.size()));
+	link_nodes.insert(link_nodes.end(), l->second.nodes.begin(),
+	    l->second.nodes.end());
+	link_nodes_idx.push_back(uint32_t(link_nodes.size()));
+    }
+}
+
+void KaparContext::writeTopology(OutFile &out, char *argv[])
+{
+    ostringstream config;
+    printHeader(config, argv);
+    string configText = config.str();
+
+    KaparTopology topo;
+    buildTopology(topo);
+    const vector<TopoIface> &ifaces = topo.ifaces;
+    const vector<uint32_t> &node_ids = topo.node_ids;
+    const vector<uint32_t> &node_ifaces_idx = topo.node_ifaces_idx;
+    const vector<uint32_t> &node_ifaces = topo.node_ifaces;
+    const vector<uint32_t> &link_ids = topo.link_ids;
+    const vector<uint32_t> &link_ifaces_idx = topo.link_ifaces_idx;
+    const vector<uint32_t> &link_ifaces = topo.link_ifaces;
+    const vector<uint32_t> &link_nodes_idx = topo.link_nodes_idx;
+    const vector<uint32_t> &link_nodes = topo.link_nodes;
+
+    TopoHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TOPO_MAGIC, sizeof(hdr.magic));
+    hdr.version = TOPO_VERSION;
+    hdr.byteorder = TOPO_BYTEORDER;
+    hdr.n_ifaces = uint32_t(ifaces.size());
+    hdr.n_nodes = uint32_t(node_ids.size());
+    hdr.n_node_ifaces = uint32_t(node_ifaces.size());
+    hdr.n_links = uint32_t(link_ids.size());
+    hdr.n_link_ifaces = uint32_t(link_ifaces.size());
+    hdr.n_link_nodes = uint32_t(link_nodes.size());
+    uint64_t off = sizeof(hdr);
+#define TOPO_LAYOUT(field, len) \
+    off = topoAlign(off); hdr.field = off; off += (len)
+    TOPO_LAYOUT(config_off, configText.size() + 1);
+    hdr.config_len = configText.size();
+    TOPO_LAYOUT(ifaces_off, ifaces.size() * sizeof(TopoIface));
+    TOPO_LAYOUT(node_ids_off, node_ids.size() * 4);
+    TOPO_LAYOUT(node_ifaces_idx_off, node_ifaces_idx.size() * 4);
+    TOPO_LAYOUT(node_ifaces_off, node_ifaces.size() * 4);
+    TOPO_LAYOUT(link_ids_off, link_ids.size() * 4);
+    TOPO_LAYOUT(link_ifaces_idx_off, link_ifaces_idx.size() * 4);
+    TOPO_LAYOUT(link_ifaces_off, link_ifaces.size() * 4);
+    TOPO_LAYOUT(link_nodes_idx_off, link_nodes_idx.size() * 4);
+    TOPO_LAYOUT(link_nodes_off, link_nodes.size() * 4);
+#undef TOPO_LAYOUT
+    hdr.file_size = off;
+
+    uint64_t pos = 0;
+    writeSection(out, pos, 0, &hdr, sizeof(hdr));
+    writeSection(out, pos, hdr.config_off, configText.c_str(), configText.size() + 1);
+    writeSection(out, pos, hdr.ifaces_off, ifaces);
+    writeSection(out, pos, hdr.node_ids_off, node_ids);
+    writeSection(out, pos, hdr.node_ifaces_idx_off, node_ifaces_idx);
+    writeSection(out, pos, hdr.node_ifaces_off, node_ifaces);
+    writeSection(out, pos, hdr.link_ids_off, link_ids);
+    writeSection(out, pos, hdr.link_ifaces_idx_off, link_ifaces_idx);
+    writeSection(out, pos, hdr.link_ifaces_off, link_ifaces);
+    writeSection(out, pos, hdr.link_nodes_idx_off, link_nodes_idx);
+    writeSection(out, pos, hdr.link_nodes_off, link_nodes);
+    out.close();
+}
+
+#ifdef ENABLE_TTL
+// Append a TTL record of a state file:  a presence byte, followed by the raw
+// data of ttl (or zeros).
+static void writeTTL(OutFile &out, uint64_t &pos, const ttlVec &ttl)
+{
+    vector<uint8_t> zeros(ttl.rawsize());
+    uint8_t present = !ttl.empty();
+    writeValue(out, pos, present);
+    writeData(out, pos, present ? ttl.raw() : zeros.data(), zeros.size());
+}
+#endif
+
+// Write the state built by loading the inputs (see StateFile.h).
+void KaparContext::writeState(const char *filename, char *argv[])
+{
+    out_log << "# saveState: " << filename << endl;
+    ostringstream config, options;
+    printHeader(config, argv);
+    printLoadOptions(options);
+    string configText = config.str();
+    string optionsText = options.str();
+
+    StateHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STATE_MAGIC, sizeof(hdr.magic));
+    hdr.version = STATE_VERSION;
+    hdr.byteorder = STATE_BYTEORDER;
+    hdr.flags = cfg.need_traceids ? STATE_TRACEIDS : 0;
+    hdr.n_named = uint32_t(namedIfaces.size());
+    hdr.n_anon = uint32_t(anonIfaces.size());
+    hdr.n_nodes = uint32_t(nodes.size());
+    hdr.n_links = uint32_t(links.size());
+    hdr.next_nodeid = nodes.nextid;
+    hdr.next_linkid = links.nextid;
+    hdr.n_bad_subnets = badSubnets->size();
+    hdr.n_dstlinks = dstlinks.size();
+    hdr.n_anon_segs = anonSegs.size();
+    hdr.n_ttls = cfg.n_ttls;
+    hdr.n_raw_traces = pathLoader.n_raw_traces;
+    hdr.n_good_traces = pathLoader.n_good_traces;
+    hdr.n_loops = pathLoader.n_loops;
+    hdr.n_discarded_traces = pathLoader.n_discarded_traces;
+    hdr.n_anon_hops = n_anon;
+    hdr.n_total_hops = n_total_hops;
+    hdr.n_bad_31_traces = n_bad_31_traces;
+    hdr.n_not_min_mask = n_not_min_mask;
+    hdr.n_not_min_net = n_not_min_net;
+    hdr.n_same_min_net = n_same_min_net;
+
+    NamedIfaceSet::const_iterator nit;
+    AnonIfaceSet::const_iterator ait;
+    uint64_t n_traces = 0, n_prev = 0, n_next = 0;
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit) {
+	n_traces += (*nit)->traces.rawsize();
+	n_prev += 2 * (*nit)->prev.size();
+	n_next += (*nit)->next.size();
+    }
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait) {
+	n_traces += (*ait)->traces.rawsize();
+	n_prev += (*ait)->prev.size();
+    }
+    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
+	hdr.n_node_ifaces += n->second.ifaces.size();
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l) {
+	hdr.n_link_ifaces += l->second.ifaces.size();
+	hdr.n_link_nodes += l->second.nodes.size();
+    }
+#ifdef ENABLE_TTL
+    if (cfg.n_ttls > 0) {
+	uint64_t len = ttlVec().rawsize();
+	hdr.ttls_len = (hdr.n_named + 2 * uint64_t(hdr.n_nodes)) * (1 + len);
+    }
+#endif
+
+    uint64_t n_ifaces = uint64_t(hdr.n_named) + hdr.n_anon;
+    uint64_t off = sizeof(hdr);
+#define STATE_LAYOUT(field, len) \
+    off = stateAlign(off); hdr.field = off; off += (len)
+    STATE_LAYOUT(config_off, configText.size() + 1);
+    hdr.config_len = configText.size();
+    STATE_LAYOUT(options_off, optionsText.size() + 1);
+    hdr.options_len = optionsText.size();
+    STATE_LAYOUT(ifaces_off, n_ifaces * sizeof(StateIface));
+    STATE_LAYOUT(traces_idx_off, (n_ifaces + 1) * 8);
+    STATE_LAYOUT(traces_off, n_traces * 4);
+    STATE_LAYOUT(prev_idx_off, (n_ifaces + 1) * 8);
+    STATE_LAYOUT(prev_off, n_prev * 4);
+    STATE_LAYOUT(next_idx_off, (uint64_t(hdr.n_named) + 1) * 8);
+    STATE_LAYOUT(next_off, n_next * 4);
+    STATE_LAYOUT(node_ids_off, uint64_t(hdr.n_nodes) * 4);
+    STATE_LAYOUT(node_ifaces_idx_off, (uint64_t(hdr.n_nodes) + 1) * 8);
+    STATE_LAYOUT(node_ifaces_off, hdr.n_node_ifaces * 4);
+    STATE_LAYOUT(link_ids_off, uint64_t(hdr.n_links) * 4);
+    STATE_LAYOUT(link_ifaces_idx_off, (uint64_t(hdr.n_links) + 1) * 8);
+    STATE_LAYOUT(link_ifaces_off, hdr.n_link_ifaces * 4);
+    STATE_LAYOUT(link_nodes_idx_off, (uint64_t(hdr.n_links) + 1) * 8);
+    STATE_LAYOUT(link_nodes_off, hdr.n_link_nodes * 4);
+    STATE_LAYOUT(bad_subnets_off, hdr.n_bad_subnets * sizeof(StatePrefix));
+    STATE_LAYOUT(dstlinks_off, hdr.n_dstlinks * 8);
+    STATE_LAYOUT(anon_segs_off, hdr.n_anon_segs * sizeof(StateAnonSeg));
+    STATE_LAYOUT(ttls_off, hdr.ttls_len);
+#undef STATE_LAYOUT
+    hdr.file_size = off;
+
+    OutFile out;
+    out.open(filename);
+    uint64_t pos = 0, idx;
+    writeSection(out, pos, 0, &hdr, sizeof(hdr));
+    writeSection(out, pos, hdr.config_off, configText.c_str(), configText.size() + 1);
+    writeSection(out, pos, hdr.options_off, optionsText.c_str(), optionsText.size() + 1);
+
+    padSection(out, pos, hdr.ifaces_off);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit) {
+	NamedIface *i = *nit;
+	StateIface si = { i->addr, i->nodeid, i->linkid,
+	    (i->seen_as_transit ? STATE_TRANSIT : 0u) |
+	    (i->seen_as_dest ? STATE_DEST : 0u) |
+	    (i->preAliased() ? STATE_PREALIASED : 0u), 0 };
+	writeValue(out, pos, si);
+    }
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait) {
+	const AnonIface *i = *ait;
+	StateIface si = { i->addr, i->nodeid, i->linkid,
+	    (i->seen_as_transit ? STATE_TRANSIT : 0u) |
+	    (i->seen_as_dest ? STATE_DEST : 0u) | STATE_ANON, i->redundant };
+	writeValue(out, pos, si);
+    }
+
+    // A trace id set is stored in its raw form, and a PathSeg<N> has the
+    // layout of N addresses.
+    padSection(out, pos, hdr.traces_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeValue(out, pos, idx += (*nit)->traces.rawsize());
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait)
+	writeValue(out, pos, idx += (*ait)->traces.rawsize());
+    padSection(out, pos, hdr.traces_off);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeData(out, pos, (*nit)->traces.rawdata(), (*nit)->traces.rawsize() * 4);
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait)
+	writeData(out, pos, (*ait)->traces.rawdata(), (*ait)->traces.rawsize() * 4);
+
+    padSection(out, pos, hdr.prev_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeValue(out, pos, idx += 2 * (*nit)->prev.size());
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait)
+	writeValue(out, pos, idx += (*ait)->prev.size());
+    padSection(out, pos, hdr.prev_off);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeData(out, pos, (*nit)->prev.begin(), (*nit)->prev.size() * 8);
+    for (ait = anonIfaces.begin(); ait != anonIfaces.end(); ++ait)
+	writeData(out, pos, (*ait)->prev.begin(), (*ait)->prev.size() * 4);
+
+    padSection(out, pos, hdr.next_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeValue(out, pos, idx += (*nit)->next.size());
+    padSection(out, pos, hdr.next_off);
+    for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	writeData(out, pos, (*nit)->next.begin(), (*nit)->next.size() * 4);
+
+    IfaceVector::const_iterator i;
+    padSection(out, pos, hdr.node_ids_off);
+    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
+	writeValue(out, pos, n->first);
+    padSection(out, pos, hdr.node_ifaces_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n)
+	writeValue(out, pos, idx += n->second.ifaces.size());
+    padSection(out, pos, hdr.node_ifaces_off);
+    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n) {
+	for (i = n->second.ifaces.begin(); i != n->second.ifaces.end(); ++i)
+	    writeValue(out, pos, uint32_t((*i)->addr));
+    }
+
+    padSection(out, pos, hdr.link_ids_off);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l)
+	writeValue(out, pos, l->first);
+    padSection(out, pos, hdr.link_ifaces_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l)
+	writeValue(out, pos, idx += l->second.ifaces.size());
+    padSection(out, pos, hdr.link_ifaces_off);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l) {
+	for (i = l->second.ifaces.begin(); i != l->second.ifaces.end(); ++i)
+	    writeValue(out, pos, uint32_t((*i)->addr));
+    }
+    padSection(out, pos, hdr.link_nodes_idx_off);
+    writeValue(out, pos, idx = 0);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l)
+	writeValue(out, pos, idx += l->second.nodes.size());
+    padSection(out, pos, hdr.link_nodes_off);
+    for (LinkSet::const_iterator l = links.begin(); l != links.end(); ++l)
+	writeData(out, pos, l->second.nodes.begin(), l->second.nodes.size() * 4);
+
+    padSection(out, pos, hdr.bad_subnets_off);
+    NetPrefixSet::const_iterator bit;
+    for (bit = badSubnets->begin(); bit != badSubnets->end(); ++bit) {
+	StatePrefix sp = { bit->addr, bit->len };
+	writeValue(out, pos, sp);
+    }
+
+    padSection(out, pos, hdr.dstlinks_off);
+    writeData(out, pos, dstlinks.data(), dstlinks.size() * 8);
+
+    // anonSegs is unordered; write it in a reproducible order
+    vector<StateAnonSeg> segs;
+    segs.reserve(anonSegs.size());
+    for (AnonSegSet::const_iterator sit = anonSegs.begin(); sit != anonSegs.end(); ++sit) {
+	StateAnonSeg seg = { (*sit)->lo, (*sit)->hi, uint32_t((*sit)->length),
+	    (*sit)->loAnon };
+	segs.push_back(seg);
+    }
+    sort(segs.begin(), segs.end(),
+	[](const StateAnonSeg &a, const StateAnonSeg &b) { return a.loAnon < b.loAnon; });
+    padSection(out, pos, hdr.anon_segs_off);
+    writeData(out, pos, segs.data(), segs.size() * sizeof(StateAnonSeg));
+
+    padSection(out, pos, hdr.ttls_off);
+#ifdef ENABLE_TTL
+    if (cfg.n_ttls > 0) {
+	for (nit = namedIfaces.begin(); nit != namedIfaces.end(); ++nit)
+	    writeTTL(out, pos, (*nit)->ttl);
+	for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n) {
+	    writeTTL(out, pos, n->second.min_ttl);
+	    writeTTL(out, pos, n->second.max_ttl);
+	}
+    }
+#endif
+    out.close();
+    if (pos != hdr.file_size)
+	throw runtime_error("internal error writing " + string(filename));
+
+    out_log << "# saved state: " << hdr.file_size << " bytes" << endl;
+}
+
+// Load the state saved by writeState(), in place of loading the inputs.
+void KaparContext::loadState(const char *filename)
+{
+    out_log << "# loadState: " << filename << endl;
+    StateFile state(filename);
+    const StateHeader &hdr = state.header();
+    string where = string(filename) + ": ";
+
+    ostringstream options;
+    printLoadOptions(options);
+    if (options.str() != state.options())
+	throw runtime_error(where + "state was saved with loading options \"" +
+	    state.options() + "\", not \"" + options.str() + "\"");
+    if (cfg.need_traceids && !(hdr.flags & STATE_TRACEIDS))
+	throw runtime_error(where + "state was saved without trace ids");
+#ifdef ENABLE_TTL
+    cfg.n_ttls = hdr.n_ttls;
+    ttlVec::n_ttls = cfg.n_ttls;
+    uint64_t ttlsize = cfg.n_ttls > 0 ? ttlVec().rawsize() + 1 : 0;
+    if (hdr.ttls_len != (hdr.n_named + 2 * uint64_t(hdr.n_nodes)) * ttlsize)
+	throw runtime_error(where + "corrupt state file");
+    const uint8_t *ttl = state.ttls;
+#else
+    if (hdr.n_ttls > 0)
+	throw runtime_error(where + "state has TTLs, but TTL features are disabled");
+#endif
+
+    pathLoader.n_raw_traces = int(hdr.n_raw_traces);
+    pathLoader.n_good_traces = unsigned(hdr.n_good_traces);
+    pathLoader.n_loops = int(hdr.n_loops);
+    pathLoader.n_discarded_traces = int(hdr.n_discarded_traces);
+    n_anon = unsigned(hdr.n_anon_hops);
+    n_total_hops = unsigned(hdr.n_total_hops);
+    n_bad_31_traces = unsigned(hdr.n_bad_31_traces);
+    n_not_min_mask = unsigned(hdr.n_not_min_mask);
+    n_not_min_net = unsigned(hdr.n_not_min_net);
+    n_same_min_net = unsigned(hdr.n_same_min_net);
+    nodes.nextid = hdr.next_nodeid;
+    links.nextid = hdr.next_linkid;
+    anonIfaces.maxid = hdr.n_anon;
+
+    // Restore the fields common to named and anonymous interfaces.
+    auto restore = [&](ExplicitIface *iface, const StateIface &si, uint32_t i) {
+	iface->nodeid = si.nodeid;
+	iface->linkid = si.linkid;
+	iface->seen_as_transit = si.flags & STATE_TRANSIT;
+	iface->seen_as_dest = si.flags & STATE_DEST;
+	iface->traces.assignRaw(state.traces + state.traces_idx[i],
+	    uint32_t(state.traces_idx[i+1] - state.traces_idx[i]));
+    };
+    // A PathSeg<N> has the layout of N addresses.
+    const PathSeg<2> *prev2 = reinterpret_cast<const PathSeg<2>*>(state.prev);
+    const PathSeg<1> *prev1 = reinterpret_cast<const PathSeg<1>*>(state.prev);
+    const PathSeg<1> *next1 = reinterpret_cast<const PathSeg<1>*>(state.next);
+
+    uint32_t i;
+    ip4addr_t prevaddr(0);
+    for (i = 0; i < hdr.n_named; ++i) {
+	const StateIface &si = state.ifaces[i];
+	if ((si.flags & STATE_ANON) || isAnon(ip4addr_t(si.addr)) ||
+	    (i > 0 && si.addr <= prevaddr) || (state.prev_idx[i+1] - state.prev_idx[i]) % 2)
+		throw runtime_error(where + "corrupt state file");
+	prevaddr = ip4addr_t(si.addr);
+	NamedIface *iface = new (namedIfacePool) NamedIface(prevaddr);
+	restore(iface, si, i);
+	iface->preAliased() = si.flags & STATE_PREALIASED;
+	iface->prev.assign(prev2 + state.prev_idx[i] / 2, prev2 + state.prev_idx[i+1] / 2);
+	iface->next.assign(next1 + state.next_idx[i], next1 + state.next_idx[i+1]);
+#ifdef ENABLE_TTL
+	if (ttlsize) {
+	    if (*ttl) iface->ttl.setRaw(ttl + 1);
+	    ttl += ttlsize;
+	}
+#endif
+	namedIfaces.insert(namedIfaces.end(), iface);
+	if (iface->nodeid && nodeMembers)
+	    nodeMembers->insert(iface);
+    }
+    anonIfaces.reserve(hdr.n_anon);
+    for (uint32_t k = 0; k < hdr.n_anon; ++k, ++i) {
+	const StateIface &si = state.ifaces[i];
+	if (!(si.flags & STATE_ANON) || si.addr != ((k + 1) | AnonIface::PREFIX))
+	    throw runtime_error(where + "corrupt state file");
+	AnonIface *iface = new (anonIfacePool) AnonIface(ip4addr_t(si.addr));
+	restore(iface, si, i);
+	iface->redundant = ip4addr_t(si.redundant);
+	iface->prev.assign(prev1 + state.prev_idx[i], prev1 + state.prev_idx[i+1]);
+	anonIfaces.push_back(iface);
+    }
+
+    // Find the interface with address addr.
+    auto lookup = [&](uint32_t addr) -> Iface* {
+	if (isAnon(ip4addr_t(addr))) {
+	    uint32_t id = addr & ~AnonIface::NETMASK;
+	    if (id > 0 && id <= anonIfaces.size())
+		return anonIfaces[id - 1];
+	} else {
+	    NamedIface key((ip4addr_t(addr)));
+	    NamedIfaceSet::const_iterator it = namedIfaces.find(&key);
+	    if (it != namedIfaces.end())
+		return *it;
+	}
+	throw runtime_error(where + "unknown interface " + string(ip4addr_t(addr)));
+    };
+    uint64_t k;
+    for (uint32_t n = 0; n < hdr.n_nodes; ++n) {
+	NodeSet::iterator node = nodes.emplace_hint(nodes.end(),
+	    piecewise_construct, forward_as_tuple(state.node_ids[n]),
+	    forward_as_tuple());
+	for (k = state.node_ifaces_idx[n]; k < state.node_ifaces_idx[n+1]; ++k)
+	    node->second.ifaces.push_back(lookup(state.node_ifaces[k]));
+#ifdef ENABLE_TTL
+	if (ttlsize) {
+	    if (*ttl) node->second.min_ttl.setRaw(ttl + 1);
+	    ttl += ttlsize;
+	    if (*ttl) node->second.max_ttl.setRaw(ttl + 1);
+	    ttl += ttlsize;
+	}
+#endif
+    }
+    for (uint32_t l = 0; l < hdr.n_links; ++l) {
+	LinkSet::iterator link = links.insert(links.end(),
+	    LinkSet::value_type(state.link_ids[l], Link()));
+	for (k = state.link_ifaces_idx[l]; k < state.link_ifaces_idx[l+1]; ++k)
+	    link->second.ifaces.push_back(lookup(state.link_ifaces[k]));
+	for (k = state.link_nodes_idx[l]; k < state.link_nodes_idx[l+1]; ++k)
+	    link->second.nodes.push_back(state.link_nodes[k]);
+    }
+
+    for (k = 0; k < hdr.n_bad_subnets; ++k) {
+	const StatePrefix &sp = state.bad_subnets[k];
+	badSubnets->insert(badSubnets->end(),
+	    NetPrefix(ip4addr_t(sp.addr), uint8_t(sp.len)));
+    }
+    dstlinks.reserve(hdr.n_dstlinks);
+    for (k = 0; k < hdr.n_dstlinks; ++k) {
+	dstlinks.push_back(OrderedAddrPair(ip4addr_t(state.dstlinks[2*k]),
+	    ip4addr_t(state.dstlinks[2*k+1]), false));
+    }
+    dstlinks.compact();
+
+    // anonymous segments, so that more traces can be loaded
+    for (k = 0; k < hdr.n_anon_segs; ++k) {
+	const StateAnonSeg &ss = state.anon_segs[k];
+	if (ss.length == 0 || ss.length > MAXHOPS || ss.loAnon > hdr.n_anon ||
+	    ss.length > hdr.n_anon - ss.loAnon)
+		throw runtime_error(where + "corrupt state file");
+	anonSegs.insert(new (anonSegPool) AnonSeg(ip4addr_t(ss.lo),
+	    ip4addr_t(ss.hi), int(ss.length), ss.loAnon));
+    }
+
+    out_log << "# loaded state: traces=" << pathLoader.n_good_traces <<
+	" namedIfaces=" << namedIfaces.size() <<
+	" anonIfaces=" << anonIfaces.size() <<
+	" nodes=" << nodes.size() <<
+	" links=" << links.size() <<
+	" badSubnets=" << badSubnets->size() <<
+	" dstlinks=" << dstlinks.size() <<
+	" anonSegs=" << anonSegs.size() <<
+	endl;
+}
+
+// Number of items formatted by each slice of writeLines().
+static const size_t WRITE_SLICE_ITEMS = 4096;
+
+// Write a line for each item in [begin, end) to out, using format().  Batches
+// of slices are formatted in parallel, and then written in order, so only a
+// bounded amount of formatted text is held in memory.
+template<class It>
+void KaparContext::writeLines(OutFile &out, It begin, It end)
+{
+    size_t n_slices = cfg.n_threads * PARALLEL_SLICES_PER_THREAD;
+    vector<It> start(n_slices + 1);
+    vector<OutBuf> bufs(n_slices);
+    while (begin != end) {
+	size_t k = 0;
+	start[0] = begin;
+	while (k < n_slices && begin != end) {
+	    for (size_t i = 0; i < WRITE_SLICE_ITEMS && begin != end; ++i)
+		++begin;
+	    start[++k] = begin;
+	}
+	parallelFor(k, k, [&](size_t, size_t, size_t slice) {
+	    for (It it = start[slice]; it != start[slice+1]; ++it) {
+		format(bufs[slice], *it);
+		bufs[slice].put('\n');
+	    }
+	});
+	for (size_t i = 0; i < k; ++i)
+	    out.write(bufs[i]);
+    }
+}
+
+
+static string perfCommand;	// command line, for the performance report,
+				// or empty if there is no report to write
 
 static void exitPerformance()
 {
-    memoryInfo.print("exit");
+    if (perfCommand.empty()) return;
+    mainContext->memoryInfo.print("exit");
+    mainContext->memoryInfo.writeReport(mainContext->outfileName(".perf.json"), perfCommand);
 }
 
-int main(int argc, char *argv[])
+// Are trace ids needed by the configuration?
+bool KaparContext::needTraceIDs()
 {
-  InFile::fork = false;
-  try {
-    set_new_handler(outOfMemory);
-    time(&cfg.start_time);
-    pathLoader.handler = new MyPathLoaderHandler;
-    pathLoader.raw = false;
+    return cfg.infer_aliases || cfg.output_subnets ||
+	!cfg.aliasFiles.empty() || cfg.min_subnet_middle_required < 30;
+}
 
-    // default options
-    cfg.filetype = 0;
-    // -r31
-    cfg.s30_beats_s31 = false;
-    // -sir
-    cfg.subnet_inference = true;
-    cfg.subnet_rank = true;
-    // -c0.5
-    cfg.mincompleteness = MINCOMPLETENESS;
-    // -nv
-    cfg.alias_subnet_verify = true;
-    // -adms
-    cfg.anon_dups = true;
-    cfg.anon_match = true;
-    cfg.anon_shared_nodelink = true;
-    // -m?
-    cfg.min_subnet_middle_required = -1;
-    // -O kapar
-    cfg.output_basename = 0;
-    // -ial
-    cfg.infer_aliases = true;
-    cfg.infer_links = true;
-    // -oal
-    cfg.output_aliases = true;
-    cfg.output_links = true;
-    cfg.output_ifaces = false;
-    cfg.output_subnets = false;
-    // -1a
-    cfg.oneloop_anon = true;
-    // -py
-    cfg.markNonP2P = true;
-    // -z24
-    cfg.minsubnetlen = MINSUBNETLEN;
+size_t KaparContext::countInputFiles()
+{
+    return cfg.bogonFiles.size() + cfg.aliasFiles.size() +
 #ifdef ENABLE_TTL
-    // -tsi (equivalent to -tA in version <= 1.105)
-    cfg.ttl_beats_subnet = true;
-    cfg.ttl_beats_inferred_alias = true;
-    cfg.ttl_beats_loaded_alias = false;
+	cfg.ttlFiles.size() +
 #endif
-    // -X0
-    cfg.pfxlen = 0;
+	cfg.ifaceFiles.size() + cfg.dstFiles.size() + cfg.traceFiles.size();
+}
+
+// Run the analysis once for each configuration in the sweep file, each in a
+// child process forked after loading so that it shares the loaded data with
+// the parent (copy-on-write).  Each line of the file holds the options of a
+// configuration, which are applied on top of the command line options.
+// Returns only in a child, with cfg set to its configuration and its output
+// files open; the parent waits for each child in turn, and then exits.
+void KaparContext::runSweep(char *argv[])
+{
+    vector<vector<char*> > configs; // argv of each configuration
+    InFile in(cfg.sweep_file);
+    char buf[8192], *saveptr;
+    while (in.gets(buf, sizeof(buf))) {
+	if (buf[0] == '#') continue; // comment
+	vector<char*> args(1, argv[0]);
+	for (char *tok = strtok_r(buf, " \t\n", &saveptr); tok;
+	    tok = strtok_r(NULL, " \t\n", &saveptr))
+	    args.push_back(strdup(tok));
+	if (args.size() > 1)
+	    configs.push_back(args);
+    }
+    in.close();
+    out_log << "# sweep: " << configs.size() << " configurations from " <<
+	cfg.sweep_file << endl;
+
+    ostringstream loadOptions;
+    printLoadOptions(loadOptions);
+    string basename = outfileName("");
+    size_t n_files = countInputFiles();
+    const char *load_state = cfg.load_state, *save_state = cfg.save_state;
+    bool need_traceids = cfg.need_traceids;
+    int n_failed = 0;
+
+    for (size_t i = 0; i < configs.size(); ++i) {
+	string line;
+	for (size_t j = 1; j < configs[i].size(); ++j)
+	    line += string(" ") + configs[i][j];
+	out_log << "# sweep configuration " << (i+1) << ":" << line << endl;
+	out_log.flush();
+	cout.flush();
+	cerr.flush();
+	pid_t pid = fork();
+	if (pid < 0)
+	    throw runtime_error(string("fork: ") + strerror(errno));
+	if (pid == 0) {
+	    if (spillArena)
+		spillArena->detach(); // don't change the parent's spilled data
+	    ostringstream name;
+	    name << basename << "." << (i+1);
+	    cfg.output_basename = strdup(name.str().c_str());
+	    cfg.filetype = 0;
+	    // A rejected configuration leaves no files behind, not even a
+	    // performance report.
+	    string command = perfCommand;
+	    perfCommand.clear();
+	    parseOptions(int(configs[i].size()), configs[i].data());
+	    ostringstream options;
+	    printLoadOptions(options);
+	    if (options.str() != loadOptions.str())
+		throw runtime_error("sweep configuration " + to_string(i+1) +
+		    " changes loading options (" + loadOptions.str() + " ->" +
+		    options.str() + ")");
+	    if (countInputFiles() != n_files || cfg.load_state != load_state ||
+		cfg.save_state != save_state)
+		    throw runtime_error("sweep configuration " + to_string(i+1) +
+			" has input or state file options");
+	    if (needTraceIDs() && !need_traceids)
+		throw runtime_error("sweep configuration " + to_string(i+1) +
+		    " needs trace ids, which were not loaded (add -os to the"
+		    " command line)");
+	    cfg.sweep_file = 0;
+	    perfCommand = command + " (sweep configuration " +
+		to_string(i+1) + ":" + line + ")";
+	    out_log.close();
+	    openOutfile(out_log, ".log", argv);
+	    openResultFiles(argv);
+	    return;
+	}
+	int status;
+	while (waitpid(pid, &status, 0) < 0) {
+	    if (errno != EINTR)
+		throw runtime_error(string("waitpid: ") + strerror(errno));
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+	    out_log << "# sweep configuration " << (i+1) << " FAILED" << endl;
+	    ++n_failed;
+	}
+    }
+    out_log << "# sweep: " << (configs.size() - n_failed) << " of " <<
+	configs.size() << " configurations succeeded" << endl;
+    memoryInfo.print("done");
+    exit(n_failed ? 1 : 0);
+}
+
+// Can -x use loadTracesFast()?  Not if anything but traces adds interfaces, or
+// if the state must be saved or swept.
+bool KaparContext::canExtractFast()
+{
+    return cfg.mode_extract && cfg.aliasFiles.empty() &&
+	cfg.ifaceFiles.empty() &&
+#ifdef ENABLE_TTL
+	cfg.ttlFiles.empty() &&
+#endif
+	!cfg.load_state && !cfg.save_state && !cfg.sweep_file &&
+	!debugOn(DEBUG_PATH) && !debugOn(DEBUG_SUBNET);
+}
+
+// The missing middle addresses that findSmallerSubnets() would find in the
+// sorted addresses [begin, end), which share a /(len-1) prefix.
+void KaparContext::findMissingMiddles(const ip4addr_t *begin,
+    const ip4addr_t *end, int len, vector<ip4addr_t> &mids) const
+{
+    const ip4addr_t *i, *j, *m;
+    for (i = begin; i != end; i = j) {
+	ip4addr_t maxaddr = maxAddr(*i, len);
+	for (j = i + 1; j != end && *j <= maxaddr; ++j) { }
+	int n = int(j - i);
+	if (n < 2) continue;
+	int sublen = maxSubnetLen(*i, *(j-1));
+	if (sublen >= len && sublen < 30 &&
+	    sublen >= cfg.min_subnet_middle_required &&
+	    float(n) / ((1 << (32-sublen)) - 2) >= cfg.mincompleteness)
+	{
+	    ip4addr_t mid1(maxAddr(netPrefix(*i, sublen), sublen+1));
+	    ip4addr_t mid2(mid1 + 1);
+	    for (m = i; m != end && *m <= mid2; ++m) {
+		if (*m == mid1 || *m == mid2)
+		    break; // we found a middle address
+	    }
+	    if (m == end || *m > mid2) {
+		mids.push_back(mid1);
+		mids.push_back(mid2);
+	    }
+	}
+	if (n > 2) // might contain smaller subnets
+	    findMissingMiddles(i, j, max(sublen,len) + 1, mids);
+    }
+}
 
-    pathLoader.include_src = true;
+// The fast path of address extraction (-x), which builds no interfaces:  load
+// the trace files in parallel into a bitmap of the address space.
+void KaparContext::loadTracesFast(AddrBitmap *addrs)
+{
+    // results of each file, combined in order after the files are loaded
+    struct FileResult {
+	string warnings, error;
+	int n_traces, n_raw, n_loops, n_discarded;
+	unsigned n_good, n_anon, n_total_hops, n_bad_31_traces;
+    };
+    size_t n_files = cfg.traceFiles.size();
+    vector<FileResult> results(n_files);
+    parallelFor(n_files, n_files,
+	[&](size_t, size_t, size_t k) {
+	    FileResult &res = results[k];
+	    ostringstream warn;
+	    PathLoader loader;
+	    loader.raw = pathLoader.raw;
+	    loader.loop_discard = pathLoader.loop_discard;
+	    loader.loop_after = pathLoader.loop_after;
+	    loader.include_src = pathLoader.include_src;
+	    loader.include_dst = pathLoader.include_dst;
+	    loader.dst_filter = pathLoader.dst_filter;
+	    loader.dst_index_dir = pathLoader.dst_index_dir;
+	    ExtractHandler handler(*this, loader, *addrs, warn);
+	    loader.handler = &handler;
+	    res.n_traces = 0;
+	    try {
+		res.n_traces = loader.load(cfg.traceFiles[k]);
+	    } catch (const std::exception &e) {
+		res.error = e.what();
+	    }
+	    handler.sendProgress();
+	    loader.handler = 0;
+	    res.warnings = warn.str();
+	    res.n_raw = loader.n_raw_traces;
+	    res.n_good = loader.n_good_traces;
+	    res.n_loops = loader.n_loops;
+	    res.n_discarded = loader.n_discarded_traces;
+	    res.n_anon = handler.n_anon;
+	    res.n_total_hops = handler.n_total_hops;
+	    res.n_bad_31_traces = handler.n_bad_31_traces;
+	});
+    for (size_t k = 0; k < n_files; ++k) {
+	const FileResult &res = results[k];
+	out_log << "# loadTraces: " << cfg.traceFiles[k] << endl;
+	out_log << res.warnings;
+	if (!res.error.empty())
+	    throw runtime_error(res.error);
+	pathLoader.n_raw_traces += res.n_raw;
+	pathLoader.n_good_traces += res.n_good;
+	pathLoader.n_loops += res.n_loops;
+	pathLoader.n_discarded_traces += res.n_discarded;
+	n_anon += res.n_anon;
+	n_total_hops += res.n_total_hops;
+	n_bad_31_traces += res.n_bad_31_traces;
+	out_log << "# traces=" << res.n_traces <<
+	    "/" << pathLoader.n_good_traces <<
+	    "/" << pathLoader.n_raw_traces <<
+	    " loops=" << pathLoader.n_loops <<
+	    " discarded=" << pathLoader.n_discarded_traces << endl;
+    }
+    out_log << "# anon=" << n_anon << " hops=" << n_total_hops <<
+	" bad_31_traces=" << n_bad_31_traces << " bitmap=" <<
+	addrs->memory() << endl;
+    memoryInfo.print("loaded traces");
+}
+
+// Write the results of address extraction from the addresses loaded by
+// loadTracesFast().  They are the same as those of the general path, which
+// orders anonymous addresses (0 and the anonymous prefix, which can appear
+// only as the first or last hop) first.
+void KaparContext::writeExtracted(const AddrBitmap *addrs)
+{
+
+    // address ranges in the order of addr_less_than()
+    const uint32_t anonLo = AnonIface::PREFIX, anonHi = anonLo | ~AnonIface::NETMASK;
+    pair<uint32_t, uint32_t> ranges[4] = { make_pair(0u, 0u),
+	make_pair(anonLo, anonHi), make_pair(1u, anonLo - 1),
+	make_pair(anonHi + 1, 0xFFFFFFFFu) };
+    int n_ranges = anonHi == 0xFFFFFFFF ? 3 : 4;
+
+    // dump ifaces
+    out_addrs << "# Observed addresses: " << addrs->count() << endl;
+    OutBuf buf;
+    for (int r = 0; r < n_ranges; ++r) {
+	addrs->forEach(ranges[r].first, ranges[r].second, [&](uint32_t a) {
+	    buf.putAddr(a).put('\n');
+	    if (buf.size() >= OutFile::CHUNKSIZE) {
+		out_addrs.write(buf.data(), buf.size());
+		buf.clear();
+	    }
+	});
+    }
+    out_addrs.write(buf.data(), buf.size());
+    buf.clear();
+    out_addrs.close();
+    memoryInfo.print("dumped addrs");
+
+    if (cfg.min_subnet_middle_required < 30) {
+	// Dump missing middles.  The /minsubnetlen blocks (or /16s, whichever
+	// are larger) are analyzed in parallel, and their results kept in
+	// order.
+	int unitlen = min(cfg.minsubnetlen, 16);
+	uint64_t unitsize = uint64_t(1) << (32 - unitlen);
+	vector<pair<uint32_t, uint32_t> > units;
+	for (int r = 0; r < n_ranges; ++r) {
+	    for (uint64_t lo = ranges[r].first; lo <= ranges[r].second; ) {
+		uint64_t hi = min(uint64_t(ranges[r].second),
+		    (lo & ~(unitsize - 1)) + unitsize - 1);
+		units.push_back(make_pair(uint32_t(lo), uint32_t(hi)));
+		lo = hi + 1;
+	    }
+	}
+	size_t n_slices = cfg.n_threads * PARALLEL_SLICES_PER_THREAD;
+	vector<vector<ip4addr_t> > sliceMids(n_slices);
+	parallelFor(units.size(), n_slices,
+	    [&](size_t begin, size_t end, size_t slice) {
+		vector<ip4addr_t> unit;
+		for (size_t u = begin; u < end; ++u) {
+		    unit.clear();
+		    addrs->forEach(units[u].first, units[u].second,
+			[&unit](uint32_t a) { unit.push_back(ip4addr_t(a)); });
+		    if (unit.size() > 1)
+			findMissingMiddles(unit.data(), unit.data() + unit.size(),
+			    cfg.minsubnetlen, sliceMids[slice]);
+		}
+	    });
+	size_t n_mids = 0;
+	for (size_t i = 0; i < n_slices; ++i)
+	    n_mids += sliceMids[i].size();
+	out_missing << "# Missing ";
+	if (cfg.min_subnet_middle_required < 29)
+	   out_missing << "/" << cfg.min_subnet_middle_required << " - ";
+	out_missing << "/29 subnet middles: " << n_mids << endl;
+	for (size_t i = 0; i < n_slices; ++i) {
+	    for (size_t j = 0; j < sliceMids[i].size(); ++j)
+		buf.putAddr(sliceMids[i][j]).put('\n');
+	    out_missing.write(buf.data(), buf.size());
+	    buf.clear();
+	}
+	out_missing.close();
+    }
+}
 
+// Parse the options in argv, on top of the current configuration.
+void KaparContext::parseOptions(int argc, char *argv[])
+{
 // allow "-xarg" or "-x arg"
 #define get_optarg()  ( argv[optind][2] ? argv[optind] + 2 : \
     optind+1 < argc ? argv[++optind] : 0 )
@@ -2897,19 +4414,20 @@ int main(int argc, char *argv[])
 		    switch (*p) {
 			case 'a': cfg.infer_aliases = true; break;
 			case 'l': cfg.infer_links = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		break;
 	    case 'o':
-		cfg.output_aliases = cfg.output_links = cfg.output_ifaces = cfg.output_subnets = false;
+		cfg.output_aliases = cfg.output_links = cfg.output_ifaces = cfg.output_subnets = cfg.output_topo = false;
 		for (char *p = get_optarg(); *p; ++p) {
 		    switch (*p) {
 			case 'a': cfg.output_aliases = true; break;
 			case 'l': cfg.output_links = true; break;
 			case 'i': cfg.output_ifaces = true; break;
 			case 's': cfg.output_subnets = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			case 'b': cfg.output_topo = true; break;
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		break;
@@ -2919,7 +4437,7 @@ int main(int argc, char *argv[])
 		break;
 	    case 'g':
 		optarg = get_optarg();
-		pathLoader.grep_dst = ip4addr_t(optarg);
+		cfg.grep_dsts.push_back(ip4addr_t(optarg));
 		break;
 	    case 's':
 		cfg.subnet_verify = cfg.subnet_inference = false;
@@ -2930,12 +4448,12 @@ int main(int argc, char *argv[])
 			case 'i': cfg.subnet_inference = true; break;
 			case 'l': cfg.subnet_len = true; break;
 			case 'r': cfg.subnet_rank = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		if ((cfg.subnet_len && cfg.subnet_rank) ||
 		    (cfg.subnet_verify && cfg.subnet_inference))
-			usageExit(argv[0], argv[optind], 1);
+			throw badOption(argv[optind]);
 		break;
 	    case 'c':
 		optarg = get_optarg();
@@ -2948,7 +4466,7 @@ int main(int argc, char *argv[])
 		else if (strcmp(optarg, "v") == 0)
 		    cfg.alias_subnet_verify = true;
 		else
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		break;
 	    case 'r':
 		optarg = get_optarg();
@@ -2957,7 +4475,7 @@ int main(int argc, char *argv[])
 		else if (strcmp(optarg, "31") == 0)
 		    cfg.s30_beats_s31 = false;
 		else
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		break;
 	    case 'a':
 		cfg.anon_ignore = cfg.anon_dups = cfg.anon_match =
@@ -2968,12 +4486,12 @@ int main(int argc, char *argv[])
 			case 'd': cfg.anon_dups = true; break;
 			case 'm': cfg.anon_match = true; break;
 			case 's': cfg.anon_shared_nodelink = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		if (cfg.anon_ignore &&
 		    (cfg.anon_dups || cfg.anon_match || cfg.anon_shared_nodelink))
-			usageExit(argv[0], argv[optind], 1);
+			throw badOption(argv[optind]);
 		break;
 	    case 't':
 #ifdef ENABLE_TTL
@@ -2985,12 +4503,11 @@ int main(int argc, char *argv[])
 			case 's': cfg.ttl_beats_subnet = true; break;
 			case 'i': cfg.ttl_beats_inferred_alias = true; break;
 			case 'l': cfg.ttl_beats_loaded_alias = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 #else
-		cerr << "TTL features are disabled.\n";
-		usageExit(argv[0], argv[optind], 1);
+		throw badOption(argv[optind], "TTL features are disabled");
 #endif
 		break;
 
@@ -3001,7 +4518,7 @@ int main(int argc, char *argv[])
 		else if (strcmp(optarg, "y") == 0)
 		    cfg.markNonP2P = true;
 		else
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		break;
 	    case 'b':
 		cfg.bug_rev_anondup = cfg.bug_pprev = cfg.bug_rank = cfg.bug_broadcast = cfg.bug_BE_link = false;
@@ -3013,13 +4530,13 @@ int main(int argc, char *argv[])
 			case 'b': cfg.bug_broadcast = true; break;
 			case 'l': cfg.bug_BE_link = true; break;
 			case 'd': cfg.bug_swap_dstlink = true; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		break;
 	    case 'x':
 		if (argv[optind][2]) // trailing garbage?
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		cfg.mode_extract = true;
 		break;
 	    case 'z':
@@ -3033,12 +4550,42 @@ int main(int argc, char *argv[])
 	    case 'N':
 		cfg.negativeAlias = true;
 		break;
+	    case 'Z':
+		cfg.output_gzip = true;
+		break;
+	    case 'H':
+		memoryInfo.enableCounters();
+		break;
+	    case 'v':
+		for (int i = 0; i < N_DEBUG_CATEGORIES; ++i)
+		    cfg.debugEnabled[i] = false;
+		for (char *p = get_optarg(); *p; ++p) {
+		    if (*p == '0') continue; // none
+		    const char *c = strchr(debugCategoryOpts, *p);
+		    if (!c) throw badOption(argv[optind]);
+		    cfg.debugEnabled[c - debugCategoryOpts] = true;
+		}
+		break;
+	    case 'R':
+		optarg = get_optarg();
+		cfg.progress_interval = atoi(optarg);
+		break;
+	    case 'S':
+		optarg = get_optarg();
+		cfg.progress_endpoint = strdup(optarg);
+		break;
+	    case 'j':
+		optarg = get_optarg();
+		cfg.n_threads = atoi(optarg);
+		if (cfg.n_threads < 1)
+		    throw badOption(argv[optind]);
+		break;
 	    case 'd':
 		optarg = get_optarg();
 		switch (*optarg) {
 		    case '0': cfg.include_dst = false; break;
 		    case '1': cfg.include_dst = true; break;
-		    default:  usageExit(argv[0], argv[optind], 1);
+		    default:  throw badOption(argv[optind]);
 		}
 		cfg.include_dst_explicit = true;
 		break;
@@ -3051,7 +4598,7 @@ int main(int argc, char *argv[])
 		else if (strcmp(optarg, "r") == 0)
 		    cfg.min_subnet_middle_required = MINSUBNETLEN;
 		else
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		break;
 	    case 'l':
 		optarg = get_optarg();
@@ -3064,7 +4611,7 @@ int main(int argc, char *argv[])
 		    pathLoader.loop_discard = false;
 		    pathLoader.loop_after = true;
 		} else {
-		    usageExit(argv[0], argv[optind], 1);
+		    throw badOption(argv[optind]);
 		}
 		break;
 	    case '1':
@@ -3072,29 +4619,51 @@ int main(int argc, char *argv[])
 		    switch (*p) {
 			case 'a': cfg.oneloop_anon = true; break;
 			case 'l': cfg.oneloop_anon = false; break;
-			default:  usageExit(argv[0], argv[optind], 1);
+			default:  throw badOption(argv[optind]);
 		    }
 		}
 		break;
+	    case '-':
+		// long options, each followed by a separate argument
+		if (optind+1 >= argc)
+		    throw badOption(argv[optind]);
+		if (strcmp(argv[optind], "--save-state") == 0)
+		    cfg.save_state = argv[++optind];
+		else if (strcmp(argv[optind], "--load-state") == 0)
+		    cfg.load_state = argv[++optind];
+		else if (strcmp(argv[optind], "--sweep") == 0)
+		    cfg.sweep_file = argv[++optind];
+		else if (strcmp(argv[optind], "--memory-budget") == 0) {
+		    int mb = atoi(argv[++optind]);
+		    if (mb <= 0)
+			throw badOption(argv[optind-1]);
+		    cfg.memory_budget = size_t(mb) << 20;
+		} else if (strcmp(argv[optind], "--spill-dir") == 0)
+		    cfg.spill_dir = argv[++optind];
+		else if (strcmp(argv[optind], "--dst-index") == 0)
+		    cfg.dst_index_dir = argv[++optind];
+		else
+		    throw badOption(argv[optind]);
+		break;
 	    case 'D':
 #ifndef ENABLE_TTL
-		cerr << "TTL features are disabled.\n";
-		usageExit(argv[0], argv[optind], 1);
+		throw badOption(argv[optind], "TTL features are disabled");
 		break;
 #endif
-	    case 'B': case 'A': case 'I': case 'P':
+	    case 'B': case 'A': case 'I': case 'G': case 'P':
 		cfg.filetype = argv[optind][1];
 		if (argv[optind][2]) // allow "-Xfile" without space
 		    if (!cfg.setFile(argv[optind]+2))
-			usageExit(argv[0], 0, 1);
+			throw badOption(argv[optind]);
 		break;
 	    default:
-		usageExit(argv[0], argv[optind], 1);
+		throw badOption(argv[optind]);
 	    }
 	} else {
 	    // allow "-X... file ..."
 	    if (!cfg.setFile(argv[optind]))
-		usageExit(argv[0], 0, 1);
+		throw UsageError(string("file name \"") + argv[optind] +
+		    "\" without a preceding file option");
 	}
     }
 
@@ -3119,41 +4688,147 @@ int main(int argc, char *argv[])
 
     if (cfg.bug_rank && cfg.subnet_rank)
 	cfg.subnet_len = true;
+}
 
-    openOutfile(out_log, ".log", argv);
-    if (cfg.mode_extract) {
-	openOutfile(out_addrs, ".addrs", argv);
-	openOutfile(out_missing, ".missing", argv);
-#if 0
-	openOutfile(out_ptp, ".ptp", argv);
+KaparContext::KaparContext() :
+    cfg(), out_warn(&cerr), spillArena(0), badSubnets(0),
+    subnets(0), rankedSubnets(0), nodeMembers(0),
+    n_anon(0), n_total_hops(0), n_traceids(0), n_bad_31_traces(0),
+    n_not_min_mask(0), n_not_min_net(0), n_same_min_net(0), n_named_prev(0),
+    n_named_next(0), n_anon_prev(0)
+{
+#ifdef HAVE_PTHREAD
+    ownerThread = pthread_self();
+    inParallel = false;
 #endif
-    } else {
-	if (cfg.output_aliases)
-	    openOutfile(out_aliases, ".aliases", argv);
-	if (cfg.output_links)
-	    openOutfile(out_links, ".links", argv);
-	if (cfg.output_ifaces)
-	    openOutfile(out_ifaces, ".ifaces", argv);
-	if (cfg.output_subnets)
-	    openOutfile(out_subnets, ".subnets", argv);
+    time(&cfg.start_time);
+    pathLoader.raw = false;
+
+    // default options
+    cfg.filetype = 0;
+    // -r31
+    cfg.s30_beats_s31 = false;
+    // -sir
+    cfg.subnet_inference = true;
+    cfg.subnet_rank = true;
+    // -c0.5
+    cfg.mincompleteness = MINCOMPLETENESS;
+    // -nv
+    cfg.alias_subnet_verify = true;
+    // -adms
+    cfg.anon_dups = true;
+    cfg.anon_match = true;
+    cfg.anon_shared_nodelink = true;
+    // -m?
+    cfg.min_subnet_middle_required = -1;
+    // -O kapar
+    cfg.output_basename = 0;
+    // -ial
+    cfg.infer_aliases = true;
+    cfg.infer_links = true;
+    // -oal
+    cfg.output_aliases = true;
+    cfg.output_links = true;
+    cfg.output_ifaces = false;
+    cfg.output_subnets = false;
+    cfg.output_topo = false;
+    cfg.output_gzip = false;
+    // -vb
+    for (int i = 0; i < N_DEBUG_CATEGORIES; ++i)
+	cfg.debugEnabled[i] = (i == DEBUG_BRIEF);
+    // -1a
+    cfg.oneloop_anon = true;
+    // -py
+    cfg.markNonP2P = true;
+    // -z24
+    cfg.minsubnetlen = MINSUBNETLEN;
+#ifdef ENABLE_TTL
+    // -tsi (equivalent to -tA in version <= 1.105)
+    cfg.ttl_beats_subnet = true;
+    cfg.ttl_beats_inferred_alias = true;
+    cfg.ttl_beats_loaded_alias = false;
+#endif
+    // -X0
+    cfg.pfxlen = 0;
+    // -j<number of CPUs>
+    cfg.n_threads = parallelDefaultThreads();
+    cfg.progress_interval = 60;
+    cfg.progress_endpoint = 0;
+    cfg.save_state = 0;
+    cfg.load_state = 0;
+    cfg.sweep_file = 0;
+    cfg.memory_budget = 0;
+    cfg.spill_dir = ".";
+    cfg.dst_index_dir = 0;
+
+    pathLoader.include_src = true;
+}
+
+KaparContext::~KaparContext()
+{
+    SpillArena::Scope arenaScope(spillArena); // free into our own arena
+    delete pathLoader.handler;
+    if (subnets) {
+	for (SubnetSet::iterator sit = subnets->begin(); sit != subnets->end(); ++sit)
+	    delete (*sit);
+	delete subnets;
     }
+    delete rankedSubnets;
+    delete badSubnets;
+    delete nodeMembers;
+    // interfaces are in the pools; run their destructors before freeing them
+    for (NamedIfaceSet::iterator it = namedIfaces.begin(); it != namedIfaces.end(); ++it)
+	(*it)->~NamedIface();
+    for (AnonIfaceSet::iterator it = anonIfaces.begin(); it != anonIfaces.end(); ++it)
+	(*it)->~AnonIface();
+    namedIfacePool.freeall();
+    anonIfacePool.freeall();
+    anonSegPool.freeall();
+    delete spillArena;		// after everything allocated from it
+}
 
-    cfg.need_traceids = cfg.infer_aliases || cfg.output_subnets ||
-	!cfg.aliasFiles.empty() || cfg.min_subnet_middle_required < 30;
+// Set up the context for the options in argv.
+void KaparContext::setup(int argc, char *argv[])
+{
+    pathLoader.handler = new MyPathLoaderHandler(*this);
+
+    parseOptions(argc, argv);
+#ifdef ENABLE_TTL
+    ttlVec::n_ttls = cfg.n_ttls;
+#endif
+
+    if (cfg.load_state && (!cfg.aliasFiles.empty() ||
+#ifdef ENABLE_TTL
+	!cfg.ttlFiles.empty() ||
+#endif
+	!cfg.ifaceFiles.empty()))
+    {
+	throw UsageError("--load-state can't be used with -A, -D, or -I.");
+    }
+
+    pathLoader.handler->debug = debugOn(DEBUG_PATH);
+
+    cfg.need_traceids = needTraceIDs();
 
     cfg.dump_ptp_mates = false;
 
+    if (cfg.memory_budget)
+	spillArena = new SpillArena(cfg.spill_dir, cfg.memory_budget);
+
     subnets = new SubnetSet();
     badSubnets = new NetPrefixSet();
+    if (cfg.infer_aliases)
+	nodeMembers = new IfaceAddrIndex();
+}
 
-    memoryInfo.print("startup");
-    atexit(exitPerformance);
-
+// Load the bogon, TTL, interface, and alias input files, or the saved state.
+void KaparContext::loadInputs()
+{
     // load bogons
     bogons.installStdBogons();
     out_log << "# loaded " << bogons.size() << " bogons" << endl;
-    if (cfg.bogonFiles.size() < 1) {
-	cerr << "WARNING: no bogon files specified" << endl;
+    if (cfg.bogonFiles.size() < 1 && (!cfg.load_state || !cfg.traceFiles.empty())) {
+	*out_warn << "WARNING: no bogon files specified" << endl;
     }
     for (unsigned i = 0; i < cfg.bogonFiles.size(); ++i) {
 	out_log << "# loadBogons: " << cfg.bogonFiles[i] << endl;
@@ -3169,11 +4844,24 @@ int main(int argc, char *argv[])
 #endif
     memoryInfo.print("loaded bogons");
 
+    // compile the destination filter
+    if (!cfg.grep_dsts.empty() || !cfg.dstFiles.empty()) {
+	for (unsigned i = 0; i < cfg.grep_dsts.size(); ++i)
+	    dstFilter.add(cfg.grep_dsts[i], 32);
+	for (unsigned i = 0; i < cfg.dstFiles.size(); ++i) {
+	    out_log << "# loadDsts: " << cfg.dstFiles[i] << endl;
+	    dstFilter.load(cfg.dstFiles[i]);
+	}
+	dstFilter.compile();
+	out_log << "# loaded " << dstFilter.size() << " destination ranges" << endl;
+	pathLoader.dst_filter = &dstFilter;
+    }
+    pathLoader.dst_index_dir = cfg.dst_index_dir;
+
 #ifdef ENABLE_TTL
     // load TTL data
-    for (unsigned i = 0; i < cfg.ttlFiles.size(); ++i) {
-	loadTTLs(i, cfg.ttlFiles[i]);
-    }
+    if (!cfg.ttlFiles.empty())
+	loadTTLs();
 #if 0
     for (NamedIfaceSet::const_iterator it = namedIfaces.begin(); it != namedIfaces.end(); ++it)
     {
@@ -3209,18 +4897,33 @@ int main(int argc, char *argv[])
     }
 #endif
 
-    // load path traces
-    for (unsigned i = 0; i < cfg.traceFiles.size(); ++i) {
-	loadTraces(cfg.traceFiles[i]);
+    if (cfg.load_state) {
+	loadState(cfg.load_state);
+	memoryInfo.print("loaded state");
     }
+}
+
+// Finish loading traces (from files or the library API), save the state if
+// requested, and match anonymous interfaces.
+void KaparContext::finishLoading(char *argv[])
+{
     delete pathLoader.handler;
     pathLoader.handler = 0;
+    dstlinks.compact();
+
+    if (cfg.save_state) {
+	writeState(cfg.save_state, argv);
+	memoryInfo.print("saved state");
+    }
 
     // anonSegs is no longer needed; free it
     anonSegs.clear();
-    AnonSeg::freeall();
+    anonSegPool.freeall();
     memoryInfo.print("freed anonSegs");
 
+    if (spillArena)
+	packSpilled();
+
 #if 0
     {
 	map<int,int> prevhist;
@@ -3247,6 +4950,241 @@ int main(int argc, char *argv[])
 	matchAnonymousIfaces();
 	memoryInfo.print("matched anons");
     }
+}
+
+// Move the spilled path segments and trace id sets of all interfaces into new
+// segments of the arena, in address order, so the inference phases, which
+// visit interfaces in that order, read the spill files sequentially.
+void KaparContext::packSpilled()
+{
+    spillArena->beginRelocation();
+    for (NamedIfaceSet::iterator it = namedIfaces.begin(); it != namedIfaces.end(); ++it) {
+	(*it)->prev.relocate();
+	(*it)->next.relocate();
+	(*it)->traces.relocate();
+    }
+    for (AnonIfaceSet::iterator it = anonIfaces.begin(); it != anonIfaces.end(); ++it) {
+	(*it)->prev.relocate();
+	(*it)->traces.relocate();
+    }
+    spillArena->endRelocation();
+    spillArena->trim();
+    out_log << "# spilled " << (spillArena->usedBytes() >> 20) << " MB in " <<
+	(spillArena->mappedBytes() >> 20) << " MB of files in " <<
+	cfg.spill_dir << endl;
+    memoryInfo.print("packed spilled data");
+}
+
+// Infer subnets, aliases, and links, and write the requested outputs.
+void KaparContext::analyze(char *argv[])
+{
+    if (cfg.infer_aliases || cfg.output_subnets) {
+	findSubnets();
+	memoryInfo.print("found subnets");
+    }
+
+    if (cfg.infer_aliases) {
+	findAliases(false);
+	printNodeLinkCounts("findAliases 1");
+	memoryInfo.print("found aliases 1");
+
+	badSubnets->clear(); // no longer needed (but WAS needed for verifySubnet() during findAliases(true)).
+	delete badSubnets;
+	badSubnets = 0;
+	memoryInfo.print("freed badSubnets");
+
+	findAliases(true);
+	printNodeLinkCounts("findAliases 2");
+	memoryInfo.print("found aliases 2");
+
+	nodeMembers->clear(); // no longer needed
+	delete nodeMembers;
+	nodeMembers = 0;
+    }
+
+#if 1
+    // dump subnets
+    if (cfg.output_subnets) {
+	int rightnets = 0, leftnets = 0;
+	SubnetVec::iterator sit;
+	for (sit = rankedSubnets->begin(); sit != rankedSubnets->end(); ++sit) {
+	    out_subnets << *(*sit);
+	    if ((*sit)->used_right) {
+		rightnets++;
+		out_subnets << " CD";
+	    }
+	    if ((*sit)->used_left) {
+		leftnets++;
+		out_subnets << " BE";
+	    }
+	    out_subnets << endl;
+	}
+	out_subnets << "# found " << rankedSubnets->size() << " subnets" << endl;
+	out_subnets << "# found " << rightnets << " CD-nets" << endl;
+	out_subnets << "# found " << leftnets << " BE-nets" << endl;
+	out_subnets.close();
+	memoryInfo.print("dumped subnets");
+    }
+#endif
+
+    // TraceIDSets are no longer needed
+    for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
+	(*iit)->traces.free(true);
+    }
+    for (AnonIfaceSet::iterator iit = anonIfaces.begin(); iit != anonIfaces.end(); ++iit) {
+	(*iit)->traces.free(true);
+    }
+    memoryInfo.print("freed traceids");
+
+    // subnets are no longer needed
+    if (rankedSubnets) {
+	rankedSubnets->clear();
+	delete rankedSubnets;
+	rankedSubnets = 0;
+    }
+    for (SubnetSet::iterator sit = subnets->begin(); sit != subnets->end(); ++sit) {
+	delete (*sit);
+    }
+    subnets->clear();
+    delete subnets;
+    subnets = 0;
+    memoryInfo.print("freed subnets");
+
+    // next hops are no longer needed
+    for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
+	(*iit)->next.free(true);
+    }
+    memoryInfo.print("freed nexts");
+
+    if (cfg.infer_links) {
+	findLinks(); // note: findLinks may create aliases
+	printNodeLinkCounts("findLinks");
+	memoryInfo.print("found links");
+
+	fixOrphans();
+	memoryInfo.print("fixed orphans");
+    }
+
+    // As before -ob existed, redundant anonymous interfaces are marked only
+    // for the aliases output, so that asking for -ob doesn't change what
+    // the other outputs contain.  All outputs of a run omit the same ones.
+    if (cfg.anon_shared_nodelink && cfg.output_aliases) {
+	markRedundantAnon();
+	memoryInfo.print("redundant anon");
+    }
+
+    // dump aliases
+    if (cfg.output_aliases) {
+	nodes.calculateStats();
+	ostringstream header;
+	header << "# found " << nodes.size() << " nodes, containing " <<
+	    nodes.n_ifaces - nodes.n_redundant_ifaces << " interfaces (" <<
+	    nodes.n_redundant_ifaces << " redundant (omitted), " <<
+	    nodes.n_anon_ifaces << " anonymous, " <<
+	    nodes.n_named_ifaces << " named)." << endl;
+	out_aliases.write(header.str());
+	writeLines(out_aliases, nodes.cbegin(), nodes.cend());
+	out_aliases.close();
+	memoryInfo.print("dumped aliases");
+    }
+
+    // dump links
+    if (cfg.output_links) {
+	links.calculateStats();
+	ostringstream header;
+	header << "# found " << links.size() << " links, containing " <<
+	    links.n_ifaces - links.n_redundant_ifaces << " interfaces (" <<
+	    links.n_implicit_ifaces << " implicit, " <<
+	    links.n_redundant_ifaces << " redundant (omitted), " <<
+	    links.n_anon_ifaces << " anonymous, " <<
+	    links.n_named_ifaces << " named)." << endl;
+	out_links.write(header.str());
+	writeLines(out_links, links.cbegin(), links.cend());
+	out_links.close();
+	memoryInfo.print("dumped links");
+    }
+
+    // dump ifaces
+    if (cfg.output_ifaces) {
+	anonIfaces.calculateStats();
+	ostringstream header;
+	header << "# key:" << endl;
+	header << "#   N<n> = on Node id <n>" << endl;
+	header << "#   L<n> = on Link id <n>" << endl;
+	header << "#   T = appeared in a traceroute as a transit hop" << endl;
+	header << "#   D = appeared in a traceroute as a destination hop" << endl;
+	header << "#" << endl;
+	header << "# found " << namedIfaces.size() << " named interfaces" << endl;
+	out_ifaces.write(header.str());
+	writeLines(out_ifaces, namedIfaces.cbegin(), namedIfaces.cend());
+	header.str("");
+	header << "# found " << anonIfaces.size() << " anonymous interfaces (" << anonIfaces.n_kept_ifaces << " kept, " << anonIfaces.n_redundant_ifaces << " redundant)" << endl;
+	out_ifaces.write(header.str());
+	writeLines(out_ifaces, anonIfaces.cbegin(), anonIfaces.cend());
+	out_ifaces.close();
+	memoryInfo.print("dumped ifaces");
+    }
+
+    // dump binary topology
+    if (cfg.output_topo) {
+	writeTopology(out_topo, argv);
+	memoryInfo.print("dumped topology");
+    }
+}
+
+int KaparContext::run(int argc, char *argv[])
+{
+    setup(argc, argv);
+    SpillArena::Scope arenaScope(spillArena);
+
+    openOutfile(out_log, ".log", argv);
+    if (!cfg.sweep_file)
+	openResultFiles(argv);
+
+    for (int i = 0; i < argc; ++i)
+	perfCommand += (i ? " " : "") + string(argv[i]);
+    memoryInfo.print("startup");
+    atexit(exitPerformance);
+
+    loadInputs();
+
+    // load path traces
+    AddrBitmap *extracted = canExtractFast() ? new AddrBitmap() : 0;
+    {
+	ProgressReporter progress("kapar");
+	uint64_t total_bytes = 0;
+	for (unsigned i = 0; i < cfg.traceFiles.size(); ++i) {
+	    struct stat st;
+	    if (stat(cfg.traceFiles[i], &st) == 0)
+		total_bytes += st.st_size;
+	}
+	progress.add("traces", &pathLoader.progress_traces);
+	progress.add("hops", &progressHops);
+	progress.add("ifaces", &progressIfaces);
+	progress.add("anonSegs", &progressAnonSegs, false);
+	progress.add("bytes", &pathLoader.progress_bytes);
+	progress.setGoal(&pathLoader.progress_bytes, total_bytes);
+	progress.start(cfg.progress_interval,
+	    cfg.progress_endpoint ? cfg.progress_endpoint : "");
+	if (extracted) {
+	    loadTracesFast(extracted);
+	} else {
+	    for (unsigned i = 0; i < cfg.traceFiles.size(); ++i) {
+		loadTraces(cfg.traceFiles[i]);
+	    }
+	}
+	progress.stop();
+    }
+    if (extracted) {
+	writeExtracted(extracted);
+	delete extracted;
+	memoryInfo.print("done");
+	return 0;
+    }
+    finishLoading(argv);
+
+    if (cfg.sweep_file)
+	runSweep(argv); // returns only in a child process
 
     if (cfg.mode_extract) {
 	// Address extraction mode
@@ -3296,153 +5234,137 @@ int main(int argc, char *argv[])
 #endif
 
     } else {
-	// Analysis mode
-	if (cfg.infer_aliases || cfg.output_subnets) {
-	    findSubnets();
-	    memoryInfo.print("found subnets");
-	}
-
-	if (cfg.infer_aliases) {
-	    findAliases(false);
-	    printNodeLinkCounts("findAliases 1");
-	    memoryInfo.print("found aliases 1");
-
-	    badSubnets->clear(); // no longer needed (but WAS needed for verifySubnet() during findAliases(true)).
-	    delete badSubnets;
-	    badSubnets = 0;
-	    memoryInfo.print("freed badSubnets");
+	analyze(argv);
+    }
 
-	    findAliases(true);
-	    printNodeLinkCounts("findAliases 2");
-	    memoryInfo.print("found aliases 2");
-	}
+    memoryInfo.print("done");
+    return 0;
+}
 
-#if 1
-	// dump subnets
-	if (cfg.output_subnets) {
-	    int rightnets = 0, leftnets = 0;
-	    SubnetVec::iterator sit;
-	    for (sit = rankedSubnets->begin(); sit != rankedSubnets->end(); ++sit) {
-		out_subnets << *(*sit);
-		if ((*sit)->used_right) {
-		    rightnets++;
-		    out_subnets << " CD";
-		}
-		if ((*sit)->used_left) {
-		    leftnets++;
-		    out_subnets << " BE";
-		}
-		out_subnets << endl;
-	    }
-	    out_subnets << "# found " << rankedSubnets->size() << " subnets" << endl;
-	    out_subnets << "# found " << rightnets << " CD-nets" << endl;
-	    out_subnets << "# found " << leftnets << " BE-nets" << endl;
-	    out_subnets.close();
-	    memoryInfo.print("dumped subnets");
-	}
-#endif
+const uint32_t KaparTopology::NONE;
 
-	// TraceIDSets are no longer needed
-	for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
-	    (*iit)->traces.free(true);
-	}
-	for (AnonIfaceSet::iterator iit = anonIfaces.begin(); iit != anonIfaces.end(); ++iit) {
-	    (*iit)->traces.free(true);
-	}
-	memoryInfo.print("freed traceids");
+void KaparTopology::index()
+{
+    addrBits = 1;
+    while ((size_t(1) << addrBits) < 2 * ifaces.size())
+	++addrBits;
+    addrSlots.assign(size_t(1) << addrBits, 0);
+    uint32_t mask = uint32_t(addrSlots.size() - 1);
+    for (uint32_t i = 0; i < ifaces.size(); ++i) {
+	uint32_t h = addrSlot(ifaces[i].addr);
+	while (addrSlots[h]) h = (h + 1) & mask;
+	addrSlots[h] = i + 1;
+    }
 
-	// subnets are no longer needed
-	if (rankedSubnets) {
-	    rankedSubnets->clear();
-	    delete rankedSubnets;
-	    rankedSubnets = 0;
+    nodeById.assign(node_ids.empty() ? 0 : node_ids.back() + 1, NONE);
+    for (uint32_t n = 0; n < node_ids.size(); ++n)
+	nodeById[node_ids[n]] = n;
+    linkById.assign(link_ids.empty() ? 0 : link_ids.back() + 1, NONE);
+    for (uint32_t l = 0; l < link_ids.size(); ++l)
+	linkById[link_ids[l]] = l;
+
+    // (node, link) pairs, from the links' explicit and implicit interfaces
+    vector<pair<uint32_t, uint32_t> > nodeLink;
+    for (uint32_t l = 0; l < link_ids.size(); ++l) {
+	Range r = linkIfaces(l);
+	for (const uint32_t *p = r.begin; p != r.end; ++p) {
+	    uint32_t n = findNode(ifaces[*p].nodeid);
+	    if (n != NONE) nodeLink.push_back(make_pair(n, l));
 	}
-	for (SubnetSet::iterator sit = subnets->begin(); sit != subnets->end(); ++sit) {
-	    delete (*sit);
+	r = linkNodes(l);
+	for (const uint32_t *p = r.begin; p != r.end; ++p) {
+	    uint32_t n = findNode(*p);
+	    if (n != NONE) nodeLink.push_back(make_pair(n, l));
 	}
-	subnets->clear();
-	delete subnets;
-	subnets = 0;
-	memoryInfo.print("freed subnets");
+    }
+    sort(nodeLink.begin(), nodeLink.end());
+    nodeLink.erase(unique(nodeLink.begin(), nodeLink.end()), nodeLink.end());
+    node_links.clear();
+    node_links.reserve(nodeLink.size());
+    node_links_idx.assign(node_ids.size() + 1, 0);
+    for (size_t k = 0; k < nodeLink.size(); ++k) {
+	node_links.push_back(nodeLink[k].second);
+	++node_links_idx[nodeLink[k].first + 1];
+    }
+    for (size_t n = 0; n < node_ids.size(); ++n)
+	node_links_idx[n+1] += node_links_idx[n];
+}
 
-	// next hops are no longer needed
-	for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
-	    (*iit)->next.free(true);
-	}
-	memoryInfo.print("freed nexts");
+Kapar::Kapar(const vector<string> &options) :
+    ctx(new KaparContext()), args(options), topo(), inferred(false)
+{
+    args.insert(args.begin(), "libkapar");
+    for (size_t i = 0; i < args.size(); ++i)
+	argv.push_back(&args[i][0]);
+    argv.push_back(0);
+    int argc = int(args.size());
+    try {
+	// write no output files unless requested
+	ctx->cfg.output_aliases = ctx->cfg.output_links = false;
+	// write warnings and "# perf:" lines to the log, if any, not stderr
+	ctx->out_warn = &ctx->out_log;
+	ctx->memoryInfo.setOutput(&ctx->out_log);
+	ctx->setup(argc, argv.data());
+	SpillArena::Scope arenaScope(ctx->spillArena);
+	if (ctx->cfg.sweep_file || ctx->cfg.mode_extract)
+	    throw runtime_error("libkapar: --sweep and -x are not supported");
+	if (ctx->cfg.output_basename)
+	    ctx->openOutfile(ctx->out_log, ".log", argv.data());
+	ctx->openResultFiles(argv.data());
+	ctx->loadInputs();
+	for (unsigned i = 0; i < ctx->cfg.traceFiles.size(); ++i)
+	    ctx->loadTraces(ctx->cfg.traceFiles[i]);
+    } catch (...) {
+	delete ctx;
+	throw;
+    }
+}
 
-	if (cfg.infer_links) {
-	    findLinks(); // note: findLinks may create aliases
-	    printNodeLinkCounts("findLinks");
-	    memoryInfo.print("found links");
+Kapar::~Kapar()
+{
+    delete ctx;
+}
 
-	    fixOrphans();
-	    memoryInfo.print("fixed orphans");
-	}
+void Kapar::addTraces(const KaparTrace *traces, size_t n)
+{
+    if (inferred)
+	throw runtime_error("libkapar: addTraces() called after infer()");
+    SpillArena::Scope arenaScope(ctx->spillArena);
+    ctx->addTraces(traces, n);
+}
 
-	// dump aliases
-	if (cfg.output_aliases) {
-	    if (cfg.anon_shared_nodelink) {
-		markRedundantAnon();
-		memoryInfo.print("redundant anon");
-	    }
-	    nodes.calculateStats();
-	    out_aliases << "# found " << nodes.size() << " nodes, containing " <<
-		nodes.n_ifaces - nodes.n_redundant_ifaces << " interfaces (" <<
-		nodes.n_redundant_ifaces << " redundant (omitted), " <<
-		nodes.n_anon_ifaces << " anonymous, " <<
-		nodes.n_named_ifaces << " named)." << endl;
-	    for (NodeSet::const_iterator n = nodes.begin(); n != nodes.end(); ++n) {
-		out_aliases << *n << endl;
-		// nodes.erase(n); // keeps memory-leak-checker happy
-	    }
-	    out_aliases.close();
-	    memoryInfo.print("dumped aliases");
-	}
-
-	// dump links
-	if (cfg.output_links) {
-	    links.calculateStats();
-	    out_links << "# found " << links.size() << " links, containing " <<
-		links.n_ifaces - links.n_redundant_ifaces << " interfaces (" <<
-		links.n_implicit_ifaces << " implicit, " <<
-		links.n_redundant_ifaces << " redundant (omitted), " <<
-		links.n_anon_ifaces << " anonymous, " <<
-		links.n_named_ifaces << " named)." << endl;
-	    LinkSet::const_iterator lit;
-	    for (lit = links.begin(); lit != links.end(); ++lit) {
-		out_links << *lit << endl;
-		// links.erase(lit); // keeps memory-leak-checker happy
-	    }
-	    out_links.close();
-	    memoryInfo.print("dumped links");
-	}
+void Kapar::infer()
+{
+    if (inferred)
+	throw runtime_error("libkapar: infer() called twice");
+    inferred = true;
+    SpillArena::Scope arenaScope(ctx->spillArena);
+    ctx->finishLoading(argv.data());
+    ctx->analyze(argv.data());
+    ctx->buildTopology(topo);
+    topo.index();
+    ctx->memoryInfo.print("built topology");
+}
 
-	// dump ifaces
-	if (cfg.output_ifaces) {
-	    anonIfaces.calculateStats();
-	    out_ifaces << "# key:" << endl;
-	    out_ifaces << "#   N<n> = on Node id <n>" << endl;
-	    out_ifaces << "#   L<n> = on Link id <n>" << endl;
-	    out_ifaces << "#   T = appeared in a traceroute as a transit hop" << endl;
-	    out_ifaces << "#   D = appeared in a traceroute as a destination hop" << endl;
-	    out_ifaces << "#" << endl;
-	    out_ifaces << "# found " << namedIfaces.size() << " named interfaces" << endl;
-	    for (NamedIfaceSet::iterator iit = namedIfaces.begin(); iit != namedIfaces.end(); ++iit) {
-		dump(out_ifaces, *iit);
-	    }
-	    out_ifaces << "# found " << anonIfaces.size() << " anonymous interfaces (" << anonIfaces.n_kept_ifaces << " kept, " << anonIfaces.n_redundant_ifaces << " redundant)" << endl;
-	    for (AnonIfaceSet::iterator iit = anonIfaces.begin(); iit != anonIfaces.end(); ++iit) {
-		dump(out_ifaces, *iit);
-	    }
-	    out_ifaces.close();
-	    memoryInfo.print("dumped ifaces");
-	}
-    }
+const KaparTopology &Kapar::topology() const
+{
+    if (!inferred)
+	throw runtime_error("libkapar: topology() called before infer()");
+    return topo;
+}
 
-    memoryInfo.print("done");
-    return 0;
+int kaparMain(int argc, char *argv[])
+{
+  InFile::fork = false;
+  try {
+    set_new_handler(outOfMemory);
+    mainContext = new KaparContext(); // never deleted; see exitPerformance()
+    return mainContext->run(argc, argv);
 
+  } catch (const UsageError &e) {
+    cerr << e.what() << endl;
+    printUsage(argv[0]);
+    exit(1);
   } catch (const std::exception &e) {
     cerr << e.what() << endl;
     exit(1);
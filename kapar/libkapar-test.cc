@@ -0,0 +1,140 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Tests of libkapar that "make check" runs.  Exits with status 0 if all of
+ * them pass.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "libkapar.h"
+
+using namespace std;
+
+static int n_failed = 0;
+
+static void check(bool ok, const char *what)
+{
+    cout << (ok ? "ok:     " : "FAILED: ") << what << endl;
+    if (!ok) ++n_failed;
+}
+
+// Traces through a synthetic network of routers, each with several
+// point-to-point links numbered from 20.0.0.0/8.
+static void makeTraces(vector<vector<uint32_t> > &hops, vector<KaparTrace> &traces)
+{
+    const int N_ROUTERS = 400, N_TRACES = 4000, MAX_HOPS = 12;
+    uint32_t seed = 1;
+    hops.resize(N_TRACES);
+    for (int t = 0; t < N_TRACES; ++t) {
+	int r = t % N_ROUTERS;
+	int n = 4 + t % (MAX_HOPS - 4);
+	for (int i = 0; i < n; ++i) {
+	    seed = seed * 1103515245 + 12345;
+	    int next = (r * 7 + 1 + int((seed >> 16) % 5)) % N_ROUTERS;
+	    // the address of next's end of its link from r
+	    uint32_t link = uint32_t(r < next ? r * N_ROUTERS + next : next * N_ROUTERS + r);
+	    hops[t].push_back((20u << 24) + link * 4 + (r < next ? 2 : 1));
+	    r = next;
+	}
+    }
+    traces.resize(N_TRACES);
+    for (int t = 0; t < N_TRACES; ++t) {
+	KaparTrace trace = { 0, 0, hops[t].data(), int(hops[t].size()) };
+	traces[t] = trace;
+    }
+}
+
+static bool sameTopology(const KaparTopology &a, const KaparTopology &b)
+{
+    if (a.n_ifaces() != b.n_ifaces() || a.n_nodes() != b.n_nodes() ||
+	a.n_links() != b.n_links())
+	return false;
+    for (uint32_t i = 0; i < a.n_ifaces(); ++i) {
+	if (a.iface(i).addr != b.iface(i).addr ||
+	    a.iface(i).nodeid != b.iface(i).nodeid ||
+	    a.iface(i).linkid != b.iface(i).linkid)
+	    return false;
+    }
+    return true;
+}
+
+static vector<string> options(const char *opt1 = 0, const char *opt2 = 0)
+{
+    vector<string> v;
+    v.push_back("-j2");
+    if (opt1) v.push_back(opt1);
+    if (opt2) v.push_back(opt2);
+    return v;
+}
+
+int main()
+{
+    vector<vector<uint32_t> > hops;
+    vector<KaparTrace> traces;
+    makeTraces(hops, traces);
+
+    // reference result, from a context alone in the process
+    KaparTopology ref;
+    {
+	Kapar k(options());
+	k.addTraces(traces);
+	k.infer();
+	ref = k.topology();
+    }
+    check(ref.n_nodes() > 0 && ref.n_links() > 0, "single context infers a topology");
+
+    // A context without --memory-budget must not use the arena of another
+    // context, which is unmapped when that context is deleted.
+    {
+	Kapar *a = new Kapar(options("--memory-budget", "1"));
+	Kapar b(options());
+	a->addTraces(traces);
+	b.addTraces(traces);
+	delete a;
+	b.infer();
+	check(sameTopology(b.topology(), ref),
+	    "context is unaffected by another context's spill arena");
+    }
+
+    // Two contexts with their own arenas, used alternately.
+    {
+	Kapar a(options("--memory-budget", "1"));
+	Kapar b(options("--memory-budget", "1"));
+	a.addTraces(traces);
+	b.addTraces(traces);
+	a.infer();
+	b.infer();
+	check(sameTopology(a.topology(), ref) && sameTopology(b.topology(), ref),
+	    "contexts with separate spill arenas");
+    }
+
+    // Invalid options are reported by an exception, not by exiting.
+    try {
+	Kapar k(options("-Q"));
+	check(false, "invalid option throws");
+    } catch (const runtime_error &e) {
+	check(true, "invalid option throws");
+    }
+
+    return n_failed ? 1 : 0;
+}
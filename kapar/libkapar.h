@@ -0,0 +1,170 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * The kapar inference engine as a library (libkapar.a).  A Kapar object is
+ * configured with kapar command line options, is given traces in batches
+ * through addTraces(), and after infer() exposes the inferred topology in
+ * memory as a KaparTopology.  Lookups of an address's interface or node, a
+ * node's interfaces or links, and a link's interfaces or nodes are O(1).
+ *
+ * Example:
+ *     std::vector<std::string> options;
+ *     options.push_back("-B");
+ *     options.push_back("bogons.txt");
+ *     Kapar kapar(options);
+ *     uint32_t hops[] = { ... };	// host byte order; 0 = no response
+ *     KaparTrace t = { src, dst, hops, sizeof(hops)/sizeof(*hops) };
+ *     kapar.addTraces(&t, 1);
+ *     kapar.infer();
+ *     const KaparTopology &topo = kapar.topology();
+ *     uint32_t n = topo.nodeOf(addr);
+ *     if (n != KaparTopology::NONE) {
+ *         KaparTopology::Range r = topo.nodeLinks(n);
+ *         for (const uint32_t *p = r.begin; p != r.end; ++p)
+ *             ... topo.linkId(*p) ...
+ *     }
+ *
+ * Errors are reported by throwing std::runtime_error.
+ *
+ * Each Kapar object has its own configuration (including the debug output
+ * selected with -v), so objects don't affect each other.  The resource usage
+ * in a log written with -O is that of the whole process, though.
+ */
+
+#ifndef LIBKAPAR_H
+#define LIBKAPAR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "../lib/TopoFile.h"
+
+// One traceroute path.
+struct KaparTrace {
+    uint32_t src;		// source address, or 0 if unknown
+    uint32_t dst;		// destination address, or 0 if unknown
+    const uint32_t *hops;	// hop addresses, in order; 0 for no response
+    int n_hops;
+};
+
+// The inferred topology, in the same form as the binary topology file
+// (see TopoFile.h), plus indexes for constant time lookups.  Interfaces,
+// nodes, and links are referred to by their index in this topology; ids are
+// the node and link ids of kapar's output.
+class KaparTopology {
+    std::vector<uint32_t> addrSlots; // iface index + 1 by addr hash, or 0
+    int addrBits;		// log2 of addrSlots.size()
+    std::vector<uint32_t> nodeById, linkById; // index by id, or NONE
+    uint32_t addrSlot(uint32_t addr) const {
+	return uint32_t((uint64_t(addr) * 0x9E3779B97F4A7C15ULL) >> (64 - addrBits));
+    }
+public:
+    static const uint32_t NONE = 0xFFFFFFFF;
+    typedef TopoFile::Range Range;
+    std::vector<TopoIface> ifaces; // sorted by addr
+    std::vector<uint32_t> node_ids, node_ifaces_idx, node_ifaces;
+    std::vector<uint32_t> link_ids, link_ifaces_idx, link_ifaces;
+    std::vector<uint32_t> link_nodes_idx, link_nodes;
+    std::vector<uint32_t> node_links_idx, node_links; // link indexes
+
+    KaparTopology() : addrBits(1) {}
+    // Build the lookup indexes and node_links from the other members.
+    void index();
+
+    uint32_t n_ifaces() const { return uint32_t(ifaces.size()); }
+    const TopoIface &iface(uint32_t i) const { return ifaces[i]; }
+    // index of the interface with address addr, or NONE
+    uint32_t findIface(uint32_t addr) const {
+	uint32_t mask = uint32_t(addrSlots.size() - 1);
+	for (uint32_t h = addrSlot(addr); addrSlots[h]; h = (h + 1) & mask) {
+	    if (ifaces[addrSlots[h] - 1].addr == addr)
+		return addrSlots[h] - 1;
+	}
+	return NONE;
+    }
+    // index of the node that owns the address addr, or NONE
+    uint32_t nodeOf(uint32_t addr) const {
+	uint32_t i = findIface(addr);
+	return i == NONE ? NONE : findNode(ifaces[i].nodeid);
+    }
+
+    uint32_t n_nodes() const { return uint32_t(node_ids.size()); }
+    uint32_t nodeId(uint32_t n) const { return node_ids[n]; }
+    // index of the node with id nodeid, or NONE
+    uint32_t findNode(uint32_t nodeid) const
+	{ return nodeid < nodeById.size() ? nodeById[nodeid] : NONE; }
+    // indexes of the interfaces of the node with index n
+    Range nodeIfaces(uint32_t n) const { return range(node_ifaces_idx, node_ifaces, n); }
+    // indexes of the links of the node with index n
+    Range nodeLinks(uint32_t n) const { return range(node_links_idx, node_links, n); }
+
+    uint32_t n_links() const { return uint32_t(link_ids.size()); }
+    uint32_t linkId(uint32_t l) const { return link_ids[l]; }
+    // index of the link with id linkid, or NONE
+    uint32_t findLink(uint32_t linkid) const
+	{ return linkid < linkById.size() ? linkById[linkid] : NONE; }
+    // indexes of the explicit interfaces of the link with index l
+    Range linkIfaces(uint32_t l) const { return range(link_ifaces_idx, link_ifaces, l); }
+    // ids of nodes with implicit interfaces on the link with index l
+    Range linkNodes(uint32_t l) const { return range(link_nodes_idx, link_nodes, l); }
+
+private:
+    static Range range(const std::vector<uint32_t> &idx,
+	const std::vector<uint32_t> &v, uint32_t i)
+    {
+	Range r = { v.data() + idx[i], v.data() + idx[i+1] };
+	return r;
+    }
+};
+
+class KaparContext;
+
+class Kapar {
+    KaparContext *ctx;
+    std::vector<std::string> args;
+    std::vector<char*> argv;	// pointers into args, for option parsing
+    KaparTopology topo;
+    bool inferred;
+    Kapar(const Kapar&); // no copying
+    Kapar &operator=(const Kapar&);
+public:
+    // Options are those of the kapar command.  Input files given with -B,
+    // -A, -I, -G, and -P are loaded by the constructor, before any traces added
+    // with addTraces().  Unlike the command, no output files are written
+    // unless requested with -o; the log is written only if -O is given, and
+    // gets the warnings and "# perf:" lines that kapar writes to stderr.
+    // Invalid options throw std::runtime_error instead of exiting.
+    // Sweeps (--sweep) and address extraction (-x) are not supported.
+    explicit Kapar(const std::vector<std::string> &options =
+	std::vector<std::string>());
+    ~Kapar();
+    // Add traces, before infer().
+    void addTraces(const KaparTrace *traces, size_t n);
+    void addTraces(const std::vector<KaparTrace> &traces)
+	{ addTraces(traces.data(), traces.size()); }
+    // Run the inference phases.  The results are then in topology().
+    void infer();
+    const KaparTopology &topology() const;
+};
+
+// Run kapar like the command line program, and return its exit status.
+int kaparMain(int argc, char *argv[]);
+
+#endif // LIBKAPAR_H
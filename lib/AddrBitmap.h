@@ -0,0 +1,126 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A set of IPv4 addresses as a bitmap of the whole 2^32 address space, in the
+ * manner of utils/ipset.c:  a table of 2^16 lazily allocated leaves, each a
+ * bitmap of the 2^16 addresses of one /16 (8 KB).  add() may be called by
+ * several threads at once; the other methods may not run concurrently with
+ * add().
+ */
+
+#ifndef ADDRBITMAP_H
+#define ADDRBITMAP_H
+
+#include <stdint.h>
+#include <atomic>
+
+class AddrBitmap {
+    static const int LEAFBITS = 16;
+    static const uint32_t LEAFWORDS = (1 << LEAFBITS) / 64;
+    struct Leaf {
+	std::atomic<uint64_t> word[LEAFWORDS];
+	Leaf() {
+	    for (uint32_t i = 0; i < LEAFWORDS; ++i)
+		word[i].store(0, std::memory_order_relaxed);
+	}
+    };
+    std::atomic<Leaf*> leaves[1 << (32 - LEAFBITS)];
+    AddrBitmap(const AddrBitmap&); // no copying
+    AddrBitmap &operator=(const AddrBitmap&);
+
+    Leaf *leaf(uint32_t addr) const
+	{ return leaves[addr >> LEAFBITS].load(std::memory_order_acquire); }
+public:
+    AddrBitmap() {
+	for (uint32_t i = 0; i < (1 << (32 - LEAFBITS)); ++i)
+	    leaves[i].store(0, std::memory_order_relaxed);
+    }
+    ~AddrBitmap() {
+	for (uint32_t i = 0; i < (1 << (32 - LEAFBITS)); ++i)
+	    delete leaves[i].load(std::memory_order_relaxed);
+    }
+    void add(uint32_t addr) {
+	std::atomic<Leaf*> &slot = leaves[addr >> LEAFBITS];
+	Leaf *l = slot.load(std::memory_order_acquire);
+	if (!l) {
+	    // Racing threads may both allocate; the loser deletes its leaf.
+	    Leaf *fresh = new Leaf();
+	    if (slot.compare_exchange_strong(l, fresh, std::memory_order_acq_rel))
+		l = fresh;
+	    else
+		delete fresh;
+	}
+	uint64_t bit = uint64_t(1) << (addr & 63);
+	std::atomic<uint64_t> &w = l->word[(addr & 0xFFFF) >> 6];
+	if (!(w.load(std::memory_order_relaxed) & bit)) // usually already set
+	    w.fetch_or(bit, std::memory_order_relaxed);
+    }
+    bool contains(uint32_t addr) const {
+	const Leaf *l = leaf(addr);
+	if (!l) return false;
+	uint64_t bits = l->word[(addr & 0xFFFF) >> 6].load(std::memory_order_relaxed);
+	return (bits >> (addr & 63)) & 1;
+    }
+    // number of addresses in [lo, hi]
+    uint64_t count(uint32_t lo = 0, uint32_t hi = 0xFFFFFFFF) const {
+	uint64_t n = 0;
+	forEachWord(lo, hi, [&n](uint32_t, uint64_t bits) {
+	    n += __builtin_popcountll(bits);
+	});
+	return n;
+    }
+    // Call fn(addr) for each address in [lo, hi], in increasing order.
+    template<class Fn> void forEach(uint32_t lo, uint32_t hi, Fn fn) const {
+	forEachWord(lo, hi, [&fn](uint32_t base, uint64_t bits) {
+	    while (bits) {
+		fn(base + uint32_t(__builtin_ctzll(bits)));
+		bits &= bits - 1;
+	    }
+	});
+    }
+    // Call fn(base, bits) for each nonzero 64-bit word of addresses in
+    // [lo, hi], with the bits of addresses outside [lo, hi] cleared.
+    template<class Fn> void forEachWord(uint32_t lo, uint32_t hi, Fn fn) const {
+	if (lo > hi) return;
+	for (uint64_t l = lo >> LEAFBITS; l <= (hi >> LEAFBITS); ++l) {
+	    const Leaf *p = leaves[l].load(std::memory_order_acquire);
+	    if (!p) continue;
+	    uint32_t leafbase = uint32_t(l << LEAFBITS);
+	    uint32_t first = (l == (lo >> LEAFBITS)) ? (lo & 0xFFFF) >> 6 : 0;
+	    uint32_t last = (l == (hi >> LEAFBITS)) ? (hi & 0xFFFF) >> 6 : LEAFWORDS - 1;
+	    for (uint32_t i = first; i <= last; ++i) {
+		uint64_t bits = p->word[i].load(std::memory_order_relaxed);
+		if (!bits) continue;
+		uint32_t base = leafbase + (i << 6);
+		if (base < lo) bits &= ~uint64_t(0) << (lo - base);
+		if (hi - base < 63) bits &= ~uint64_t(0) >> (63 - (hi - base));
+		if (bits) fn(base, bits);
+	    }
+	}
+    }
+    // approximate memory used
+    size_t memory() const {
+	size_t n = sizeof(*this);
+	for (uint32_t i = 0; i < (1 << (32 - LEAFBITS)); ++i)
+	    if (leaves[i].load(std::memory_order_relaxed)) n += sizeof(Leaf);
+	return n;
+    }
+};
+
+#endif // ADDRBITMAP_H
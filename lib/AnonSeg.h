@@ -0,0 +1,64 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Anonymous trace segments:  runs of anonymous hops between a given pair of
+ * named interfaces.
+ */
+
+#ifndef ANONSEG_H
+#define ANONSEG_H
+
+#include <stdint.h>
+#include "ip4addr.h"
+#include "Pool.h"
+#include "unordered_set.h"
+
+struct AnonSeg {	// anonymous trace segment
+    const ip4addr_t lo;	// addr of lower neighboring named iface
+    const ip4addr_t hi;	// addr of higher neighboring named iface
+    const short length;	// number of anonymous hops
+    const uint32_t loAnon;	// index of anonIfaces entry of anonymous hop next to lo
+    AnonSeg(ip4addr_t lo_, ip4addr_t hi_, int length_, uint32_t idx = 0xFFFFFFFF) :
+	lo(lo_), hi(hi_), length(length_), loAnon(idx) { }
+    // AnonSegs are allocated from a pool owned by the caller:
+    //     AnonSeg *seg = new (pool) AnonSeg(lo, hi, length);
+    // and are freed by pool.free(seg, sizeof(AnonSeg)) or pool.freeall().
+    static void * operator new(size_t size, Pool<AnonSeg> &pool)
+	{ return pool.alloc(size); }
+    static void operator delete(void *p, Pool<AnonSeg> &pool)
+	{ pool.free(p, sizeof(AnonSeg)); } // if constructor throws
+private:
+    static void operator delete(void *p, size_t size); // not from the heap
+};
+
+struct AnonSegHash {
+    size_t operator()(const AnonSeg * const s) const {
+	return ((s->lo >> 16) | (s->lo << 16)) ^ s->hi ^ s->length;
+    }
+};
+
+struct AnonSegEqual {
+    bool operator()(const AnonSeg * const a, const AnonSeg * const b) const {
+	return a->lo == b->lo && a->hi == b->hi && a->length == b->length;
+    }
+};
+
+typedef UNORDERED_NAMESPACE::unordered_set<AnonSeg*, AnonSegHash, AnonSegEqual> AnonSegSet;
+
+#endif // ANONSEG_H
@@ -0,0 +1,125 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * CompactIDSet implementation
+ */
+
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+
+#include "CompactIDSet.h"
+
+bool CompactIDSet::overlaps(const CompactIDSet &that) const
+{
+    bool result = false;
+#if TEST_TRACEIDSET
+    static int call = 0;
+    bool backup_result = false;
+    call++;
+    {
+	const std::vector<TraceID> &a = this->backup, &b = that.backup;
+	size_t ai = 0, bi = 0;
+	while (ai < a.size() && bi < b.size()) {
+	    if (a[ai] < b[bi]) {
+		ai++;
+	    } else if (b[bi] < a[ai]) {
+		bi++;
+	    } else {
+		backup_result = true;
+		break;
+	    }
+	}
+    }
+#endif
+
+    IdvectorWalker a(this->data);
+    IdvectorWalker b(that.data);
+    while (a.i < a.vec.size() && b.i < b.vec.size()) {
+	if (a.val == b.val) { result = true; break; }
+	if (a.is_int && b.is_int) {
+	    // neither is a bitvector
+	    if (a.val < b.val) a.increment();
+	    else /* b.val < a.val */ b.increment();
+	} else if (a.is_int) {
+	    // b is a bitvector
+	    if (a.val < b.val) {
+		a.increment();
+	    } else /* a.val > b.val */ {
+		size_t dist = a.val - b.val;
+		if (dist-1 < 31 * (b.i - b.start - 1)) {
+		    // a.val is before b.vec[b.i]'s range
+		    a.increment();
+		} else if (dist-1 >= 31 * (b.i - b.start)) {
+		    // a.val is after b.vec[b.i]'s range
+		    b.increment();
+		} else {
+		    // a.val is in b.vec[b.i]'s range
+		    if (b.vec[b.i] & (1 << ((dist-1)%31))) { result = true; break; }
+		    a.increment();
+		}
+	    }
+	} else if (b.is_int) {
+	    // a is a bitvector
+	    if (b.val < a.val) {
+		b.increment();
+	    } else /* b.val > a.val */ {
+		size_t dist = b.val - a.val;
+		if (dist-1 < 31 * (a.i - a.start - 1)) {
+		    // b.val is before a.vec[a.i]'s range
+		    b.increment();
+		} else if (dist-1 >= 31 * (a.i - a.start)) {
+		    // b.val is after a.vec[a.i]'s range
+		    a.increment();
+		} else {
+		    // b.val is in a.vec[a.i]'s range
+		    if (a.vec[a.i] & (1 << ((dist-1)%31))) { result = true; break; }
+		    b.increment();
+		}
+	    }
+	} else {
+	    // both are bitvectors
+	    int dist = (b.val + 31*(b.i-b.start)) - (a.val + 31*(a.i-a.start));
+	    if (dist >= 0) {
+		// a's range starts before b's range
+		if (dist <= 31) { // the ranges overlap
+		    if (a.vec[a.i] & (b.vec[b.i] << dist) & MASK) { result = true; break; }
+		}
+		a.increment();
+	    } else {
+		// b's range starts before a's range
+		if (-dist <= 31) { // the ranges overlap
+		    if (b.vec[b.i] & (a.vec[a.i] << -dist) & MASK) { result = true; break; }
+		}
+		b.increment();
+	    }
+	}
+    }
+
+#if TEST_TRACEIDSET
+    if (result != backup_result) {
+	std::cerr << "# ERROR in call #" << call << ";" <<
+	    " ai=" << a.i << " astart=" << a.start << " aval=" << a.val << " a[ai]=" << std::hex << a.vec[a.i] << std::dec <<
+	    " bi=" << b.i << " bstart=" << b.start << " bval=" << b.val << " b[bi]=" << std::hex << b.vec[b.i] << std::dec <<
+	    endl;
+	::exit(1);
+    }
+#endif
+    return result;
+}
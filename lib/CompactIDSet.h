@@ -0,0 +1,166 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A compact set of trace ids.
+ */
+
+#ifndef COMPACTIDSET_H
+#define COMPACTIDSET_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include "ivector.h"
+#include "SpillArena.h"
+
+typedef uint32_t TraceID;
+
+// A set of nonnegative integers with a vector-like interface, but more
+// compact storage of clusters of nearby values.
+#define TEST_TRACEIDSET 0
+class CompactIDSet {
+    // Storage is basically a vector of integers, but if an element has FLAG
+    // set, it is a bitvector of 31 possible values following the previous
+    // element.  There can be up to MAX bitvectors in a row.
+    typedef ivector<uint32_t, TraceID, SpillAllocator<TraceID> > idvector;
+    idvector data;
+#if TEST_TRACEIDSET
+    std::vector<TraceID> backup;
+#endif
+    static const uint32_t FLAG = 0x80000000;
+    static const uint32_t MASK = 0x7fffffff;
+    static const int MAX = 33;
+public:
+    CompactIDSet() : data(0) {}
+    void append(TraceID id) {
+#if TEST_TRACEIDSET
+	backup.push_back(id);
+#endif
+	int sz = data.size();
+	if (sz > 1) {
+	    int dist;
+	    if (data[sz-1] & FLAG) {
+		int start = sz-2;
+		// search back for initial integer element
+		while (data[start] & FLAG)
+		    --start;
+		dist = id - data[start];
+		if (dist <= 31 * (sz - start - 1)) {
+		    // add id to existing bitvector
+		    data[sz-1] |= 1 << ((dist-1) % 31);
+		    return;
+		} else if ((sz - start < MAX) && (dist < 31 * (sz - start))) {
+		    // add id to new bitvector
+		    data.push_back(FLAG | (1 << ((dist-1) % 31)));
+		    return;
+		}
+	    } else if (!(data[sz-2] & FLAG)) {
+		// last two entries are not bitvectors
+		dist = id - data[sz-2];
+		if (dist <= 31) {
+		    // convert last element to bitvector and add id
+		    uint32_t bits = 1 << (dist-1);
+		    dist = data[sz-1] - data[sz-2];
+		    bits |= 1 << (dist-1);
+		    data[sz-1] = FLAG | bits;
+		    return;
+		}
+	    }
+	}
+	data.push_back(id);
+#if TEST_TRACEIDSET
+	{
+	    int val = 0, start = 0;
+	    size_t bi = 0;
+	    TraceID n;
+	    static int call = 0;
+	    call++;
+	    for (size_t i = 0; i < data.size(); ++i) {
+		if (!(data[i] & FLAG)) {
+		    start = i;
+		    val = data[i];
+		    n = data[i];
+		    if (backup[bi++] != n)
+			std::cerr << "# ERROR mismatch in call " << call << std::endl;
+		} else {
+		    uint32_t bits = data[i] & MASK;
+		    for (int j = 0; bits; ++j, bits = bits>>1) {
+			if (bits & 0x1) {
+			    n = (val + (i-start-1) * 31 + j + 1);
+			    if (backup[bi++] != n)
+				std::cerr << "# ERROR mismatch in call " << call << std::endl;
+			}
+		    }
+		}
+	    }
+	    if (bi != backup.size())
+		std::cerr << "# ERROR mismatch in call " << call << std::endl;
+	}
+#endif
+    }
+    uint32_t rawsize() const {
+	return data.size();
+    }
+    bool empty() const {
+	return data.empty();
+    }
+    uint32_t size() const {
+	if (data.empty()) return 0;
+	idvector::const_iterator i;
+	uint32_t n = 0;
+	for (i = data.begin(); i != data.end(); ++i) {
+	    if (*i & FLAG) {
+		for (uint32_t bits = *i & MASK; bits; bits = bits >> 1) {
+		    n += (bits & 0x1);
+		}
+	    } else {
+		++n;
+	    }
+	}
+	return n;
+    }
+    // Raw storage, for saving the set and restoring it with assignRaw().
+    const uint32_t *rawdata() const { return data.begin(); }
+    void assignRaw(const uint32_t *raw, uint32_t n) {
+	data.assign(raw, raw + n);
+    }
+    bool overlaps(const CompactIDSet &b) const;
+    void free(bool corrupt = false) {
+	data.free(corrupt);
+    }
+    void relocate() { data.relocate(); }
+
+    struct IdvectorWalker {
+	const idvector &vec;
+	size_t i; // position of current element
+	size_t start; // position of last integer element
+	TraceID val; // value of last integer element
+	bool is_int;
+	IdvectorWalker(const idvector &_vec) : vec(_vec), i(0), start(0), val(_vec[0]), is_int(true) {}
+	void increment() {
+	    i++;
+	    if (i < vec.size() && (is_int = !(vec[i] & FLAG))) {
+		start = i;
+		val = vec[i];
+	    }
+	}
+    };
+};
+#endif // COMPACTIDSET_H
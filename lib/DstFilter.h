@@ -0,0 +1,142 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * A set of trace destinations, given as addresses and prefixes, compiled
+ * into a lookup table for testing each trace's destination before the trace
+ * is parsed any further.  The prefixes are merged into sorted disjoint
+ * ranges of addresses, and a table indexed by the top 16 bits of an address
+ * gives the few ranges that could contain it.
+ */
+
+#ifndef DSTFILTER_H
+#define DSTFILTER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include "ip4addr.h"
+#include "infile.h"
+
+class DstFilter {
+    static const int TABLEBITS = 16;
+    typedef std::pair<uint32_t, uint32_t> Range; // first, last
+    std::vector<Range> pending;	// added since the last compile()
+    std::vector<uint32_t> lo, hi; // disjoint ranges, in order
+    // first[t] is the index of the first range with hi >= t << TABLEBITS
+    std::vector<uint32_t> first;
+public:
+    DstFilter() : first((1 << TABLEBITS) + 1, 0) {}
+
+    // Add the prefix addr/len.  Not visible to matches() until compile().
+    void add(ip4addr_t addr, int len) {
+	uint32_t mask = len == 0 ? 0 : 0xFFFFFFFF << (32 - len);
+	pending.push_back(Range(addr & mask, (addr & mask) | ~mask));
+    }
+
+    // Load a text file of addresses and prefixes, one per line, in the form
+    // "<IPaddr>" or "<IPaddr>/<len>".
+    void load(const char *filename)
+    {
+	char buf[8192];
+	char *tail, *saveptr;
+
+	InFile in(filename);
+	while (in.gets(buf, sizeof(buf))) {
+	    try {
+		const char *addrStr = strtok_r(buf, " \t\r\n", &saveptr);
+		if (!addrStr || addrStr[0] == '#') continue; // empty or comment
+		int len = 32;
+		char *slash = strchr(const_cast<char*>(addrStr), '/');
+		if (slash) {
+		    *slash = '\0';
+		    len = strtol(slash + 1, &tail, 10);
+		    if (tail == slash + 1 || *tail || len < 0 || len > 32) {
+			throw std::runtime_error(std::string("invalid prefix length \"") +
+			    (slash + 1) + "\"");
+		    }
+		}
+		add(ip4addr_t(addrStr), len);
+	    } catch (const std::runtime_error &e) { throw InFile::Error(in, e); }
+	}
+	in.close();
+    }
+
+    // Merge everything added into the lookup table.
+    void compile() {
+	for (size_t i = 0; i < lo.size(); ++i)
+	    pending.push_back(Range(lo[i], hi[i]));
+	std::sort(pending.begin(), pending.end());
+	lo.clear();
+	hi.clear();
+	for (size_t i = 0; i < pending.size(); ++i) {
+	    if (!hi.empty() && (hi.back() == 0xFFFFFFFF ||
+		pending[i].first <= hi.back() + 1))
+	    {
+		// overlaps or abuts the previous range
+		if (pending[i].second > hi.back())
+		    hi.back() = pending[i].second;
+	    } else {
+		lo.push_back(pending[i].first);
+		hi.push_back(pending[i].second);
+	    }
+	}
+	std::vector<Range>().swap(pending);
+	uint32_t r = 0;
+	for (uint64_t t = 0; t < first.size(); ++t) {
+	    while (r < hi.size() && hi[r] < (t << TABLEBITS))
+		++r;
+	    first[t] = r;
+	}
+    }
+
+    // Is addr in the set (as of the last compile())?
+    bool matches(ip4addr_t addr) const {
+	uint32_t t = uint32_t(addr) >> TABLEBITS;
+	// The range containing addr, if any, is the first one with hi >= addr,
+	// which is no earlier than first[t] and no later than first[t+1].
+	uint32_t end = std::min(first[t+1] + 1, uint32_t(hi.size()));
+	const uint32_t *p = std::lower_bound(hi.data() + first[t],
+	    hi.data() + end, uint32_t(addr));
+	return p != hi.data() + end && lo[p - hi.data()] <= addr;
+    }
+
+    // number of disjoint address ranges
+    size_t size() const { return lo.size(); }
+
+    // A hash of the ranges (as of the last compile()), to tell whether two
+    // filters select the same destinations.
+    uint64_t digest() const {
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	for (size_t i = 0; i < lo.size(); ++i) {
+	    uint32_t v[2] = { lo[i], hi[i] };
+	    for (int j = 0; j < 8; ++j) {
+		h ^= (v[j/4] >> (8 * (j%4))) & 0xFF;
+		h *= 1099511628211ULL;
+	    }
+	}
+	return h;
+    }
+    bool empty() const { return lo.empty() && pending.empty(); }
+};
+
+#endif // DSTFILTER_H
@@ -24,6 +24,12 @@ static const char *cvsID UNUSED = "$Id: MemoryInfo.cc,v 1.7 2015/09/18 19:19:01
 #include <sys/types.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#ifdef __linux__
+# include <sys/ioctl.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+#endif
 
 #include <errno.h>
 #include <iostream>
@@ -43,6 +49,10 @@ using namespace std;
 
 #if !NO_DEBUG_MEMORY
 MemoryInfo::MemoryInfo() {
+    out = &cerr;
+    gettimeofday(&initWall, 0);
+    for (int i = 0; i < N_COUNTERS; i++)
+	counter_fd[i] = -1;
     FILE *f = fopen("/proc/self/stat", "r");
     if (f) {
 	// linux
@@ -74,7 +84,170 @@ MemoryInfo::MemoryInfo() {
     prevTime = initTime;
 }
 
+MemoryInfo::~MemoryInfo() {
+    for (int i = 0; i < N_COUNTERS; i++)
+	if (counter_fd[i] >= 0) close(counter_fd[i]);
+}
+
+static const char *counterName[] = { "cycles", "instructions", "llc_misses" };
+
+void MemoryInfo::enableCounters() {
+#ifdef __linux__
+    static const uint64_t config[N_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES, // usually last level cache
+    };
+    for (int i = 0; i < N_COUNTERS; i++) {
+	if (counter_fd[i] >= 0) continue;
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config[i];
+	attr.inherit = 1; // include threads created later
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counter_fd[i] = int(syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+	if (counter_fd[i] < 0)
+	    if (out) *out << "# perf: " << counterName[i] << " counter unavailable: " <<
+		strerror(errno) << endl;
+    }
+#else
+    if (out) *out << "# perf: hardware counters are not supported on this platform" << endl;
+#endif
+}
+
+// Get the current (cumulative) resource usage.
+void MemoryInfo::sample(Sample &s, const char *label) const {
+    s.label = label;
+    struct timeval now;
+    gettimeofday(&now, 0);
+    s.wall_ms = (now.tv_sec - initWall.tv_sec) * 1e3 +
+	(now.tv_usec - initWall.tv_usec) / 1e3;
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+	s.user_ms = ru.ru_utime.tv_sec * 1e3 + ru.ru_utime.tv_usec / 1e3;
+	s.sys_ms = ru.ru_stime.tv_sec * 1e3 + ru.ru_stime.tv_usec / 1e3;
+	s.minflt = ru.ru_minflt;
+	s.majflt = ru.ru_majflt;
+#ifdef __APPLE__
+	s.peak_rss_kb = ru.ru_maxrss / 1024; // bytes
+#else
+	s.peak_rss_kb = ru.ru_maxrss; // kiB
+#endif
+    } else {
+	s.user_ms = s.sys_ms = -1;
+	s.minflt = s.majflt = s.peak_rss_kb = -1;
+    }
+    s.rss_kb = -1;
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+	char buf[256];
+	long kb;
+	while (fgets(buf, sizeof(buf), f)) {
+	    if (sscanf(buf, "VmRSS: %ld kB", &kb) == 1)
+		s.rss_kb = kb;
+	    else if (sscanf(buf, "VmHWM: %ld kB", &kb) == 1)
+		s.peak_rss_kb = kb;
+	}
+	fclose(f);
+    }
+    for (int i = 0; i < N_COUNTERS; i++) {
+	uint64_t val;
+	if (counter_fd[i] >= 0 && read(counter_fd[i], &val, sizeof(val)) == sizeof(val))
+	    s.counters[i] = int64_t(val);
+	else
+	    s.counters[i] = -1;
+    }
+}
+
+static void jsonString(ostream &out, const string &str) {
+    out << '"';
+    for (string::const_iterator c = str.begin(); c != str.end(); ++c) {
+	if (*c == '"' || *c == '\\')
+	    out << '\\' << *c;
+	else if (static_cast<unsigned char>(*c) < 0x20)
+	    out << "\\u" << hex << setw(4) << setfill('0') << int(*c) <<
+		dec << setfill(' ');
+	else
+	    out << *c;
+    }
+    out << '"';
+}
+
+static void jsonValue(ostream &out, int64_t val) {
+    if (val < 0) out << "null"; else out << val;
+}
+
+static void jsonValue(ostream &out, double val) {
+    if (val < 0) out << "null"; else out << fixed << setprecision(3) << val;
+}
+
+bool MemoryInfo::writeReport(const string &filename, const string &command) const {
+    ofstream out(filename.c_str());
+    if (!out) {
+	cerr << "# perf: can't open " << filename << ": " << strerror(errno) << endl;
+	return false;
+    }
+    out << "{\n  \"command\": ";
+    jsonString(out, command);
+    out << ",\n  \"phases\": [";
+    Sample prev;
+    prev.wall_ms = prev.user_ms = prev.sys_ms = 0;
+    prev.minflt = prev.majflt = 0;
+    for (int i = 0; i < N_COUNTERS; i++) prev.counters[i] = 0;
+    for (size_t i = 0; i < samples.size(); i++) {
+	const Sample &s = samples[i];
+	out << (i ? "," : "") << "\n    { \"label\": ";
+	jsonString(out, s.label);
+	// per-phase values, then cumulative totals and memory usage
+	out << ", \"wall_ms\": ";
+	jsonValue(out, s.wall_ms - prev.wall_ms);
+	out << ", \"user_ms\": ";
+	jsonValue(out, s.user_ms < 0 ? -1 : s.user_ms - prev.user_ms);
+	out << ", \"sys_ms\": ";
+	jsonValue(out, s.sys_ms < 0 ? -1 : s.sys_ms - prev.sys_ms);
+	out << ", \"minflt\": ";
+	jsonValue(out, s.minflt < 0 ? -1 : s.minflt - prev.minflt);
+	out << ", \"majflt\": ";
+	jsonValue(out, s.majflt < 0 ? -1 : s.majflt - prev.majflt);
+	for (int c = 0; c < N_COUNTERS; c++) {
+	    out << ", \"" << counterName[c] << "\": ";
+	    jsonValue(out, s.counters[c] < 0 ? -1 : s.counters[c] - prev.counters[c]);
+	}
+	out << ",\n      \"total_wall_ms\": ";
+	jsonValue(out, s.wall_ms);
+	out << ", \"total_user_ms\": ";
+	jsonValue(out, s.user_ms);
+	out << ", \"total_sys_ms\": ";
+	jsonValue(out, s.sys_ms);
+	out << ", \"rss_kb\": ";
+	jsonValue(out, s.rss_kb);
+	out << ", \"peak_rss_kb\": ";
+	jsonValue(out, s.peak_rss_kb);
+	out << " }";
+	prev.wall_ms = s.wall_ms;
+	if (s.user_ms >= 0) prev.user_ms = s.user_ms;
+	if (s.sys_ms >= 0) prev.sys_ms = s.sys_ms;
+	if (s.minflt >= 0) prev.minflt = s.minflt;
+	if (s.majflt >= 0) prev.majflt = s.majflt;
+	for (int c = 0; c < N_COUNTERS; c++)
+	    if (s.counters[c] >= 0) prev.counters[c] = s.counters[c];
+    }
+    out << "\n  ]\n}\n";
+    out.close();
+    if (!out) {
+	cerr << "# perf: error writing " << filename << endl;
+	return false;
+    }
+    return true;
+}
+
 void MemoryInfo::print(const char *label) {
+    samples.push_back(Sample());
+    sample(samples.back(), label);
+
     FILE *f = 0;
     int64_t nowMem;
     uint64_t nowTime;
@@ -82,12 +255,12 @@ void MemoryInfo::print(const char *label) {
 	f = fopen("/proc/self/stat", "r");
 	char buf[2048];
 	if (!fgets(buf, sizeof(buf), f)) {
-	    cerr << "# perf: error: " << strerror(errno) << endl;
+	    if (out) *out << "# perf: error: " << strerror(errno) << endl;
 	    goto err;
 	}
 	const char *p = strstr(buf, ") ");
 	if (!p) {
-	    cerr << "# perf: error: bad format" << endl;
+	    if (out) *out << "# perf: error: bad format" << endl;
 	    goto err;
 	}
 	p += 2;
@@ -104,7 +277,7 @@ void MemoryInfo::print(const char *label) {
 	char buf[2048];
 	for (int i = 0; i < 2; i++) {
 	    if (!fgets(buf, sizeof(buf), f)) {
-		cerr << "# perf: error: " << strerror(errno) << endl;
+		if (out) *out << "# perf: error: " << strerror(errno) << endl;
 		goto err;
 	    }
 	}
@@ -114,7 +287,7 @@ void MemoryInfo::print(const char *label) {
 	nowMem = (char*)sbrk(0) - (char*)0;
 	nowTime = getTimeMillis();
     }
-    cerr << "# perf: " << setw(18) << label << ": " <<
+    if (out) *out << "# perf: " << setw(18) << label << ": " <<
 	setw(8) << (nowMem - prevMem) / 1024 << " / " << setw(8) << (nowMem - initMem) / 1024 << " kiB, " <<
 	setw(9) << (nowTime - prevTime) << " / " << setw(9) << (nowTime - initTime) << " ms" << endl;
     prevMem = nowMem;
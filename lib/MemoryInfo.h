@@ -23,10 +23,19 @@
 #define MEMORYINFO_H
 
 #include <sys/time.h>
+#include <stdint.h>
+#include <iosfwd>
+#include <string>
+#include <vector>
 
 class MemoryInfo {
 #if NO_DEBUG_MEMORY
+public:
     inline void print(const char *label) const { /* do nothing */ }
+    inline void enableCounters() { /* do nothing */ }
+    inline void setOutput(std::ostream *) { /* do nothing */ }
+    inline bool writeReport(const std::string &filename,
+	const std::string &command) const { return true; }
 #else
     uint32_t getTimeMillis() {
 	struct timeval tv;
@@ -39,9 +48,37 @@ class MemoryInfo {
     int64_t initMem, prevMem;
     int64_t initTime, prevTime;
     long tickspersec;
+
+    // Structured per-phase profile, for writeReport().  Each Sample holds
+    // the cumulative values at the end of a phase; -1 means unavailable.
+    enum { CYCLES, INSTRUCTIONS, LLC_MISSES, N_COUNTERS };
+    struct Sample {
+	std::string label;
+	double wall_ms;		// since the MemoryInfo was constructed
+	double user_ms, sys_ms;
+	int64_t rss_kb, peak_rss_kb;
+	int64_t minflt, majflt;
+	int64_t counters[N_COUNTERS];
+    };
+    struct timeval initWall;
+    std::vector<Sample> samples;
+    int counter_fd[N_COUNTERS];	// perf_event_open fds, or -1
+    std::ostream *out;		// where "# perf:" lines go, or NULL
+    void sample(Sample &s, const char *label) const;
 public:
     MemoryInfo();
+    ~MemoryInfo();
     void print(const char *label);
+    // Write the "# perf:" lines to o (std::cerr by default), or nowhere if
+    // o is NULL.
+    void setOutput(std::ostream *o) { out = o; }
+    // Count cycles, instructions, and last level cache misses with hardware
+    // performance counters (if available), in this thread and threads it
+    // creates afterwards.
+    void enableCounters();
+    // Write the phases recorded by print() as JSON.
+    bool writeReport(const std::string &filename,
+	const std::string &command) const;
 #endif
 };
 
@@ -71,18 +71,25 @@ struct NetPrefixSet : public std::set<NetPrefix> {
 	install("240.0.0.0",     4); // 240/8 - 255/8 reserved (RFC1112)
     }
 
+    // Does any prefix in the set contain addr?  (Assumes that no prefix in
+    // the set contains another, as is the case after load().)
+    bool covers(ip4addr_t addr) const {
+	const_iterator it = this->upper_bound(NetPrefix(addr, 32));
+	return (it != this->begin() && (*--it).contains(addr));
+    }
+
     void load(const char *filename)
     {
 	char buf[8192];
 	const char *addrStr, *lenStr;
-	char *tail;
+	char *tail, *saveptr;
 
 	InFile in(filename);
 	while (in.gets(buf, sizeof(buf))) {
 	    try {
 		if (buf[0] == '#' || buf[0] == '\n') continue; // comment or empty
-		addrStr = strtok(buf, "/");
-		lenStr = strtok(NULL, "\n");
+		addrStr = strtok_r(buf, "/", &saveptr);
+		lenStr = strtok_r(NULL, "\n", &saveptr);
 		if (!addrStr || !lenStr) {
 		    throw std::runtime_error("syntax error; expected \"<IPaddr>/<len>\"");
 		}
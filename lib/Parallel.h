@@ -0,0 +1,163 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Minimal data-parallel loop over an index range, using pthreads if
+ * available.  Without pthreads (or with n_threads <= 1), the loop simply runs
+ * in the calling thread.
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include "SpillArena.h"
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+// Number of CPUs available to this process (at least 1).
+inline int parallelDefaultThreads()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? int(n) : 1;
+}
+
+// Divide [0, n) into n_slices contiguous slices of nearly equal size, and
+// return the boundaries:  slice i is [bounds[i], bounds[i+1]).
+inline std::vector<size_t> parallelBounds(size_t n, size_t n_slices)
+{
+    std::vector<size_t> bounds(n_slices + 1);
+    for (size_t i = 0; i <= n_slices; ++i)
+	bounds[i] = n * i / n_slices;
+    return bounds;
+}
+
+// Call fn(begin, end, slice) for each of n_slices slices of [0, n).  Slices
+// are handed out to up to n_threads threads in order of availability, so
+// fn must be safe to call concurrently for different slices.  Callers that
+// need deterministic results should store per-slice results and combine them
+// in slice order after parallelFor() returns.  The worker threads allocate
+// from the caller's current SpillArena.
+template<class Fn>
+class ParallelFor {
+    Fn &fn;
+    std::vector<size_t> bounds;
+    size_t n_slices;
+    size_t next;		// next slice to be handed out
+    SpillArena *arena;		// the caller's current arena
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+    static void *run(void *arg) {
+	ParallelFor *pf = static_cast<ParallelFor*>(arg);
+	SpillArena::Scope scope(pf->arena);
+	pf->work();
+	return 0;
+    }
+#endif
+    bool take(size_t &slice) {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&mutex);
+#endif
+	slice = next < n_slices ? next++ : n_slices;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&mutex);
+#endif
+	return slice < n_slices;
+    }
+    void work() {
+	size_t slice;
+	while (take(slice))
+	    fn(bounds[slice], bounds[slice+1], slice);
+    }
+public:
+    ParallelFor(Fn &fn_, size_t n, size_t n_slices_) :
+	fn(fn_), bounds(parallelBounds(n, n_slices_)), n_slices(n_slices_),
+	next(0), arena(SpillArena::current())
+    {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&mutex, 0);
+#endif
+    }
+    ~ParallelFor() {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&mutex);
+#endif
+    }
+    void operator()(int n_threads) {
+#ifdef HAVE_PTHREAD
+	if (n_threads > int(n_slices)) n_threads = n_slices;
+	std::vector<pthread_t> threads;
+	for (int i = 1; i < n_threads; ++i) {
+	    pthread_t thread;
+	    int r = pthread_create(&thread, 0, run, this);
+	    if (r) break; // the remaining threads will do the work
+	    threads.push_back(thread);
+	}
+#endif
+	work(); // the calling thread works too
+#ifdef HAVE_PTHREAD
+	for (size_t i = 0; i < threads.size(); ++i)
+	    pthread_join(threads[i], 0);
+#endif
+    }
+};
+
+template<class Fn>
+inline void parallelFor(int n_threads, size_t n, size_t n_slices, Fn fn)
+{
+    if (n_slices < 1) n_slices = 1;
+    ParallelFor<Fn>(fn, n, n_slices)(n_threads);
+}
+
+// Sort [first, last) with up to n_threads threads:  slices are sorted in
+// parallel, then merged in pairs in parallel, in rounds.
+template<class It, class Less>
+inline void parallelSort(int n_threads, It first, It last, Less less)
+{
+    size_t n = last - first;
+    size_t n_slices = (n_threads > 1 && n >= 65536) ? size_t(n_threads) : 1;
+    std::vector<size_t> bounds = parallelBounds(n, n_slices);
+    parallelFor(n_threads, n, n_slices,
+	[&](size_t begin, size_t end, size_t) {
+	    std::sort(first + begin, first + end, less);
+	});
+    for (size_t width = 1; width < n_slices; width *= 2) {
+	size_t n_merges = (n_slices + 2 * width - 1) / (2 * width);
+	parallelFor(n_threads, n_merges, n_merges,
+	    [&](size_t, size_t, size_t m) {
+		size_t lo = m * 2 * width;
+		size_t mid = std::min(lo + width, n_slices);
+		size_t hi = std::min(lo + 2 * width, n_slices);
+		std::inplace_merge(first + bounds[lo], first + bounds[mid],
+		    first + bounds[hi], less);
+	    });
+    }
+}
+
+template<class It>
+inline void parallelSort(int n_threads, It first, It last)
+{
+    parallelSort(n_threads, first, last, std::less<typename std::iterator_traits<It>::value_type>());
+}
+
+#endif // PARALLEL_H
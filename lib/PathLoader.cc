@@ -24,6 +24,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -66,14 +67,17 @@ using namespace std;
 
 #include "ScamperInput.h"
 #include "PathLoader.h"
+#include "DstFilter.h"
 
 const char *PathLoader::cvsID = "$Id: PathLoader.cc,v 1.29 2017/09/13 17:11:14 kkeys Exp $";
 
-int PathLoader::processTrace(const ip4addr_t *hops, int n_hops, ip4addr_t src, ip4addr_t dst, void *strace)
+inline bool PathLoader::wantDst(ip4addr_t dst) const
 {
-    if (grep_dst != 0 && dst != grep_dst)
-	return 0;
+    return !dst_filter || dst_filter->matches(dst);
+}
 
+int PathLoader::processTrace(const ip4addr_t *hops, int n_hops, ip4addr_t src, ip4addr_t dst, void *strace)
+{
     ++n_branches;
 
     if (handler->debug) {
@@ -157,6 +161,20 @@ public:
     }
 };
 
+PathLoader::PathLoader() :
+    linenum(0), filename(0), handler(0), raw(false), loop_discard(false),
+    loop_after(false), include_src(false), include_dst(false), dst_filter(0),
+    dst_index_dir(0),
+    n_loops(0), n_branches(0), n_raw_traces(0), n_good_traces(0),
+    n_discarded_traces(0), multiTrace(new MultiTrace())
+{
+}
+
+PathLoader::~PathLoader()
+{
+    delete multiTrace;
+}
+
 int PathLoader::processMultiTraceTail(const MultiTrace *mtrace, ip4addr_t *hops,
     int hoff, // offset into hops[]
     int moff, // offset into mtrace->hops[]
@@ -239,6 +257,9 @@ int PathLoader::processMultiTrace(MultiTrace *mtrace, void *strace)
 
 int PathLoader::processScamperTrace(scamper_trace_t *strace)
 {
+    if (!wantDst(scamper_to_ip4addr(strace->dst)))
+	return 0;
+
     if (strace->hop_count > MAXHOPS) {
 	++n_discarded_traces;
 	handler->warn << "#" << filename << ':' << linenum << ": too many hops (" <<
@@ -292,7 +313,7 @@ int PathLoader::processScamperTrace(scamper_trace_t *strace)
 	scamper_trace_hop_t *hi;
 	int soff; // offset into strace->hops[]
 
-	static MultiTrace mtrace;
+	MultiTrace &mtrace = *multiTrace;
 	mtrace.truncate();
 	mtrace.src = scamper_to_ip4addr(strace->src);
 	mtrace.dst = scamper_to_ip4addr(strace->dst);
@@ -316,21 +337,262 @@ int PathLoader::processScamperTrace(scamper_trace_t *strace)
 	    }
 	}
 
-	return processMultiTrace(&mtrace, strace);
+	int n_traces = processMultiTrace(&mtrace, strace);
+	mtrace.truncate(); // so a text file doesn't see it as its own
+	return n_traces;
     }
 }
 #endif
 
-int PathLoader::load(const char *filename_)
+// Publish progress after reading a raw trace.  The file position is checked
+// only occasionally, since it requires a system call.
+inline void PathLoader::noteTrace(const InFile &in, uint64_t base_bytes)
+{
+    progress_traces.set(n_raw_traces);
+    if ((n_raw_traces & 1023) == 0) {
+	long long pos = in.position();
+	if (pos >= 0) progress_bytes.set(base_bytes + pos);
+    }
+}
+
+int PathLoader::loadTrace(ip4addr_t src, ip4addr_t dst, const ip4addr_t *hops, int n_hops)
+{
+    filename = "(trace batch)";
+    linenum = 0;
+    handler->linenum++;
+    ++n_raw_traces;
+    progress_traces.set(n_raw_traces);
+    n_branches = 0;
+    if (!wantDst(dst))
+	return 0;
+    if (n_hops <= 0 || n_hops > MAXHOPS) {
+	handler->warn << "#" << filename << ": trace " << n_raw_traces <<
+	    ": hop count " << n_hops << " outside range [1," << MAXHOPS << "]" << endl;
+	++n_discarded_traces;
+	return 0;
+    }
+    MultiTrace &mtrace = *multiTrace;
+    mtrace.truncate();
+    mtrace.src = src;
+    mtrace.dst = dst;
+    for (int i = 0; i < n_hops; ++i)
+	mtrace.hops[i].push_back(hops[i]);
+    mtrace.n_hops = n_hops;
+    int n_traces = processMultiTrace(&mtrace, 0);
+    mtrace.truncate();
+    return n_traces;
+}
+
+// A destination index of an iPlane file lists, for each block of the file,
+// its trace count and data length from the block header, and the destination
+// of each of its traces.  It is valid only for the data file size and
+// modification time recorded in its header.
+static const char dstIndexMagic[16] = "kapar dstidx 1\n";
+
+struct DstIndexHeader {
+    char magic[16];
+    int64_t size;		// size of the indexed file
+    int64_t mtime;		// modification time of the indexed file
+};
+
+static string dstIndexName(const char *dir, const char *filename)
+{
+    const char *base = strrchr(filename, '/');
+    return string(dir) + "/" + (base ? base + 1 : filename) + ".dstidx";
+}
+
+static bool readDstIndex(const string &name, const struct stat &st,
+    vector<uint32_t> &index)
+{
+    ifstream in(name.c_str(), ios::binary);
+    DstIndexHeader hdr;
+    if (!in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr)) ||
+	memcmp(hdr.magic, dstIndexMagic, sizeof(hdr.magic)) != 0 ||
+	hdr.size != int64_t(st.st_size) || hdr.mtime != int64_t(st.st_mtime))
+	return false;
+    uint32_t word;
+    while (in.read(reinterpret_cast<char*>(&word), sizeof(word)))
+	index.push_back(word);
+    return in.eof();
+}
+
+static bool writeDstIndex(const string &name, const struct stat &st,
+    const vector<uint32_t> &index)
+{
+    DstIndexHeader hdr;
+    memcpy(hdr.magic, dstIndexMagic, sizeof(hdr.magic));
+    hdr.size = int64_t(st.st_size);
+    hdr.mtime = int64_t(st.st_mtime);
+    string tmpname = name + ".tmp";
+    ofstream out(tmpname.c_str(), ios::binary);
+    out.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    if (!index.empty())
+	out.write(reinterpret_cast<const char*>(&index[0]),
+	    streamsize(index.size() * sizeof(uint32_t)));
+    out.close();
+    if (!out || rename(tmpname.c_str(), name.c_str()) < 0) {
+	unlink(tmpname.c_str());
+	return false;
+    }
+    return true;
+}
+
+// iPlane file (http://iplane.cs.washington.edu/data/readoutfile.cc)
+int PathLoader::loadIplane(InFile &in, uint64_t base_bytes)
 {
-    char buf[8192];
     ip4addr_t hops[MAXHOPS]; // temp array of hop addresses
     int n_hops = 0;
+    int n_traces = 0;
+    static const long long hopBytes =
+	sizeof(struct in_addr) + sizeof(float) + sizeof(int);
+
+    // With a destination filter, use the file's destination index to skip
+    // blocks with no wanted destinations, or build the index while reading.
+    vector<uint32_t> index;
+    size_t ipos = 0;		// position of next block in index
+    bool useIndex = false, buildIndex = false;
+    string indexName;
+    struct stat st;
+    if (dst_filter && dst_index_dir && stat(in.name, &st) == 0) {
+	indexName = dstIndexName(dst_index_dir, in.name);
+	useIndex = readDstIndex(indexName, st, index);
+	if (!useIndex) {
+	    index.clear();
+	    buildIndex = true;
+	}
+    }
+
+    int clientId, uniqueId, sz, len;
+    while (1) {
+	if (in.read(&clientId, sizeof(int), 1) != 1) {
+	    break;
+	}
+	if (in.read(&uniqueId, sizeof(int), 1) != 1) {
+	    handler->warn << "# warning: " << in.name << ": incomplete\n";
+	    goto incomplete;
+	}
+	if (in.read(&sz, sizeof(int), 1) != 1) {
+	    handler->warn << "# warning: " << in.name << ": incomplete\n";
+	    goto incomplete;
+	}
+	if (in.read(&len, sizeof(int), 1) != 1) {
+	    handler->warn << "# warning: " << in.name << ": incomplete\n";
+	    goto incomplete;
+	}
+
+	if (useIndex) {
+	    if (sz < 0 || ipos + 2 + size_t(sz) > index.size() ||
+		index[ipos] != uint32_t(sz) || index[ipos+1] != uint32_t(len))
+	    {
+		handler->warn << "# warning: " << indexName <<
+		    ": does not match " << in.name << "; ignoring it\n";
+		useIndex = false;
+	    } else {
+		const uint32_t *dsts = &index[ipos+2];
+		ipos += 2 + size_t(sz);
+		bool want = false;
+		for (int i = 0; i < sz && !want; i++)
+		    want = wantDst(ip4addr_t(dsts[i]));
+		if (!want) {
+		    n_raw_traces += sz;
+		    progress_traces.set(n_raw_traces);
+		    if (in.skip(len) != len) {
+			handler->warn << "# warning: " << in.name << ": incomplete\n";
+			goto incomplete;
+		    }
+		    continue;
+		}
+	    }
+	}
+
+	/* printf("read %d records (%d bytes) from %d %d\n", sz, len, clientId, uniqueId); */
+	if (buildIndex) {
+	    index.push_back(uint32_t(sz));
+	    index.push_back(uint32_t(len));
+	}
+	long long blockBytes = 0;
+	for (int i=0; i<sz; i++) {
+	    struct in_addr dst;
+	    int ttl;
+	    if (in.read(&dst, sizeof(struct in_addr), 1) != 1) {
+		handler->warn << "# warning: " << in.name << ": incomplete\n";
+		goto incomplete;
+	    }
+	    if (in.read(&n_hops, sizeof(int), 1) != 1) {
+		handler->warn << "# warning: " << in.name << ": incomplete\n";
+		goto incomplete;
+	    }
+	    blockBytes += sizeof(struct in_addr) + sizeof(int) + n_hops * hopBytes;
+	    if (buildIndex)
+		index.push_back(ip4addr_t(dst));
+	    if (!wantDst(ip4addr_t(dst))) {
+		// skip the hops without parsing them
+		if (n_hops < 0 || in.skip(n_hops * hopBytes) != n_hops * hopBytes) {
+		    handler->warn << "# warning: " << in.name << ": incomplete\n";
+		    goto incomplete;
+		}
+		++n_raw_traces;
+		noteTrace(in, base_bytes);
+		continue;
+	    }
+	    if (handler->debug) handler->warn << "# iPlane destination: " << inet_ntoa(dst) << ", hops: " << n_hops << '\n';
+	    for (int j=0; j<n_hops; j++) {
+		struct in_addr ip;
+		float rtt;
+		if (in.read(&ip, sizeof(struct in_addr), 1) != 1) {
+		    handler->warn << "# warning: " << in.name << ": incomplete\n";
+		    goto incomplete;
+		}
+		hops[j] = ip4addr_t(ip);
+		if (in.read(&rtt, sizeof(float), 1) != 1) {
+		    handler->warn << "# warning: " << in.name << ": incomplete\n";
+		    goto incomplete;
+		}
+		if (in.read(&ttl, sizeof(int), 1) != 1) {
+		    handler->warn << "# warning: " << in.name << ": incomplete\n";
+		    goto incomplete;
+		}
+		if (ttl > 512) {
+		    handler->warn << "# error: " << in.name << " possibly corrupted\n";
+		    exit(1);
+		} else if (ttl > 512) {
+		    handler->warn << "# warning: trace " << n_traces << ", hop " << j << ": MPLS?\n";
+		}
+	    }
+	    ++n_raw_traces;
+	    noteTrace(in, base_bytes);
+	    n_branches = 0;
+	    if (!include_dst && hops[n_hops-1] == ip4addr_t(dst))
+		n_hops--;
+	    n_traces += processTrace(hops, n_hops, ip4addr_t(0), ip4addr_t(dst), 0);
+	}
+	if (buildIndex && blockBytes != len) {
+	    // the index couldn't be used to skip this block
+	    handler->warn << "# warning: " << in.name << ": block length " <<
+		len << " should be " << blockBytes << "; not indexing\n";
+	    buildIndex = false;
+	}
+    }
+
+    if (buildIndex && !writeDstIndex(indexName, st, index)) {
+	handler->warn << "# warning: " << indexName << ": can't write: " <<
+	    strerror(errno) << "\n";
+    }
+    return n_traces;
+
+incomplete:
+    return n_traces;
+}
+
+int PathLoader::load(const char *filename_)
+{
+    char buf[8192];
     int n_traces = 0; // number of traces in this file
 
     filename = filename_;
     linenum = 0;
     InFile in(filename);
+    uint64_t base_bytes = progress_bytes.get();
 
     if (in.nameEndsWith(".warts")) {
 #ifdef HAVE_SCAMPER
@@ -342,6 +604,7 @@ int PathLoader::load(const char *filename_)
 	    if (!strace) break; /* EOF */
 	    handler->linenum++; // not actually a "line", but close enough
 	    ++n_raw_traces;
+	    noteTrace(in, base_bytes);
 	    n_branches = 0;
 	    n_traces += processScamperTrace(strace);
 	    scamper_trace_free(strace);
@@ -356,78 +619,20 @@ int PathLoader::load(const char *filename_)
     } else
     if (strncmp(in.basename, "trace.out.", 10) == 0) {
 	// iPlane file (http://iplane.cs.washington.edu/data/readoutfile.cc)
-	int clientId, uniqueId, sz, len;
-	while (1) {
-	    if (in.read(&clientId, sizeof(int), 1) != 1) {
-		break;
-	    }
-	    if (in.read(&uniqueId, sizeof(int), 1) != 1) {
-		handler->warn << "# warning: " << in.name << ": incomplete\n";
-		break;
-	    }
-	    if (in.read(&sz, sizeof(int), 1) != 1) {
-		handler->warn << "# warning: " << in.name << ": incomplete\n";
-		break;
-	    }
-	    if (in.read(&len, sizeof(int), 1) != 1) {
-		handler->warn << "# warning: " << in.name << ": incomplete\n";
-		break;
-	    }
-
-	    /* printf("read %d records (%d bytes) from %d %d\n", sz, len, clientId, uniqueId); */
-	    for (int i=0; i<sz; i++) {
-		struct in_addr dst;
-		int ttl;
-		if (in.read(&dst, sizeof(struct in_addr), 1) != 1) {
-		    handler->warn << "# warning: " << in.name << ": incomplete\n";
-		    goto done_iplane;
-		}
-		if (in.read(&n_hops, sizeof(int), 1) != 1) {
-		    handler->warn << "# warning: " << in.name << ": incomplete\n";
-		    goto done_iplane;
-		}
-		if (handler->debug) handler->warn << "# iPlane destination: " << inet_ntoa(dst) << ", hops: " << n_hops << '\n';
-		for (int j=0; j<n_hops; j++) {
-		    struct in_addr ip;
-		    float rtt;
-		    if (in.read(&ip, sizeof(struct in_addr), 1) != 1) {
-			handler->warn << "# warning: " << in.name << ": incomplete\n";
-			goto done_iplane;
-		    }
-		    hops[j] = ip4addr_t(ip);
-		    if (in.read(&rtt, sizeof(float), 1) != 1) {
-			handler->warn << "# warning: " << in.name << ": incomplete\n";
-			goto done_iplane;
-		    }
-		    if (in.read(&ttl, sizeof(int), 1) != 1) {
-			handler->warn << "# warning: " << in.name << ": incomplete\n";
-			goto done_iplane;
-		    }
-		    if (ttl > 512) {
-			handler->warn << "# error: " << in.name << " possibly corrupted\n";
-			exit(1);
-		    } else if (ttl > 512) {
-			handler->warn << "# warning: trace " << n_traces << ", hop " << j << ": MPLS?\n";
-		    }
-		}
-		++n_raw_traces;
-		n_branches = 0;
-		if (!include_dst && hops[n_hops-1] == ip4addr_t(dst))
-		    n_hops--;
-		n_traces += processTrace(hops, n_hops, ip4addr_t(0), ip4addr_t(dst), 0);
-	    }
-	}
-done_iplane: ;
+	n_traces = loadIplane(in, base_bytes);
 
     } else {
 	// text file
-	static MultiTrace mtrace;
+	MultiTrace &mtrace = *multiTrace;
 	char srcbuf[16], dstbuf[16];
+	char *saveptr;
+	bool skip = !wantDst(mtrace.dst); // don't parse hops of current trace
 	while (in.gets(buf, sizeof(buf))) {
 	  try {
 	    handler->linenum++;
 	    if (buf[0] == '#') {
 		++n_raw_traces;
+		noteTrace(in, base_bytes);
 		n_branches = 0;
 		// process previous trace
 		if (mtrace.n_hops > 0)
@@ -440,11 +645,12 @@ done_iplane: ;
 		} else {
 		    mtrace.src = mtrace.dst = ip4addr_t(0);
 		}
-	    } else {
+		skip = !wantDst(mtrace.dst);
+	    } else if (!skip) {
 		char *line = buf;
 		char *token;
 		if (mtrace.n_hops < MAXHOPS) {
-		    while ((token = strtok(line, " \n"))) {
+		    while ((token = strtok_r(line, " \n", &saveptr))) {
 			ip4addr_t addr(token);
 			auto &hop = mtrace.hops[mtrace.n_hops];
 			if (std::find(hop.begin(), hop.end(), addr) == hop.end())
@@ -459,8 +665,11 @@ done_iplane: ;
 	// process last trace
 	if (mtrace.n_hops > 0)
 	    n_traces += processMultiTrace(&mtrace, 0);
+	mtrace.truncate(); // so the next file doesn't process it again
     }
 
+    long long size = in.size();
+    if (size >= 0) progress_bytes.set(base_bytes + size);
     in.close();
     return n_traces;
 }
@@ -20,6 +20,8 @@
 
 #ifndef PATHLOADER_H
 #define PATHLOADER_H
+
+#include "Progress.h"
 static const int MAXHOPS = 90;
 
 #ifdef HAVE_SCAMPER
@@ -48,10 +50,14 @@ public:
 };
 
 class MultiTrace;
+class InFile;
+class DstFilter;
 
 class PathLoader {
     int linenum;
     const char *filename;
+    PathLoader(const PathLoader&); // no copying
+    PathLoader &operator=(const PathLoader&);
 public:
     static const char *cvsID;
     static const int MAXHOPS = 90;
@@ -62,16 +68,31 @@ public:
     bool loop_after; // if true (and !raw and !discard), keep segment after loop
     bool include_src; // include src addr? (always false for iplane input)
     bool include_dst; // include dst addr?
-    ip4addr_t grep_dst;
+    const DstFilter *dst_filter; // if set, skip traces to other destinations
+    // if set, directory of destination indexes of iPlane files, which let
+    // blocks of traces with no destination in dst_filter be skipped unread
+    const char *dst_index_dir;
     // stats
     int n_loops;
     int n_branches;		// number of branches in current raw trace
     int n_raw_traces;		// number of raw traces
     unsigned n_good_traces;	// number of traces (paths)
     int n_discarded_traces;
+    // progress, readable from other threads
+    ProgressCounter progress_traces; // number of raw traces read
+    ProgressCounter progress_bytes;  // bytes of input files read
     // methods
+    PathLoader();
+    ~PathLoader();
     int load(const char *filename_);
+    // Process a trace given by the caller instead of read from a file, like
+    // a trace of a text file with one address (0 for none) at each hop.
+    int loadTrace(ip4addr_t src, ip4addr_t dst, const ip4addr_t *hops, int n_hops);
 private:
+    MultiTrace *multiTrace; // buffer for the trace being processed
+    bool wantDst(ip4addr_t dst) const;
+    int loadIplane(InFile &in, uint64_t base_bytes);
+    void noteTrace(const InFile &in, uint64_t base_bytes);
     int processTrace(const ip4addr_t *hops, int n_hops, ip4addr_t src, ip4addr_t dst, void *strace);
     int processMultiTraceTail(const MultiTrace *mtrace, ip4addr_t *hops,
 	int hoff, int moff, void *strace);
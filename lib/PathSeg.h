@@ -0,0 +1,52 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Segments of paths, and compact vectors of them.
+ */
+
+#ifndef PATHSEG_H
+#define PATHSEG_H
+
+#include <stdint.h>
+#include "ip4addr.h"
+#include "ivector.h"
+#include "SpillArena.h"
+
+// an N-hop segment of a path (trace)
+template <int N>
+class PathSeg {
+public:
+    ip4addr_t hops[N];		// N sequential interface addrs seen in a path
+    PathSeg(const ip4addr_t &a, const ip4addr_t &b) { hops[0]=a; hops[1]=b; }
+    explicit PathSeg(const ip4addr_t &a) { hops[0]=a; }
+    ip4addr_t const &hop(int i) const { return hops[i]; }
+    bool operator== (const PathSeg& b) const {
+	if (this->hop(0) != b.hop(0)) return false;
+	if (N > 1)
+	    if (this->hop(1) != b.hop(1)) return false;
+	return true;
+    }
+    bool operator!= (const PathSeg& b) const { return !(*this == b); }
+};
+
+template <int N>
+class PathSegVec :
+    public ivector<uint32_t, PathSeg<N>, SpillAllocator<PathSeg<N> > > { };
+
+#endif // PATHSEG_H
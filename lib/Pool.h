@@ -69,12 +69,14 @@ public:
     }
     ~Pool() { }
     void freeall() {
-	// quickly frees all blocks allocated by this pool
+	// quickly frees all blocks allocated by this pool, without running
+	// destructors (the caller must destroy any objects that need it)
 	while (blocklist) {
 	    Block *dead = blocklist;
 	    blocklist = blocklist->next;
-	    delete dead;
+	    ::operator delete(dead);
 	}
+	freelist = 0;
     }
 };
 
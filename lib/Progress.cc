@@ -0,0 +1,245 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * progress reporter
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "config.h"
+#include "Progress.h"
+
+static const char UNIX_PREFIX[] = "unix:";
+
+static bool isSocket(const std::string &endpoint)
+{
+    return endpoint.compare(0, sizeof(UNIX_PREFIX) - 1, UNIX_PREFIX) == 0;
+}
+
+ProgressReporter::ProgressReporter(const char *prefix_) :
+    prefix(prefix_), items(), done(0), total(0), eta(-1), interval(0),
+    endpoint(), listenfd(-1), running(false)
+{
+    wakefd[0] = wakefd[1] = -1;
+}
+
+void ProgressReporter::add(const char *name, const ProgressCounter *counter,
+    bool rate)
+{
+    Item item = { name, counter, rate, 0, 0 };
+    items.push_back(item);
+}
+
+double ProgressReporter::elapsed(const struct timeval &since) const
+{
+    struct timeval now;
+    gettimeofday(&now, 0);
+    return (now.tv_sec - since.tv_sec) + (now.tv_usec - since.tv_usec) / 1e6;
+}
+
+static std::string hms(double sec)
+{
+    long s = long(sec + 0.5);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+    return buf;
+}
+
+// Print a line of values and rates to stderr, and publish to the endpoint.
+void ProgressReporter::report(bool final)
+{
+    double dt = elapsed(prevTime);
+    double t = elapsed(startTime);
+    gettimeofday(&prevTime, 0);
+    std::ostringstream line;
+    line << "# progress: " << hms(t);
+    for (size_t i = 0; i < items.size(); ++i) {
+	Item &item = items[i];
+	uint64_t val = item.counter->get();
+	line << " " << item.name << "=" << val;
+	if (item.rate) {
+	    if (dt > 0) item.rate_per_sec = (val - item.prev) / dt;
+	    if (!final)
+		line << " (" << uint64_t(item.rate_per_sec + 0.5) << "/s)";
+	}
+	item.prev = val;
+    }
+    if (done && total) {
+	uint64_t d = done->get();
+	if (d > total) d = total;
+	line << " " << std::fixed << std::setprecision(1) <<
+	    100.0 * double(d) / double(total) << "%";
+	eta = d > 0 ? t * double(total - d) / double(d) : -1;
+	if (final)
+	    eta = 0;
+	else if (eta >= 0)
+	    line << " eta " << hms(eta);
+    }
+    if (final) line << " (done)";
+    line << "\n";
+    std::string s = line.str();
+    // a single write() keeps the line intact among other stderr output
+    if (::write(2, s.data(), s.size()) < 0) { /* ignore */ }
+    if (!endpoint.empty() && !isSocket(endpoint))
+	publish(metrics());
+}
+
+// Current values, one "<prefix>_<name> <value>" per line.
+std::string ProgressReporter::metrics() const
+{
+    std::ostringstream out;
+    out << prefix << "_elapsed_seconds " << std::fixed <<
+	std::setprecision(3) << elapsed(startTime) << "\n";
+    for (size_t i = 0; i < items.size(); ++i) {
+	const Item &item = items[i];
+	out << prefix << "_" << item.name << " " << item.counter->get() << "\n";
+	if (item.rate)
+	    out << prefix << "_" << item.name << "_per_second " <<
+		item.rate_per_sec << "\n";
+    }
+    if (done && total) {
+	out << prefix << "_progress_total " << total << "\n";
+	out << prefix << "_progress_done " << done->get() << "\n";
+	if (eta >= 0)
+	    out << prefix << "_eta_seconds " << eta << "\n";
+    }
+    return out.str();
+}
+
+// Atomically replace the endpoint file with text.
+void ProgressReporter::publish(const std::string &text) const
+{
+    std::string tmp = endpoint + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f) return;
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    if (fclose(f) != 0) ok = false;
+    if (!ok || rename(tmp.c_str(), endpoint.c_str()) < 0)
+	unlink(tmp.c_str());
+}
+
+#ifdef HAVE_PTHREAD
+void *ProgressReporter::run(void *arg)
+{
+    ProgressReporter *pr = static_cast<ProgressReporter*>(arg);
+    while (true) {
+	double wait = pr->interval - pr->elapsed(pr->prevTime);
+	if (wait <= 0) {
+	    pr->report(false);
+	    continue;
+	}
+	struct pollfd fds[2];
+	fds[0].fd = pr->wakefd[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = pr->listenfd;
+	fds[1].events = POLLIN;
+	int n = poll(fds, pr->listenfd >= 0 ? 2 : 1, int(wait * 1000) + 1);
+	if (n < 0 && errno != EINTR) break;
+	if (n <= 0) continue;
+	if (fds[0].revents) break; // stop() was called
+	if (pr->listenfd >= 0 && fds[1].revents) {
+	    int fd = accept(pr->listenfd, 0, 0);
+	    if (fd >= 0) {
+		std::string text = pr->metrics();
+		const char *p = text.data();
+		size_t len = text.size();
+		while (len > 0) {
+		    ssize_t w = ::write(fd, p, len);
+		    if (w <= 0) break;
+		    p += w;
+		    len -= size_t(w);
+		}
+		close(fd);
+	    }
+	}
+    }
+    return 0;
+}
+#endif
+
+void ProgressReporter::start(int interval_, const std::string &endpoint_)
+{
+    interval = interval_;
+    endpoint = endpoint_;
+    gettimeofday(&startTime, 0);
+    prevTime = startTime;
+    if (interval <= 0 && endpoint.empty()) return;
+    if (interval <= 0) interval = 60;
+#ifdef HAVE_PTHREAD
+    if (isSocket(endpoint)) {
+	std::string path = endpoint.substr(sizeof(UNIX_PREFIX) - 1);
+	struct sockaddr_un sun;
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(sun.sun_path))
+	    throw std::runtime_error("socket path too long: " + path);
+	strcpy(sun.sun_path, path.c_str());
+	unlink(sun.sun_path); // remove stale socket
+	listenfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenfd < 0 ||
+	    bind(listenfd, (struct sockaddr*)&sun, sizeof(sun)) < 0 ||
+	    listen(listenfd, 8) < 0)
+	{
+	    std::string msg = "can't listen on " + path + ": " + strerror(errno);
+	    if (listenfd >= 0) close(listenfd);
+	    listenfd = -1;
+	    throw std::runtime_error(msg);
+	}
+    }
+    if (pipe(wakefd) < 0)
+	throw std::runtime_error(std::string("pipe: ") + strerror(errno));
+    int r = pthread_create(&pthread, 0, run, this);
+    if (r)
+	throw std::runtime_error(std::string("pthread_create: ") + strerror(r));
+    running = true;
+#else
+    fprintf(stderr, "# progress: reporting requires pthreads\n");
+#endif
+}
+
+void ProgressReporter::stop()
+{
+    if (!running) return;
+    running = false;
+#ifdef HAVE_PTHREAD
+    char c = 0;
+    if (::write(wakefd[1], &c, 1) < 0) { /* thread will exit anyway */ }
+    pthread_join(pthread, 0);
+    close(wakefd[0]);
+    close(wakefd[1]);
+    wakefd[0] = wakefd[1] = -1;
+    if (listenfd >= 0) {
+	close(listenfd);
+	listenfd = -1;
+	unlink(endpoint.c_str() + sizeof(UNIX_PREFIX) - 1);
+    }
+#endif
+    report(true);
+}
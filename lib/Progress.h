@@ -0,0 +1,99 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Progress reporting for long-running loops.  The working thread updates
+ * ProgressCounters, which are plain relaxed atomics (no locks); a
+ * ProgressReporter thread samples them at an interval and prints the values,
+ * rates, and an estimated time remaining to stderr.  The latest sample can
+ * also be published to a file (rewritten atomically at each interval) or to a
+ * Unix socket ("unix:<path>") that sends the sample to each client that
+ * connects.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <sys/time.h>
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+// A counter that is written by one thread and may be read by any thread.
+class ProgressCounter {
+    std::atomic<uint64_t> val;
+public:
+    ProgressCounter() : val(0) {}
+    uint64_t get() const { return val.load(std::memory_order_relaxed); }
+    void set(uint64_t v) { val.store(v, std::memory_order_relaxed); }
+    // only the writing thread may call add()
+    void add(uint64_t n) { set(get() + n); }
+    // add() for a counter that several threads add to
+    void addShared(uint64_t n) { val.fetch_add(n, std::memory_order_relaxed); }
+};
+
+class ProgressReporter {
+    struct Item {
+	const char *name;
+	const ProgressCounter *counter;
+	bool rate;		// report rate of change?
+	uint64_t prev;		// value at previous report
+	double rate_per_sec;	// rate during previous interval
+    };
+    std::string prefix;		// prefix of metric names for the endpoint
+    std::vector<Item> items;
+    const ProgressCounter *done; // progress toward total, for ETA
+    uint64_t total;
+    double eta;			// estimated seconds remaining, or -1
+    int interval;		// seconds between reports
+    std::string endpoint;
+    int listenfd;		// Unix socket, or -1
+    int wakefd[2];		// pipe used to wake the thread for stop()
+    struct timeval startTime, prevTime;
+    bool running;
+#ifdef HAVE_PTHREAD
+    pthread_t pthread;
+    static void *run(void *arg);
+#endif
+    double elapsed(const struct timeval &since) const;
+    void report(bool final);
+    std::string metrics() const;
+    void publish(const std::string &text) const;
+    ProgressReporter(const ProgressReporter&); // no copying
+    ProgressReporter &operator=(const ProgressReporter&);
+public:
+    explicit ProgressReporter(const char *prefix_);
+    ~ProgressReporter() { stop(); }
+    // Report counter as "name"; if rate, also report its rate of change.
+    void add(const char *name, const ProgressCounter *counter, bool rate = true);
+    // Estimate remaining time from done's progress toward total.
+    void setGoal(const ProgressCounter *done_, uint64_t total_)
+	{ done = done_; total = total_; }
+    // Start reporting every interval seconds, and publishing to endpoint if
+    // it is not empty.  Throws std::runtime_error if the endpoint can't be
+    // set up.
+    void start(int interval_, const std::string &endpoint_);
+    // Make a final report and stop the reporting thread.
+    void stop();
+};
+
+#endif // PROGRESS_H
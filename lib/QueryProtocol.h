@@ -0,0 +1,79 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Protocol of kapar-serve, the alias query daemon.  A client connects to
+ * the daemon's Unix stream socket and sends requests; each request is a
+ * QueryHeader followed by n 32-bit arguments, and is answered by a reply
+ * that is a QueryHeader (with the request's id and op) followed by n 32-bit
+ * result words.  Requests may be pipelined: a client may send any number of
+ * requests without waiting, and replies arrive in the order of the requests.
+ * Each request is answered entirely from one version of the topology, even
+ * if the daemon switches to a new one while the client is connected.
+ * Because the socket is local, all values are in host byte order.
+ *
+ * Ops and their replies, where "list" is a count followed by that many
+ * items:
+ *   QUERY_INFO            (no arguments)  generation, n_ifaces, n_nodes,
+ *                         n_links; the generation increases each time the
+ *                         daemon loads a new topology
+ *   QUERY_NODE_OF         addresses  node id of each, or 0
+ *   QUERY_LINK_OF         addresses  link id of each, or 0
+ *   QUERY_NODE_IFACES     node ids  list of addresses for each
+ *   QUERY_NODE_LINKS      node ids  list of link ids for each
+ *   QUERY_NODE_NEIGHBORS  node ids  list of ids of the other nodes sharing
+ *                         a link, for each
+ *   QUERY_LINK_MEMBERS    link ids  list of (node id, address) pairs for
+ *                         each; the address is 0 for an implicit interface
+ * Unknown ids give empty lists.  A request with an unknown op is answered
+ * with status QUERY_BAD_OP and no results; a request with more than
+ * QUERY_MAX_ARGS arguments is answered with QUERY_TOO_BIG, after which the
+ * daemon closes the connection.
+ */
+
+#ifndef QUERYPROTOCOL_H
+#define QUERYPROTOCOL_H
+
+#include <stdint.h>
+
+struct QueryHeader {
+    uint32_t id;		// chosen by the client, copied to the reply
+    uint16_t op;		// QUERY_* op
+    uint16_t status;		// 0 in requests; QUERY_* status in replies
+    uint32_t n;			// number of 32-bit words that follow
+};
+
+enum QueryOp {
+    QUERY_INFO = 0,
+    QUERY_NODE_OF = 1,
+    QUERY_LINK_OF = 2,
+    QUERY_NODE_IFACES = 3,
+    QUERY_NODE_LINKS = 4,
+    QUERY_NODE_NEIGHBORS = 5,
+    QUERY_LINK_MEMBERS = 6
+};
+
+enum QueryStatus {
+    QUERY_OK = 0,
+    QUERY_BAD_OP = 1,
+    QUERY_TOO_BIG = 2
+};
+
+static const uint32_t QUERY_MAX_ARGS = 1 << 20;
+
+#endif // QUERYPROTOCOL_H
@@ -0,0 +1,246 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * SpillArena implementation
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "SpillArena.h"
+
+thread_local SpillArena *SpillArena::_current = 0;
+
+static const size_t MB = 1 << 20;
+static const size_t MIN_SEGMENT = 16 * MB;
+static const size_t MAX_SEGMENT = 1024 * MB;
+
+// Round size up to its size class, and return the number of the class.
+// Sizes up to 64 bytes are in steps of 8; above that, there are 4 classes per
+// power of 2, so rounding wastes at most 20%.
+static int sizeClass(size_t &size)
+{
+    if (size <= 64) {
+	size = size ? (size + 7) & ~size_t(7) : 8;
+	return int(size / 8) - 1;
+    }
+    int shift = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    size_t step = size_t(1) << (shift - 2);
+    size = (size + step - 1) & ~(step - 1);
+    return 8 + (shift - 6) * 4 + int(size / step) - 5;
+}
+
+void SpillArena::lock()
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_lock(&mutex);
+#endif
+}
+
+void SpillArena::unlock()
+{
+#ifdef HAVE_PTHREAD
+    pthread_mutex_unlock(&mutex);
+#endif
+}
+
+// Holds the arena's lock for its lifetime, even if an exception is thrown.
+class SpillArena::Guard {
+    SpillArena &arena;
+public:
+    explicit Guard(SpillArena &a) : arena(a) { arena.lock(); }
+    ~Guard() { arena.unlock(); }
+};
+
+SpillArena::SpillArena(const char *dir_, size_t budget_) :
+    dir(dir_), budget(budget_), segments(), next(0), end(0), freelist(),
+    sinceTrim(0), n_files(0), mapped(0), used(0)
+{
+    segmentSize = std::min(std::max(budget / 4, MIN_SEGMENT), MAX_SEGMENT);
+    segmentSize = (segmentSize + MB - 1) & ~(MB - 1);
+#ifdef HAVE_PTHREAD
+    pthread_mutex_init(&mutex, 0);
+#endif
+}
+
+SpillArena::~SpillArena()
+{
+    for (size_t i = 0; i < segments.size(); ++i) {
+	munmap(segments[i].base, segments[i].size);
+	close(segments[i].fd);
+    }
+    if (_current == this) _current = 0;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_destroy(&mutex);
+#endif
+}
+
+void SpillArena::newSegment(size_t minsize)
+{
+    size_t size = std::max(segmentSize, (minsize + MB - 1) & ~(MB - 1));
+    char name[64];
+    sprintf(name, "/kapar-spill.%ld.%llu", long(getpid()),
+	(unsigned long long)n_files++);
+    std::string path = dir + name;
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+	throw std::runtime_error("can't create spill file " + path + ": " +
+	    strerror(errno));
+    unlink(path.c_str());
+    // Reserve the disk space now, so running out of it is an error here
+    // instead of a SIGBUS when a page is written back.
+    int err = ftruncate(fd, off_t(size)) < 0 ? errno :
+	posix_fallocate(fd, 0, off_t(size));
+    if (err && err != EINVAL && err != EOPNOTSUPP) {
+	close(fd);
+	throw std::runtime_error("can't extend spill file " + path + ": " +
+	    strerror(err));
+    }
+    void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+	err = errno;
+	close(fd);
+	throw std::runtime_error("can't map spill file " + path + ": " +
+	    strerror(err));
+    }
+    Segment seg = { static_cast<char*>(p), size, fd, false, false };
+    std::vector<Segment>::iterator it = segments.begin();
+    while (it != segments.end() && it->base < seg.base) ++it;
+    segments.insert(it, seg);
+    next = seg.base;
+    end = seg.base + size;
+    mapped += size;
+}
+
+const SpillArena::Segment *SpillArena::find(const void *p) const
+{
+    const char *cp = static_cast<const char*>(p);
+    size_t lo = 0, hi = segments.size();
+    while (lo < hi) { // find the last segment with base <= cp
+	size_t mid = (lo + hi) / 2;
+	if (segments[mid].base <= cp) lo = mid + 1; else hi = mid;
+    }
+    if (lo == 0) return 0;
+    const Segment &seg = segments[lo - 1];
+    return cp < seg.base + seg.size ? &seg : 0;
+}
+
+void *SpillArena::alloc(size_t size)
+{
+    Guard guard(*this);
+    size_t c = size_t(sizeClass(size));
+    used += size;
+    if (c < freelist.size() && freelist[c]) {
+	void *p = freelist[c];
+	freelist[c] = *static_cast<void**>(p);
+	return p;
+    }
+    if (size > size_t(end - next))
+	newSegment(size);
+    void *p = next;
+    next += size;
+    sinceTrim += size;
+    if (sinceTrim > budget)
+	trimLocked();
+    return p;
+}
+
+bool SpillArena::free(void *p, size_t size)
+{
+    Guard guard(*this);
+    const Segment *seg = find(p);
+    if (!seg) return false;
+    size_t c = size_t(sizeClass(size));
+    used -= size;
+    if (!seg->old) {
+	if (c >= freelist.size()) freelist.resize(c + 1, 0);
+	*static_cast<void**>(p) = freelist[c];
+	freelist[c] = p;
+    }
+    return true;
+}
+
+void SpillArena::beginRelocation()
+{
+    Guard guard(*this);
+    for (size_t i = 0; i < segments.size(); ++i)
+	segments[i].old = true;
+    freelist.clear();
+    next = end = 0;
+}
+
+void SpillArena::endRelocation()
+{
+    Guard guard(*this);
+    std::vector<Segment> kept;
+    for (size_t i = 0; i < segments.size(); ++i) {
+	if (segments[i].old) {
+	    munmap(segments[i].base, segments[i].size);
+	    close(segments[i].fd);
+	    mapped -= segments[i].size;
+	} else {
+	    kept.push_back(segments[i]);
+	}
+    }
+    segments.swap(kept);
+}
+
+void SpillArena::trim()
+{
+    Guard guard(*this);
+    trimLocked();
+}
+
+void SpillArena::trimLocked()
+{
+    for (size_t i = 0; i < segments.size(); ++i) {
+	Segment &seg = segments[i];
+	if (seg.priv || (next > seg.base && next <= seg.base + seg.size))
+	    continue; // private pages would be lost; current segment is hot
+	// The pages stay in the file, and are read back when touched.
+	msync(seg.base, seg.size, MS_ASYNC);
+	madvise(seg.base, seg.size, MADV_DONTNEED);
+    }
+    sinceTrim = 0;
+}
+
+void SpillArena::detach()
+{
+    Guard guard(*this);
+    for (size_t i = 0; i < segments.size(); ++i) {
+	Segment &seg = segments[i];
+	if (mmap(seg.base, seg.size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_FIXED, seg.fd, 0) == MAP_FAILED)
+		throw std::runtime_error(std::string("can't remap spill file: ") +
+		    strerror(errno));
+	seg.priv = true;
+    }
+}
@@ -0,0 +1,139 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Out-of-core storage for large, cold data.  A SpillArena allocates memory
+ * from memory-mapped segment files in a spill directory instead of from the
+ * heap, so that under memory pressure the kernel can write its pages back to
+ * the files and reclaim them, and the program slows down instead of running
+ * out of memory.  Blocks are carved from the current segment by a bump
+ * pointer, and freed blocks are kept on free lists by size class for reuse.
+ * The segment files are unlinked as soon as they are mapped, so they vanish
+ * when the process exits.
+ *
+ * The arena keeps roughly budget bytes of its data resident:  whenever that
+ * much has been allocated since the last trim, the pages of all segments
+ * other than the one being filled are released (they are paged back in from
+ * the files when touched).
+ *
+ * SpillAllocator<T> is an allocator for containers such as ivector that
+ * allocates from the current arena of the calling thread, if there is one,
+ * and from the heap otherwise.  The owner of an arena makes it current with a
+ * SpillArena::Scope around all code that allocates or frees blocks of its
+ * containers, so different owners (e.g., kapar contexts) in one process keep
+ * their blocks apart.  The allocator itself is stateless, so it adds nothing
+ * to the size of each container.
+ */
+
+#ifndef SPILLARENA_H
+#define SPILLARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+class SpillArena {
+    struct Segment {
+	char *base;
+	size_t size;
+	int fd;
+	bool old;		// being relocated out of; blocks are not reused
+	bool priv;		// mapped private (copy-on-write) by detach()
+    };
+    class Guard;
+    std::string dir;
+    size_t budget;		// bytes to keep resident
+    size_t segmentSize;		// size of a normal segment
+    std::vector<Segment> segments; // sorted by base
+    char *next, *end;		// unallocated part of the current segment
+    std::vector<void*> freelist; // by size class
+    size_t sinceTrim;		// bytes allocated since last trim()
+    uint64_t n_files;
+    uint64_t mapped, used;
+#ifdef HAVE_PTHREAD
+    pthread_mutex_t mutex;
+#endif
+    SpillArena(const SpillArena&); // no copying
+    SpillArena &operator=(const SpillArena&);
+    void newSegment(size_t size);
+    const Segment *find(const void *p) const;
+    void trimLocked();
+    void lock();
+    void unlock();
+    static thread_local SpillArena *_current;
+public:
+    // Make arena (or NULL, for the heap) the current arena of this thread
+    // for the lifetime of the Scope.
+    class Scope {
+	SpillArena *saved;
+	Scope(const Scope&); // no copying
+	Scope &operator=(const Scope&);
+    public:
+	explicit Scope(SpillArena *arena) : saved(_current) { _current = arena; }
+	~Scope() { _current = saved; }
+    };
+    // The arena used by SpillAllocator in this thread, or NULL.
+    static SpillArena *current() { return _current; }
+    SpillArena(const char *dir_, size_t budget_);
+    ~SpillArena();
+    void *alloc(size_t size);
+    // Free a block of the given size, if it belongs to this arena.  Returns
+    // false if it does not.
+    bool free(void *p, size_t size);
+    // Begin relocating blocks:  later allocations come from new segments,
+    // and blocks in the existing segments are no longer reused.
+    void beginRelocation();
+    // Finish relocating blocks:  release the segments that existed at
+    // beginRelocation(), which must no longer hold any live block.
+    void endRelocation();
+    // Release the resident pages of all segments but the current one.
+    void trim();
+    // Give this process (e.g., the child of a fork) a private copy-on-write
+    // view of the segments, so its changes don't affect other processes.
+    void detach();
+    uint64_t mappedBytes() const { return mapped; }
+    uint64_t usedBytes() const { return used; }
+};
+
+template<class T>
+class SpillAllocator : public std::allocator<T> {
+public:
+    typedef T *pointer;
+    typedef size_t size_type;
+    template<class U> struct rebind { typedef SpillAllocator<U> other; };
+    SpillAllocator() {}
+    template<class U> SpillAllocator(const SpillAllocator<U> &) {}
+    pointer allocate(size_type n, const void * = 0) {
+	SpillArena *arena = SpillArena::current();
+	if (arena)
+	    return static_cast<pointer>(arena->alloc(n * sizeof(T)));
+	return std::allocator<T>::allocate(n);
+    }
+    void deallocate(pointer p, size_type n) {
+	SpillArena *arena = SpillArena::current();
+	if (!arena || !arena->free(p, n * sizeof(T)))
+	    std::allocator<T>::deallocate(p, n);
+    }
+};
+
+#endif // SPILLARENA_H
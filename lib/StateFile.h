@@ -0,0 +1,267 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Binary state file written by "kapar --save-state", and a reader that maps
+ * it into memory.  It holds everything kapar has built by loading the input
+ * files and path traces, before anonymous interface matching, so that
+ * "kapar --load-state" can run the inference phases without reloading the
+ * inputs, or can load more traces on top of it.  The file contains:
+ *   - a header (StateHeader) giving the counts and offsets of the sections,
+ *     and the loading counters
+ *   - the text of the configuration of the run that saved the file (the same
+ *     "#" lines that start the text output files)
+ *   - the options that affect loading, which a run that loads the file must
+ *     match
+ *   - all interfaces (StateIface):  named interfaces sorted by address,
+ *     followed by anonymous interfaces in order of id
+ *   - CSR arrays mapping each interface to its raw trace id set, and to its
+ *     previous path segments (2 addresses per segment for a named interface,
+ *     1 for an anonymous interface)
+ *   - CSR arrays mapping each named interface to its next hops
+ *   - for nodes:  ascending node ids, and CSR arrays mapping each node to
+ *     the addresses of its interfaces, in node order
+ *   - for links:  ascending link ids, and CSR arrays mapping each link to
+ *     the addresses of its interfaces and to the ids of nodes with implicit
+ *     interfaces on the link
+ *   - bad subnets (StatePrefix), sorted
+ *   - destination links (pairs of addresses), sorted
+ *   - anonymous segments (StateAnonSeg), in order of their first anonymous
+ *     interface
+ *   - TTL records, if the saving run loaded TTLs:  one for each named
+ *     interface, then two (minimum and maximum) for each node; each is a
+ *     presence byte followed by the raw TTL data
+ * All values are in the byte order of the writer, and every section is
+ * 8-byte aligned.
+ */
+
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdexcept>
+#include <string>
+
+#define STATE_MAGIC	"KAPSTAT"	// 8 bytes, including the NUL
+#define STATE_VERSION	2
+#define STATE_BYTEORDER	0x01020304
+
+// StateIface flags
+#define STATE_TRANSIT	0x01	// appeared in a traceroute as a transit hop
+#define STATE_DEST	0x02	// appeared in a traceroute as a destination hop
+#define STATE_ANON	0x04	// anonymous interface
+#define STATE_PREALIASED 0x08	// named interface included in loaded aliases
+
+// StateHeader flags
+#define STATE_TRACEIDS	0x01	// interfaces' trace id sets were recorded
+
+struct StateIface {
+    uint32_t addr;		// address, in host byte order
+    uint32_t nodeid;		// id of node, or 0
+    uint32_t linkid;		// id of link, or 0
+    uint32_t flags;		// STATE_* flags
+    uint32_t redundant;		// anonymous: address of equivalent iface, or 0
+};
+
+struct StatePrefix {
+    uint32_t addr;
+    uint32_t len;
+};
+
+struct StateAnonSeg {
+    uint32_t lo;		// address of lower neighboring named iface
+    uint32_t hi;		// address of higher neighboring named iface
+    uint32_t length;		// number of anonymous hops
+    uint32_t loAnon;		// index of anonymous iface next to lo
+};
+
+struct StateHeader {
+    char magic[8];		// STATE_MAGIC
+    uint32_t version;		// STATE_VERSION
+    uint32_t byteorder;		// STATE_BYTEORDER
+    uint32_t flags;		// STATE_TRACEIDS
+    uint32_t n_named;
+    uint32_t n_anon;		// also the highest anonymous id
+    uint32_t n_nodes;
+    uint64_t n_node_ifaces;
+    uint32_t n_links;
+    uint32_t next_nodeid;
+    uint64_t n_link_ifaces;
+    uint64_t n_link_nodes;
+    uint64_t n_bad_subnets;
+    uint64_t n_dstlinks;
+    uint64_t n_anon_segs;
+    uint32_t n_ttls;		// number of TTL vantage points
+    uint32_t next_linkid;
+    // loading counters
+    uint64_t n_raw_traces;
+    uint64_t n_good_traces;
+    uint64_t n_loops;
+    uint64_t n_discarded_traces;
+    uint64_t n_anon_hops;
+    uint64_t n_total_hops;
+    uint64_t n_bad_31_traces;
+    uint64_t n_not_min_mask;
+    uint64_t n_not_min_net;
+    uint64_t n_same_min_net;
+    // sections
+    uint64_t config_off;	// char[config_len], NUL-terminated
+    uint64_t config_len;	// not including the NUL
+    uint64_t options_off;	// char[options_len], NUL-terminated
+    uint64_t options_len;	// not including the NUL
+    uint64_t ifaces_off;	// StateIface[n_named + n_anon]
+    uint64_t traces_idx_off;	// uint64_t[n_named + n_anon + 1], into traces
+    uint64_t traces_off;	// uint32_t[], raw trace id sets
+    uint64_t prev_idx_off;	// uint64_t[n_named + n_anon + 1], into prev
+    uint64_t prev_off;		// uint32_t[], previous hop addresses
+    uint64_t next_idx_off;	// uint64_t[n_named + 1], into next
+    uint64_t next_off;		// uint32_t[], next hop addresses
+    uint64_t node_ids_off;	// uint32_t[n_nodes], ascending
+    uint64_t node_ifaces_idx_off; // uint64_t[n_nodes+1], into node_ifaces
+    uint64_t node_ifaces_off;	// uint32_t[n_node_ifaces], iface addresses
+    uint64_t link_ids_off;	// uint32_t[n_links], ascending
+    uint64_t link_ifaces_idx_off; // uint64_t[n_links+1], into link_ifaces
+    uint64_t link_ifaces_off;	// uint32_t[n_link_ifaces], iface addresses
+    uint64_t link_nodes_idx_off; // uint64_t[n_links+1], into link_nodes
+    uint64_t link_nodes_off;	// uint32_t[n_link_nodes], node ids
+    uint64_t bad_subnets_off;	// StatePrefix[n_bad_subnets]
+    uint64_t dstlinks_off;	// uint32_t[2 * n_dstlinks]
+    uint64_t anon_segs_off;	// StateAnonSeg[n_anon_segs]
+    uint64_t ttls_off;		// uint8_t[ttls_len]
+    uint64_t ttls_len;
+    uint64_t file_size;
+};
+
+// Round a section offset up to the required alignment.
+inline uint64_t stateAlign(uint64_t off) { return (off + 7) & ~uint64_t(7); }
+
+class StateFile {
+    const char *base;
+    size_t size;
+    const StateHeader *hdr;
+    StateFile(const StateFile&); // no copying
+    StateFile &operator=(const StateFile&);
+    template<class T> const T *section(uint64_t off, uint64_t n) const {
+	if (off % 8 || off > size || n > (size - off) / sizeof(T))
+	    throw std::runtime_error("corrupt state file");
+	return reinterpret_cast<const T*>(base + off);
+    }
+    // a CSR index of n+1 entries, whose last entry must equal total
+    const uint64_t *index(uint64_t off, uint64_t n, uint64_t &total) const {
+	const uint64_t *idx = section<uint64_t>(off, n + 1);
+	total = idx[n];
+	for (uint64_t i = 0; i < n; ++i) {
+	    if (idx[i] > idx[i+1])
+		throw std::runtime_error("corrupt state file");
+	}
+	return idx;
+    }
+public:
+    const StateIface *ifaces;
+    const uint64_t *traces_idx, *prev_idx, *next_idx;
+    const uint32_t *traces, *prev, *next;
+    const uint32_t *node_ids, *node_ifaces, *link_ids, *link_ifaces, *link_nodes;
+    const uint64_t *node_ifaces_idx, *link_ifaces_idx, *link_nodes_idx;
+    const StatePrefix *bad_subnets;
+    const uint32_t *dstlinks;
+    const StateAnonSeg *anon_segs;
+    const uint8_t *ttls;
+
+    explicit StateFile(const char *filename) : base(0), size(0), hdr(0) {
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+	    throw std::runtime_error(std::string("can't open ") + filename +
+		": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+	    ::close(fd);
+	    throw std::runtime_error(std::string("can't stat ") + filename +
+		": " + strerror(errno));
+	}
+	size = size_t(st.st_size);
+	void *p = size < sizeof(StateHeader) ? MAP_FAILED :
+	    mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	    throw std::runtime_error(std::string("can't map ") + filename);
+	base = static_cast<const char*>(p);
+	hdr = reinterpret_cast<const StateHeader*>(base);
+	try {
+	    if (memcmp(hdr->magic, STATE_MAGIC, 8) != 0)
+		throw std::runtime_error("not a kapar state file");
+	    if (hdr->byteorder != STATE_BYTEORDER)
+		throw std::runtime_error("state file has wrong byte order");
+	    if (hdr->version != STATE_VERSION)
+		throw std::runtime_error("unsupported state file version");
+	    if (hdr->file_size != size)
+		throw std::runtime_error("truncated state file");
+	    section<char>(hdr->config_off, hdr->config_len + 1);
+	    section<char>(hdr->options_off, hdr->options_len + 1);
+	    uint64_t n_ifaces = uint64_t(hdr->n_named) + hdr->n_anon;
+	    uint64_t n;
+	    ifaces = section<StateIface>(hdr->ifaces_off, n_ifaces);
+	    traces_idx = index(hdr->traces_idx_off, n_ifaces, n);
+	    traces = section<uint32_t>(hdr->traces_off, n);
+	    prev_idx = index(hdr->prev_idx_off, n_ifaces, n);
+	    prev = section<uint32_t>(hdr->prev_off, n);
+	    next_idx = index(hdr->next_idx_off, hdr->n_named, n);
+	    next = section<uint32_t>(hdr->next_off, n);
+	    node_ids = section<uint32_t>(hdr->node_ids_off, hdr->n_nodes);
+	    node_ifaces_idx = index(hdr->node_ifaces_idx_off, hdr->n_nodes, n);
+	    node_ifaces = section<uint32_t>(hdr->node_ifaces_off,
+		hdr->n_node_ifaces);
+	    link_ids = section<uint32_t>(hdr->link_ids_off, hdr->n_links);
+	    link_ifaces_idx = index(hdr->link_ifaces_idx_off, hdr->n_links, n);
+	    link_ifaces = section<uint32_t>(hdr->link_ifaces_off,
+		hdr->n_link_ifaces);
+	    link_nodes_idx = index(hdr->link_nodes_idx_off, hdr->n_links, n);
+	    link_nodes = section<uint32_t>(hdr->link_nodes_off,
+		hdr->n_link_nodes);
+	    bad_subnets = section<StatePrefix>(hdr->bad_subnets_off,
+		hdr->n_bad_subnets);
+	    dstlinks = section<uint32_t>(hdr->dstlinks_off, 2 * hdr->n_dstlinks);
+	    anon_segs = section<StateAnonSeg>(hdr->anon_segs_off,
+		hdr->n_anon_segs);
+	    ttls = section<uint8_t>(hdr->ttls_off, hdr->ttls_len);
+	    if (base[hdr->config_off + hdr->config_len] != '\0' ||
+		base[hdr->options_off + hdr->options_len] != '\0' ||
+		node_ifaces_idx[hdr->n_nodes] != hdr->n_node_ifaces ||
+		link_ifaces_idx[hdr->n_links] != hdr->n_link_ifaces ||
+		link_nodes_idx[hdr->n_links] != hdr->n_link_nodes)
+		    throw std::runtime_error("corrupt state file");
+	} catch (const std::runtime_error &e) {
+	    munmap(const_cast<char*>(base), size);
+	    throw std::runtime_error(std::string(filename) + ": " + e.what());
+	}
+    }
+    ~StateFile() { munmap(const_cast<char*>(base), size); }
+
+    const StateHeader &header() const { return *hdr; }
+    const char *config() const { return base + hdr->config_off; }
+    const char *options() const { return base + hdr->options_off; }
+    uint32_t n_ifaces() const { return hdr->n_named + hdr->n_anon; }
+};
+
+#endif // STATEFILE_H
@@ -0,0 +1,230 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Binary topology file written by "kapar -ob", and a reader that maps it
+ * into memory.  The file contains:
+ *   - a header (TopoHeader) giving the counts and offsets of the sections
+ *   - the text of the run configuration (the same "#" lines that start the
+ *     text output files)
+ *   - all interfaces (TopoIface), sorted by address
+ *   - for nodes:  ascending node ids, and CSR arrays mapping each node to
+ *     the indexes of its interfaces
+ *   - for links:  ascending link ids, and CSR arrays mapping each link to
+ *     the indexes of its interfaces and to the ids of nodes with implicit
+ *     interfaces on the link
+ * Like the text output, node and link interface lists omit redundant
+ * anonymous interfaces.  All values are in the byte order of the writer, and
+ * every section is 8-byte aligned.
+ *
+ * Example:
+ *     TopoFile topo("kapar.topo");
+ *     uint32_t i = topo.findIface(addr);
+ *     if (i != TopoFile::NONE && topo.iface(i).nodeid) {
+ *         TopoFile::Range r = topo.nodeIfaces(topo.findNode(topo.iface(i).nodeid));
+ *         for (const uint32_t *p = r.begin; p != r.end; ++p)
+ *             ... topo.iface(*p).addr ...
+ *     }
+ */
+
+#ifndef TOPOFILE_H
+#define TOPOFILE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#define TOPO_MAGIC	"KAPTOPO"	// 8 bytes, including the NUL
+#define TOPO_VERSION	1
+#define TOPO_BYTEORDER	0x01020304
+
+// TopoIface flags
+#define TOPO_TRANSIT	0x01	// appeared in a traceroute as a transit hop
+#define TOPO_DEST	0x02	// appeared in a traceroute as a destination hop
+#define TOPO_ANON	0x04	// anonymous interface
+#define TOPO_REDUNDANT	0x08	// anonymous interface equivalent to another
+
+struct TopoIface {
+    uint32_t addr;		// address, in host byte order
+    uint32_t nodeid;		// id of node, or 0
+    uint32_t linkid;		// id of link, or 0
+    uint32_t flags;		// TOPO_* flags
+};
+
+struct TopoHeader {
+    char magic[8];		// TOPO_MAGIC
+    uint32_t version;		// TOPO_VERSION
+    uint32_t byteorder;		// TOPO_BYTEORDER
+    uint32_t n_ifaces;
+    uint32_t n_nodes;
+    uint32_t n_node_ifaces;
+    uint32_t n_links;
+    uint32_t n_link_ifaces;
+    uint32_t n_link_nodes;
+    uint64_t config_off;	// char[config_len], NUL-terminated
+    uint64_t config_len;	// not including the NUL
+    uint64_t ifaces_off;	// TopoIface[n_ifaces], sorted by addr
+    uint64_t node_ids_off;	// uint32_t[n_nodes], ascending
+    uint64_t node_ifaces_idx_off; // uint32_t[n_nodes+1], into node_ifaces
+    uint64_t node_ifaces_off;	// uint32_t[n_node_ifaces], iface indexes
+    uint64_t link_ids_off;	// uint32_t[n_links], ascending
+    uint64_t link_ifaces_idx_off; // uint32_t[n_links+1], into link_ifaces
+    uint64_t link_ifaces_off;	// uint32_t[n_link_ifaces], iface indexes
+    uint64_t link_nodes_idx_off; // uint32_t[n_links+1], into link_nodes
+    uint64_t link_nodes_off;	// uint32_t[n_link_nodes], node ids
+    uint64_t file_size;
+};
+
+// Round a section offset up to the required alignment.
+inline uint64_t topoAlign(uint64_t off) { return (off + 7) & ~uint64_t(7); }
+
+class TopoFile {
+    const char *base;
+    size_t size;
+    const TopoHeader *hdr;
+    TopoFile(const TopoFile&); // no copying
+    TopoFile &operator=(const TopoFile&);
+    template<class T> const T *section(uint64_t off, uint64_t n) const {
+	if (off % 8 || off > size || n > (size - off) / sizeof(T))
+	    throw std::runtime_error("corrupt topology file");
+	return reinterpret_cast<const T*>(base + off);
+    }
+    static uint32_t find(const uint32_t *ids, uint32_t n, uint32_t id) {
+	const uint32_t *p = std::lower_bound(ids, ids + n, id);
+	return (p != ids + n && *p == id) ? uint32_t(p - ids) : NONE;
+    }
+public:
+    static const uint32_t NONE = 0xFFFFFFFF;
+    struct Range {
+	const uint32_t *begin, *end;
+	size_t size() const { return size_t(end - begin); }
+    };
+    const TopoIface *ifaces;
+    const uint32_t *node_ids, *node_ifaces_idx, *node_ifaces;
+    const uint32_t *link_ids, *link_ifaces_idx, *link_ifaces;
+    const uint32_t *link_nodes_idx, *link_nodes;
+
+    explicit TopoFile(const char *filename) : base(0), size(0), hdr(0) {
+	int fd = ::open(filename, O_RDONLY);
+	if (fd < 0)
+	    throw std::runtime_error(std::string("can't open ") + filename +
+		": " + strerror(errno));
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+	    ::close(fd);
+	    throw std::runtime_error(std::string("can't stat ") + filename +
+		": " + strerror(errno));
+	}
+	size = size_t(st.st_size);
+	void *p = size < sizeof(TopoHeader) ? MAP_FAILED :
+	    mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED)
+	    throw std::runtime_error(std::string("can't map ") + filename);
+	base = static_cast<const char*>(p);
+	hdr = reinterpret_cast<const TopoHeader*>(base);
+	try {
+	    if (memcmp(hdr->magic, TOPO_MAGIC, 8) != 0)
+		throw std::runtime_error("not a kapar topology file");
+	    if (hdr->byteorder != TOPO_BYTEORDER)
+		throw std::runtime_error("topology file has wrong byte order");
+	    if (hdr->version != TOPO_VERSION)
+		throw std::runtime_error("unsupported topology file version");
+	    if (hdr->file_size != size)
+		throw std::runtime_error("truncated topology file");
+	    section<char>(hdr->config_off, hdr->config_len + 1);
+	    ifaces = section<TopoIface>(hdr->ifaces_off, hdr->n_ifaces);
+	    node_ids = section<uint32_t>(hdr->node_ids_off, hdr->n_nodes);
+	    node_ifaces_idx = section<uint32_t>(hdr->node_ifaces_idx_off,
+		uint64_t(hdr->n_nodes) + 1);
+	    node_ifaces = section<uint32_t>(hdr->node_ifaces_off,
+		hdr->n_node_ifaces);
+	    link_ids = section<uint32_t>(hdr->link_ids_off, hdr->n_links);
+	    link_ifaces_idx = section<uint32_t>(hdr->link_ifaces_idx_off,
+		uint64_t(hdr->n_links) + 1);
+	    link_ifaces = section<uint32_t>(hdr->link_ifaces_off,
+		hdr->n_link_ifaces);
+	    link_nodes_idx = section<uint32_t>(hdr->link_nodes_idx_off,
+		uint64_t(hdr->n_links) + 1);
+	    link_nodes = section<uint32_t>(hdr->link_nodes_off,
+		hdr->n_link_nodes);
+	    if (base[hdr->config_off + hdr->config_len] != '\0' ||
+		node_ifaces_idx[hdr->n_nodes] != hdr->n_node_ifaces ||
+		link_ifaces_idx[hdr->n_links] != hdr->n_link_ifaces ||
+		link_nodes_idx[hdr->n_links] != hdr->n_link_nodes)
+		    throw std::runtime_error("corrupt topology file");
+	} catch (const std::runtime_error &e) {
+	    munmap(const_cast<char*>(base), size);
+	    throw std::runtime_error(std::string(filename) + ": " + e.what());
+	}
+    }
+    ~TopoFile() { munmap(const_cast<char*>(base), size); }
+
+    const TopoHeader &header() const { return *hdr; }
+    const char *config() const { return base + hdr->config_off; }
+
+    uint32_t n_ifaces() const { return hdr->n_ifaces; }
+    const TopoIface &iface(uint32_t i) const { return ifaces[i]; }
+    // index of the interface with address addr, or NONE
+    uint32_t findIface(uint32_t addr) const {
+	const TopoIface *end = ifaces + hdr->n_ifaces;
+	const TopoIface *p = std::lower_bound(ifaces, end, addr,
+	    [](const TopoIface &a, uint32_t b) { return a.addr < b; });
+	return (p != end && p->addr == addr) ? uint32_t(p - ifaces) : NONE;
+    }
+
+    uint32_t n_nodes() const { return hdr->n_nodes; }
+    uint32_t nodeId(uint32_t n) const { return node_ids[n]; }
+    // index of the node with id nodeid, or NONE
+    uint32_t findNode(uint32_t nodeid) const
+	{ return find(node_ids, hdr->n_nodes, nodeid); }
+    // indexes of the interfaces of the node with index n
+    Range nodeIfaces(uint32_t n) const {
+	Range r = { node_ifaces + node_ifaces_idx[n],
+	    node_ifaces + node_ifaces_idx[n+1] };
+	return r;
+    }
+
+    uint32_t n_links() const { return hdr->n_links; }
+    uint32_t linkId(uint32_t l) const { return link_ids[l]; }
+    // index of the link with id linkid, or NONE
+    uint32_t findLink(uint32_t linkid) const
+	{ return find(link_ids, hdr->n_links, linkid); }
+    // indexes of the explicit interfaces of the link with index l
+    Range linkIfaces(uint32_t l) const {
+	Range r = { link_ifaces + link_ifaces_idx[l],
+	    link_ifaces + link_ifaces_idx[l+1] };
+	return r;
+    }
+    // ids of nodes with implicit interfaces on the link with index l
+    Range linkNodes(uint32_t l) const {
+	Range r = { link_nodes + link_nodes_idx[l],
+	    link_nodes + link_nodes_idx[l+1] };
+	return r;
+    }
+};
+
+#endif // TOPOFILE_H
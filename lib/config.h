@@ -0,0 +1,29 @@
+/* lib/config.h.  Generated from config.h.in by configure.  */
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/* #undef HAVE_SCAMPER */
+#define HAVE_PTHREAD 1
+#define HAVE_LIBZ 1
+
+
+#ifdef __GNUC__
+#define UNUSED __attribute__ ((__unused__)) 
+#else
+#define UNUSED
+#endif
@@ -27,10 +27,13 @@
 #include <string.h>
 #include <unistd.h>
 #include <cstdarg>
+#include <algorithm>
 #include <exception>
 #include <stdexcept>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 
 #include "config.h"
 #include "infile.h"
@@ -38,7 +41,7 @@
 bool InFile::fork = true;
 
 InFile::InFile(const char *filename, size_t classsize) :
-    isPipe(false), tmp(0), file(0), _linenum(0),
+    isPipe(false), tmp(0), file(0), rawfd(-1), _linenum(0),
 #ifdef HAVE_LIBZ
     gzfile(0),
 #endif
@@ -67,7 +70,12 @@ InFile::InFile(const char *filename, size_t classsize) :
 	    pipeName = "gzip";
 	} else {
 #ifdef HAVE_LIBZ
-	    if (!(gzfile = gzopen(name, "rb"))) {
+	    // open the fd ourselves, so position() can find it
+	    if ((rawfd = ::open(name, O_RDONLY)) < 0 ||
+		!(gzfile = gzdopen(rawfd, "rb")))
+	    {
+		if (rawfd >= 0) ::close(rawfd);
+		rawfd = -1;
 		throw Error(*this, "can't gzopen: %s", strerror(errno));
 	    }
 # ifdef HAVE_PTHREAD
@@ -97,9 +105,22 @@ InFile::InFile(const char *filename, size_t classsize) :
 	if (!(file = fopen(name, "r"))) {
 	    throw Error(*this, "can't open: %s", strerror(errno));
 	}
+	rawfd = fileno(file);
     }
 }
 
+long long InFile::position() const
+{
+    return rawfd < 0 ? -1 : (long long)lseek(rawfd, 0, SEEK_CUR);
+}
+
+long long InFile::size() const
+{
+    struct stat st;
+    return (rawfd < 0 ? stat(name, &st) : fstat(rawfd, &st)) < 0 ? -1 :
+	(long long)st.st_size;
+}
+
 char *InFile::gets(char *buf, unsigned len)
 {
     char *result = 0;
@@ -139,6 +160,29 @@ size_t InFile::read(void *buf, size_t size, size_t nmemb)
     return n_items;
 }
 
+long long InFile::skip(long long n)
+{
+    char buf[8192];
+    if (file && !isPipe && n > 8 * (long long)sizeof(buf)) {
+	// seek, but not past the end, so the caller sees a truncated file
+	long long pos = ftello(file), sz = size();
+	if (pos >= 0 && sz >= 0) {
+	    long long m = std::min(n, sz - pos);
+	    if (m >= 0 && fseeko(file, m, SEEK_CUR) == 0)
+		return m;
+	}
+    }
+    // short, or can't seek; read and discard
+    long long skipped = 0;
+    while (skipped < n) {
+	size_t len = size_t(std::min(n - skipped, (long long)sizeof(buf)));
+	size_t got = read(buf, 1, len);
+	skipped += got;
+	if (got < len) break;
+    }
+    return skipped;
+}
+
 #if defined(HAVE_LIBZ) && defined(HAVE_PTHREAD)
 void *InFile::run_gzreader(void *arg)
 {
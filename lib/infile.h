@@ -37,6 +37,7 @@ class InFile {
     const char *pipeName;
     char *tmp;
     FILE *file;
+    int rawfd;			// fd of the (possibly compressed) file, or -1
     long _linenum;
 #ifdef HAVE_LIBZ
     gzFile gzfile;
@@ -63,7 +64,14 @@ public:
     }
     char *gets(char *buf, unsigned len);
     size_t read(void *buf, size_t size, size_t nmemb);
+    // Skip n bytes of (uncompressed) input; returns the number skipped,
+    // which is less than n only at end of file.
+    long long skip(long long n);
     long linenum() const { return _linenum; }
+    // Number of bytes of the underlying (possibly compressed) file consumed
+    // so far, and its total size; -1 if unknown (e.g., bzip2 pipe).
+    long long position() const;
+    long long size() const;
     int fd() throw();
     void close();
     class Error : public std::runtime_error {
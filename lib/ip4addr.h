@@ -56,7 +56,7 @@ public:
     }
 };
 
-static std::ostream& operator<< (std::ostream& out, const ip4addr_t & addr) {
+static inline std::ostream& operator<< (std::ostream& out, const ip4addr_t & addr) {
     struct in_addr inaddr;
     inaddr.s_addr = htonl(addr);
     out << inet_ntoa(inaddr);
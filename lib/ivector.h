@@ -105,6 +105,8 @@ public:
     }
     // destructor
     ~ivector() {
+	if (_size > locCapacity() && dynCapacity == 0)
+	    return; // was free(true)'d; nothing to release
 	destroy_contents();
 	if (_size > locCapacity())
 	    Alloc().deallocate(dynStart, dynCapacity);
@@ -157,6 +159,31 @@ public:
 	copy_contents_backward(ptr(offset), ptr(oldsize), ptr(offset + stop - start));
 	copy_contents_backward(start, stop, ptr(offset));
     }
+    // Replace the contents with a copy of [first, last), allocating exactly
+    // the needed capacity.
+    void assign(const T *first, const T *last) {
+	free();
+	I n = I(last - first);
+	T *start = locStart();
+	if (n > locCapacity()) {
+	    start = dynStart = Alloc().allocate(n);
+	    dynCapacity = n;
+	}
+	_size = n;
+	for (I i = 0; i < n; ++i) Alloc().construct(start + i, first[i]);
+    }
+    // Move the contents to a freshly allocated block of exactly the needed
+    // capacity, e.g. to pack vectors into the order in which they will be
+    // used.
+    void relocate() {
+	if (_size <= locCapacity() || dynCapacity == 0)
+	    return; // local or free(true)'d
+	T *newstart = Alloc().allocate(_size);
+	copy_contents_backward(dynStart, dynStart + _size, newstart);
+	Alloc().deallocate(dynStart, dynCapacity);
+	dynStart = newstart;
+	dynCapacity = _size;
+    }
     //iterator erase(iterator pos) {
     //    Alloc().destroy(pos, 1);
     //    copy_contents(pos+1, ptr(_size), pos);
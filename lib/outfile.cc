@@ -0,0 +1,249 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * file writer
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#include "config.h"
+#include "outfile.h"
+
+OutBuf::Octet OutBuf::octets[256];
+
+struct OctetInit {
+    OctetInit() {
+	for (int i = 0; i < 256; ++i) {
+	    OutBuf::Octet &o = OutBuf::octets[i];
+	    o.len = uint8_t(sprintf(o.s, "%d", i));
+	    o.s[o.len] = '.';
+	}
+    }
+} octetInit;
+
+void OutBuf::grow(size_t n)
+{
+    size_t newcap = cap ? cap * 2 : 4096;
+    while (newcap < len + n) newcap *= 2;
+    char *p = static_cast<char*>(::realloc(buf, newcap));
+    if (!p) throw std::bad_alloc();
+    buf = p;
+    cap = newcap;
+}
+
+OutFile::OutFile() : _name(), fd(-1), pending(), error()
+#ifdef HAVE_LIBZ
+    , gzfile(0)
+#endif
+#ifdef HAVE_PTHREAD
+    , threaded(false)
+#endif
+{
+}
+
+void OutFile::open(const std::string &filename, bool compress)
+{
+    close();
+    _name = filename;
+    error.clear();
+#ifndef HAVE_LIBZ
+    if (compress)
+	throw std::runtime_error("can't write " + _name +
+	    ": compression support was not enabled at compile time");
+#endif
+    fd = ::open(_name.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+    if (fd < 0)
+	throw std::runtime_error("can't open " + _name + ": " + strerror(errno));
+#ifdef HAVE_LIBZ
+    if (compress) {
+	if (!(gzfile = gzdopen(fd, "wb"))) {
+	    ::close(fd);
+	    fd = -1;
+	    throw std::runtime_error("can't open " + _name + ": gzdopen failed");
+	}
+	gzbuffer(gzfile, CHUNKSIZE);
+    }
+#endif
+#ifdef HAVE_PTHREAD
+    qhead = qlen = 0;
+    closing = false;
+    pthread_mutex_init(&mutex, 0);
+    pthread_cond_init(&cond, 0);
+    // If the thread can't be created, we just write in the calling thread.
+    threaded = (pthread_create(&pthread, 0, run_writer, this) == 0);
+    if (!threaded) {
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+    }
+#endif
+}
+
+// Write a chunk to the file (in the writer thread, if there is one).
+void OutFile::writeChunk(const OutBuf &chunk)
+{
+    if (!error.empty()) return; // discard data after an error
+    const char *p = chunk.data();
+    size_t n = chunk.size();
+#ifdef HAVE_LIBZ
+    if (gzfile) {
+	while (n > 0) {
+	    unsigned len = n > CHUNKSIZE ? unsigned(CHUNKSIZE) : unsigned(n);
+	    int r = gzwrite(gzfile, p, len);
+	    if (r <= 0) {
+		int errnum;
+		const char *msg = gzerror(gzfile, &errnum);
+		error = "error writing " + _name + ": " +
+		    (errnum == Z_ERRNO ? strerror(errno) : msg);
+		return;
+	    }
+	    p += r;
+	    n -= size_t(r);
+	}
+	return;
+    }
+#endif
+    while (n > 0) {
+	ssize_t r = ::write(fd, p, n);
+	if (r < 0) {
+	    if (errno == EINTR) continue;
+	    error = "error writing " + _name + ": " + strerror(errno);
+	    return;
+	}
+	p += r;
+	n -= size_t(r);
+    }
+}
+
+#ifdef HAVE_PTHREAD
+void *OutFile::run_writer(void *arg)
+{
+    OutFile *out = static_cast<OutFile*>(arg);
+    OutBuf chunk;
+    while (true) {
+	pthread_mutex_lock(&out->mutex);
+	while (out->qlen == 0 && !out->closing)
+	    pthread_cond_wait(&out->cond, &out->mutex);
+	if (out->qlen == 0) { // closing, and nothing left to write
+	    pthread_mutex_unlock(&out->mutex);
+	    break;
+	}
+	chunk.swap(out->queue[out->qhead]);
+	out->qhead = (out->qhead + 1) % MAXQUEUE;
+	out->qlen--;
+	pthread_cond_broadcast(&out->cond);
+	pthread_mutex_unlock(&out->mutex);
+	out->writeChunk(chunk);
+	chunk.clear();
+    }
+    return 0;
+}
+#endif
+
+// Hand the pending data to the writer.
+void OutFile::flushPending()
+{
+    if (pending.empty()) return;
+#ifdef HAVE_PTHREAD
+    if (!threaded) {
+	writeChunk(pending);
+	pending.clear();
+	return;
+    }
+    pthread_mutex_lock(&mutex);
+    while (qlen == MAXQUEUE)
+	pthread_cond_wait(&cond, &mutex);
+    OutBuf &slot = queue[(qhead + qlen) % MAXQUEUE];
+    slot.swap(pending); // pending gets slot's old (empty) buffer
+    qlen++;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+#else
+    writeChunk(pending);
+#endif
+    pending.clear();
+}
+
+void OutFile::write(const char *s, size_t n)
+{
+    if (fd < 0)
+	throw std::runtime_error("write to unopened file " + _name);
+    pending.put(s, n);
+    if (pending.size() >= CHUNKSIZE)
+	flushPending();
+}
+
+void OutFile::write(OutBuf &buf)
+{
+    if (fd < 0)
+	throw std::runtime_error("write to unopened file " + _name);
+    if (buf.size() >= CHUNKSIZE) {
+	flushPending();
+	pending.swap(buf);
+	flushPending();
+    } else {
+	pending.put(buf.data(), buf.size());
+	if (pending.size() >= CHUNKSIZE)
+	    flushPending();
+    }
+    buf.clear();
+}
+
+void OutFile::checkError()
+{
+    if (!error.empty())
+	throw std::runtime_error(error);
+}
+
+void OutFile::close()
+{
+    if (fd < 0) return;
+    flushPending();
+#ifdef HAVE_PTHREAD
+    if (threaded) {
+	pthread_mutex_lock(&mutex);
+	closing = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+	pthread_join(pthread, 0);
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+	threaded = false;
+    }
+#endif
+#ifdef HAVE_LIBZ
+    if (gzfile) {
+	int r = gzclose(gzfile);
+	gzfile = 0;
+	if (r != Z_OK && error.empty())
+	    error = "error closing " + _name;
+    } else
+#endif
+    if (::close(fd) < 0 && error.empty())
+	error = "error closing " + _name + ": " + strerror(errno);
+    fd = -1;
+    pending.clear();
+    checkError();
+}
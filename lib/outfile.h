@@ -0,0 +1,140 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Fast output of large text files.  OutBuf is a growable character buffer
+ * with cheap formatting of strings, integers, and IPv4 addresses.  OutFile
+ * writes OutBufs to a regular or gzipped file; with pthreads, the actual
+ * writing (and compression) is done in a separate thread.
+ */
+
+#ifndef OUTFILE_H
+#define OUTFILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#ifdef HAVE_LIBZ
+# include <zlib.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+class OutBuf {
+    char *buf;
+    size_t len, cap;
+    struct Octet { char s[4]; uint8_t len; };
+    static Octet octets[256]; // text of each octet value, followed by '.'
+    friend struct OctetInit;
+    OutBuf(const OutBuf&); // no copying
+    OutBuf &operator=(const OutBuf&);
+    void grow(size_t n);
+public:
+    OutBuf() : buf(0), len(0), cap(0) {}
+    ~OutBuf() { ::free(buf); }
+    const char *data() const { return buf; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    void clear() { len = 0; }
+    void swap(OutBuf &that) {
+	std::swap(buf, that.buf); std::swap(len, that.len);
+	std::swap(cap, that.cap);
+    }
+    // Return a pointer to at least n bytes of free space at the end of the
+    // buffer; the caller may then commit some of them with advance().
+    char *reserve(size_t n) {
+	if (len + n > cap) grow(n);
+	return buf + len;
+    }
+    void advance(size_t n) { len += n; }
+    OutBuf &put(char c) { *reserve(1) = c; ++len; return *this; }
+    OutBuf &put(const char *s, size_t n) {
+	memcpy(reserve(n), s, n); len += n; return *this;
+    }
+    OutBuf &put(const char *s) { return put(s, strlen(s)); }
+    OutBuf &put(const std::string &s) { return put(s.data(), s.size()); }
+    OutBuf &put(uint32_t n) {
+	char tmp[10];
+	char *p = tmp + sizeof(tmp);
+	do { *--p = char('0' + n % 10); n /= 10; } while (n);
+	return put(p, size_t(tmp + sizeof(tmp) - p));
+    }
+    // Dotted quad of an IPv4 address in host byte order.  Each octet is
+    // copied as 4 bytes from a table and the write pointer advanced by its
+    // length, so there are no data-dependent branches.
+    OutBuf &putAddr(uint32_t addr) {
+	char *p = reserve(16), *start = p;
+	const Octet *o;
+	o = &octets[addr >> 24];         memcpy(p, o->s, 4); p += o->len + 1;
+	o = &octets[(addr >> 16) & 255]; memcpy(p, o->s, 4); p += o->len + 1;
+	o = &octets[(addr >> 8) & 255];  memcpy(p, o->s, 4); p += o->len + 1;
+	o = &octets[addr & 255];         memcpy(p, o->s, 4); p += o->len;
+	len += size_t(p - start);
+	return *this;
+    }
+};
+
+class OutFile {
+    std::string _name;
+    int fd;
+    OutBuf pending;		// data not yet handed to the writer
+    std::string error;		// first error encountered by the writer
+#ifdef HAVE_LIBZ
+    gzFile gzfile;
+#endif
+#ifdef HAVE_PTHREAD
+    enum { MAXQUEUE = 4 };	// max chunks waiting for the writer thread
+    OutBuf queue[MAXQUEUE];
+    int qhead, qlen;
+    bool closing;
+    bool threaded;		// is the writer thread running?
+    pthread_t pthread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    static void *run_writer(void *arg);
+#endif
+    void flushPending();
+    void writeChunk(const OutBuf &chunk);
+    void checkError();
+    OutFile(const OutFile&); // no copying
+    OutFile &operator=(const OutFile&);
+public:
+    static const size_t CHUNKSIZE = 1 << 20;
+    OutFile();
+    // You should always call .close() explicitly and catch its exceptions.
+    // The dtor closes implicitly if needed, but does not throw exceptions.
+    ~OutFile() {
+	try { close(); } catch (...) { /* throwing from dtor is unsafe */ }
+    }
+    // Open filename for writing; if compress, the data will be gzipped.
+    void open(const std::string &filename, bool compress = false);
+    bool is_open() const { return fd >= 0; }
+    const std::string &name() const { return _name; }
+    void write(const char *s, size_t n);
+    void write(const std::string &s) { write(s.data(), s.size()); }
+    // Write the contents of buf, and clear it.  Large buffers are handed to
+    // the writer without copying.
+    void write(OutBuf &buf);
+    void close();
+};
+
+#endif // OUTFILE_H
@@ -0,0 +1,64 @@
+#! /usr/bin/env perl
+# usage: alias-score.pl truthfile aliasfile
+# Compare inferred alias sets to true alias sets (both in "node N<n>: <addr>..."
+# form, as written by topo-gen and kapar -oa), and print pairwise precision
+# and recall.  Anonymous (224/4) addresses are ignored.  Recall is measured
+# only over true alias pairs whose addresses both appear in aliasfile.
+
+use strict;
+
+if (scalar @ARGV != 2) {
+    print STDERR "usage: alias-score.pl truthfile aliasfile\n";
+    print STDERR "prints pairwise precision and recall of inferred aliases\n";
+    exit 1;
+}
+
+my ($truthfile, $aliasfile) = @ARGV;
+
+sub readSets($) {
+    my ($file) = @_;
+    my @sets;
+    open IN, "<", $file or die "$file: $!\n";
+    while (<IN>) {
+	next unless (/^node N\d+:\s+/);
+	my @set = grep { !/^(22[4-9]|2[3-5]\d)\./ } split(/\s+/, $');
+	push @sets, \@set;
+    }
+    close IN;
+    return @sets;
+}
+
+sub pairs($) { my ($n) = @_; return $n * ($n - 1) / 2; }
+
+# address -> true router
+my %router;
+my $i = 0;
+for my $set (readSets($truthfile)) {
+    $router{$_} = $i for (@$set);
+    $i++;
+}
+
+my $inferred = 0;	# inferred pairs
+my $correct = 0;	# inferred pairs that are true
+my %seen;		# number of observed addresses of each true router
+for my $set (readSets($aliasfile)) {
+    my %count;		# number of addresses of each true router in set
+    for my $addr (@$set) {
+	# addresses that are not router interfaces (e.g., destinations) can
+	# only contribute incorrect pairs
+	next unless (defined $router{$addr});
+	$count{$router{$addr}}++;
+	$seen{$router{$addr}}++;
+    }
+    $inferred += pairs(scalar @$set);
+    $correct += pairs($_) for (values %count);
+}
+
+my $true = 0;		# true pairs among observed addresses
+$true += pairs($_) for (values %seen);
+
+printf "inferred_pairs %d\n", $inferred;
+printf "true_pairs %d\n", $true;
+printf "correct_pairs %d\n", $correct;
+printf "precision %.4f\n", $inferred ? $correct / $inferred : 1;
+printf "recall %.4f\n", $true ? $correct / $true : 1;
@@ -0,0 +1,90 @@
+#! /usr/bin/env perl
+# Benchmark kapar on synthetic topologies of several sizes generated by
+# topo-gen, and report run time, peak memory, and alias precision/recall.
+# Output is one tab-separated line per run, preceded by a "#" header line.
+
+use strict;
+use Getopt::Std;
+use File::Basename;
+use Time::HiRes qw(time);
+
+my $dir = dirname($0);
+my %opts = (
+    'k' => "$dir/../kapar/kapar",
+    'g' => "$dir/topo-gen",
+    'r' => "1000,10000,100000",
+    't' => 20,
+    'f' => "ti",
+    'w' => "bench-work",
+);
+
+sub usage() {
+    print STDERR "usage: $0 [options] [-- <kapar options>]\n";
+    print STDERR "-k <kapar>     kapar executable (default: $opts{k})\n";
+    print STDERR "-g <topo-gen>  topo-gen executable (default: $opts{g})\n";
+    print STDERR "-r <n>,...     numbers of routers (default: $opts{r})\n";
+    print STDERR "-t <n>         traced destinations per router (default: $opts{t})\n";
+    print STDERR "-f <formats>   trace formats to test: t (text), i (iPlane) (default: $opts{f})\n";
+    print STDERR "-s <seed>      random seed for topo-gen (default: 1)\n";
+    print STDERR "-w <dir>       directory for generated files (default: $opts{w})\n";
+    exit 1;
+}
+
+getopts('k:g:r:t:f:s:w:', \%opts) or usage();
+my @kaparopts = @ARGV;
+my $seed = $opts{s} || 1;
+mkdir $opts{w} unless (-d $opts{w});
+-x $opts{k} or die "$opts{k}: not executable\n";
+-x $opts{g} or die "$opts{g}: not executable\n";
+
+sub run(@) {
+    system(@_) == 0 or die "command failed: @_\n";
+}
+
+# read the totals of the final phase of a kapar .perf.json report
+sub readPerf($) {
+    my ($file) = @_;
+    my ($wall, $rss);
+    open IN, "<", $file or die "$file: $!\n";
+    while (<IN>) {
+	$wall = $1 if (/"total_wall_ms": ([\d.]+)/);
+	$rss = $1 if (/"peak_rss_kb": (\d+)/);
+    }
+    close IN;
+    return ($wall, $rss);
+}
+
+sub score($$) {
+    my ($truth, $aliases) = @_;
+    my %score;
+    open SCORE, "-|", "$dir/alias-score.pl", $truth, $aliases
+	or die "alias-score.pl: $!\n";
+    while (<SCORE>) {
+	$score{$1} = $2 if (/^(\S+) (\S+)$/);
+    }
+    close SCORE or die "alias-score.pl failed\n";
+    return %score;
+}
+
+print join("\t", "# routers", qw(dests format wall_sec peak_rss_mb
+    precision recall inferred_pairs true_pairs)), "\n";
+for my $n (split(/,/, $opts{r})) {
+    my $base = "$opts{w}/r$n";
+    my $dests = $n * $opts{t};
+    run($opts{g}, "-s", $seed, "-r", $n, "-t", $dests, "-f", $opts{f},
+	"-o", $base);
+    for my $fmt (split(//, $opts{f})) {
+	my $input = $fmt eq 't' ? "$base.txt" : "$opts{w}/trace.out.r$n";
+	my $out = "$base-$fmt";
+	my $start = time();
+	run("$opts{k} -oa -O $out @kaparopts -P $input >$out.log 2>&1");
+	my $elapsed = time() - $start;
+	my ($wall, $rss) = readPerf("$out.perf.json");
+	$wall = defined $wall ? $wall / 1000 : $elapsed;
+	my %s = score("$base.truth", "$out.aliases");
+	printf "%d\t%d\t%s\t%.3f\t%.1f\t%s\t%s\t%s\t%s\n", $n, $dests,
+	    $fmt eq 't' ? "text" : "iplane", $wall,
+	    defined $rss ? $rss / 1024 : 0, $s{precision}, $s{recall},
+	    $s{inferred_pairs}, $s{true_pairs};
+    }
+}
@@ -0,0 +1,458 @@
+/* 
+ * Copyright (C) 2011-2018 The Regents of the University of California.
+ * 
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Generate a random router-level topology and simulated traceroutes over it,
+ * for testing and benchmarking kapar against a known ground truth.
+ *
+ * Routers are connected by a preferential-attachment tree plus extra random
+ * edges.  Each edge is a point-to-point /30 or /31 subnet; in addition, some
+ * sets of routers share a multi-access /24-/29 LAN.  Destinations are hosts
+ * in /24 stub prefixes attached to random routers.  Traces follow random
+ * shortest paths from monitors; a hop reports the address of the interface
+ * on which the probe arrived.  Traces may have anonymous hops (silent
+ * routers and lost responses), per-packet load balancing (different probes
+ * of a hop take different equal-cost paths), and responses from the
+ * destination.  Each path taken by the probes to a destination is written
+ * as a separate trace, with the same hops in every format.
+ *
+ * Output files:
+ *   <base>.txt            traces in kapar's text path format ("# trace"
+ *                         header followed by one line per hop)
+ *   trace.out.<base>      traces in iPlane format
+ *   <base>.truth          the true alias sets, one "node N<n>:" line per
+ *                         router, in the same format as kapar's .aliases
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+
+using namespace std;
+
+struct Adj {
+    uint32_t nbr;	// index of neighbor router
+    uint32_t addr;	// this router's address on the subnet shared with nbr
+};
+
+struct Router {
+    vector<uint32_t> ifaces;	// addresses
+    vector<Adj> adj;
+    bool silent;		// never responds to traceroute
+};
+
+struct Dest {
+    uint32_t router;	// router to which the destination's prefix is attached
+    uint32_t addr;
+};
+
+static int cfg_routers = 1000;
+static int cfg_traces = 10000;
+static int cfg_monitors = 10;
+static int cfg_probes = 3;		// probes per hop
+static double cfg_extra_edges = 0.5;	// extra edges per router
+static double cfg_slash31 = 0.3;	// fraction of p2p links that are /31
+static double cfg_lans = 0.05;		// LANs per router
+static double cfg_silent = 0.02;	// fraction of routers that are silent
+static double cfg_loss = 0.02;		// probability of a lost response
+static double cfg_perpacket = 0.1;	// fraction of traces with per-packet LB
+static double cfg_dstreply = 0.7;	// probability that destination replies
+static const char *cfg_base = "synth";
+static const char *cfg_formats = "ti";
+
+static vector<Router> routers;
+static vector<Dest> dests;
+static uint32_t nextAddr = 20 << 24;
+static const uint32_t maxAddr = 100u << 24; // stay below 100.64/10, etc.
+
+static double frand() { return random() / 2147483648.0; }
+static uint32_t irand(uint32_t n) { return uint32_t(frand() * n); }
+
+static string addrstr(uint32_t addr)
+{
+    char buf[16];
+    sprintf(buf, "%u.%u.%u.%u", addr >> 24, (addr >> 16) & 255,
+	(addr >> 8) & 255, addr & 255);
+    return buf;
+}
+
+// allocate an aligned block of size addresses
+static uint32_t alloc(uint32_t size)
+{
+    uint32_t block = (nextAddr + size - 1) & ~(size - 1);
+    if (block >= maxAddr || maxAddr - block < size) {
+	cerr << "error: out of address space; use fewer routers" << endl;
+	exit(1);
+    }
+    nextAddr = block + size;
+    return block;
+}
+
+static void addIface(uint32_t r, uint32_t addr)
+{
+    routers[r].ifaces.push_back(addr);
+}
+
+static void addP2P(uint32_t a, uint32_t b)
+{
+    uint32_t ia, ib;
+    if (frand() < cfg_slash31) {
+	uint32_t p = alloc(2);
+	ia = p; ib = p + 1;
+    } else {
+	uint32_t p = alloc(4);
+	ia = p + 1; ib = p + 2;
+    }
+    addIface(a, ia);
+    addIface(b, ib);
+    Adj adja = { b, ia }, adjb = { a, ib };
+    routers[a].adj.push_back(adja);
+    routers[b].adj.push_back(adjb);
+}
+
+static void addLAN()
+{
+    int len = 24 + int(irand(6));		// /24 - /29
+    uint32_t size = 1u << (32 - len);
+    uint32_t maxk = min(size - 2, 16u);
+    uint32_t k = 3 + irand(maxk - 2);		// 3 - maxk members
+    if (k > routers.size()) return;
+    vector<uint32_t> members;
+    while (members.size() < k) {
+	uint32_t r = irand(uint32_t(routers.size()));
+	if (find(members.begin(), members.end(), r) == members.end())
+	    members.push_back(r);
+    }
+    // hosts are numbered from the bottom of the subnet, as is common
+    uint32_t prefix = alloc(size);
+    for (uint32_t i = 0; i < k; ++i) {
+	uint32_t addr = prefix + 1 + i;
+	addIface(members[i], addr);
+	for (uint32_t j = 0; j < k; ++j) {
+	    if (j == i) continue;
+	    Adj adj = { members[j], addr };
+	    routers[members[i]].adj.push_back(adj);
+	}
+    }
+}
+
+static void makeTopology()
+{
+    routers.resize(size_t(cfg_routers));
+    // Preferential attachment:  picking a random endpoint of an existing
+    // edge picks a router with probability proportional to its degree.
+    vector<uint32_t> ends;
+    for (uint32_t r = 1; r < routers.size(); ++r) {
+	uint32_t t = ends.empty() ? 0 : ends[irand(uint32_t(ends.size()))];
+	addP2P(r, t);
+	ends.push_back(r);
+	ends.push_back(t);
+    }
+    int n_extra = int(cfg_extra_edges * cfg_routers);
+    for (int i = 0; i < n_extra; ++i) {
+	uint32_t a = irand(uint32_t(routers.size()));
+	uint32_t b = ends[irand(uint32_t(ends.size()))];
+	if (a != b) addP2P(a, b);
+    }
+    int n_lans = int(cfg_lans * cfg_routers + 0.5);
+    for (int i = 0; i < n_lans; ++i)
+	addLAN();
+    for (size_t r = 0; r < routers.size(); ++r)
+	routers[r].silent = frand() < cfg_silent;
+
+    int n_stubs = cfg_routers;
+    for (int i = 0; i < n_stubs; ++i) {
+	uint32_t r = irand(uint32_t(routers.size()));
+	uint32_t prefix = alloc(256);
+	for (int j = 0; j < 2; ++j) {
+	    Dest d = { r, prefix + 1 + irand(254) };
+	    dests.push_back(d);
+	}
+    }
+}
+
+// hop distance of every router from src
+static void bfs(uint32_t src, vector<int> &dist)
+{
+    dist.assign(routers.size(), -1);
+    deque<uint32_t> queue;
+    dist[src] = 0;
+    queue.push_back(src);
+    while (!queue.empty()) {
+	uint32_t u = queue.front();
+	queue.pop_front();
+	const vector<Adj> &adj = routers[u].adj;
+	for (size_t i = 0; i < adj.size(); ++i) {
+	    if (dist[adj[i].nbr] < 0) {
+		dist[adj[i].nbr] = dist[u] + 1;
+		queue.push_back(adj[i].nbr);
+	    }
+	}
+    }
+}
+
+// A hop of a path:  the router, and the address of the interface on which
+// the probe arrived.
+struct Hop {
+    uint32_t router;
+    uint32_t addr;
+};
+
+// A random shortest path from the monitor to router d (path[i] is hop i+1).
+static void randomPath(const vector<int> &dist, uint32_t d, vector<Hop> &path)
+{
+    path.resize(size_t(dist[d]));
+    vector<const Adj*> cand;
+    for (uint32_t v = d; dist[v] > 0; ) {
+	// equal-cost upstream neighbors
+	cand.clear();
+	const vector<Adj> &adj = routers[v].adj;
+	for (size_t i = 0; i < adj.size(); ++i) {
+	    if (dist[adj[i].nbr] == dist[v] - 1)
+		cand.push_back(&adj[i]);
+	}
+	const Adj *a = cand[irand(uint32_t(cand.size()))];
+	Hop &hop = path[size_t(dist[v] - 1)];
+	hop.router = v;
+	hop.addr = a->addr;
+	v = a->nbr;
+    }
+}
+
+// Address of the response to one probe of hop, or 0 if there is none.
+static uint32_t response(const Hop &hop)
+{
+    if (routers[hop.router].silent || frand() < cfg_loss)
+	return 0;
+    return hop.addr;
+}
+
+static FILE *openOut(const string &name)
+{
+    FILE *f = fopen(name.c_str(), "w");
+    if (!f) {
+	cerr << "error: can't open " << name << ": " << strerror(errno) << endl;
+	exit(1);
+    }
+    return f;
+}
+
+static void closeOut(FILE *f, const string &name)
+{
+    if (ferror(f) | fclose(f)) {
+	cerr << "error writing " << name << ": " << strerror(errno) << endl;
+	exit(1);
+    }
+}
+
+template<class T> static void append(vector<char> &data, const T &value)
+{
+    const char *p = reinterpret_cast<const char*>(&value);
+    data.insert(data.end(), p, p + sizeof(T));
+}
+
+// iPlane record:  clientId, uniqueId, number of traces, length of data,
+// then for each trace:  destination, number of hops, and for each hop:
+// address, rtt, ttl.
+static void appendIplaneHop(vector<char> &data, uint32_t addr, float rtt,
+    int ttl)
+{
+    append(data, htonl(addr));
+    append(data, rtt);
+    append(data, ttl);
+}
+
+static void writeIplaneRecord(FILE *f, int client, int n_traces,
+    const vector<char> &data)
+{
+    int hdr[4] = { client, 0, n_traces, int(data.size()) };
+    fwrite(hdr, sizeof(hdr), 1, f);
+    if (!data.empty())
+	fwrite(&data[0], data.size(), 1, f);
+}
+
+// Returns the number of traces written.
+static int makeTraces()
+{
+    string txtname = string(cfg_base) + ".txt";
+    string ipname = cfg_base;
+    size_t slash = ipname.rfind('/');
+    ipname.insert(slash == string::npos ? 0 : slash + 1, "trace.out.");
+    FILE *txt = strchr(cfg_formats, 't') ? openOut(txtname) : 0;
+    FILE *ipl = strchr(cfg_formats, 'i') ? openOut(ipname) : 0;
+
+    vector<uint32_t> monitors;
+    while (monitors.size() < size_t(cfg_monitors) &&
+	monitors.size() < routers.size())
+    {
+	uint32_t r = irand(uint32_t(routers.size()));
+	if (find(monitors.begin(), monitors.end(), r) == monitors.end())
+	    monitors.push_back(r);
+    }
+
+    vector<int> dist;
+    vector<vector<Hop> > paths(static_cast<size_t>(cfg_probes));
+    vector<char> ipdata;
+    int n_trace = 0;
+    for (size_t m = 0; m < monitors.size(); ++m) {
+	bfs(monitors[m], dist);
+	uint32_t src = routers[monitors[m]].ifaces[0];
+	int n = cfg_traces / int(monitors.size()) +
+	    (int(m) < cfg_traces % int(monitors.size()) ? 1 : 0);
+	int n_iptraces = 0;
+	ipdata.clear();
+	for (int t = 0; t < n; ) {
+	    const Dest &dst = dests[irand(uint32_t(dests.size()))];
+	    if (dst.router == monitors[m]) continue;
+	    ++t;
+	    // With per-flow load balancing, all probes of a hop follow one
+	    // path; with per-packet load balancing, each probe may take a
+	    // different one.  Each path becomes a trace of its own, so the
+	    // text and iPlane traces contain the same responses.
+	    int n_paths = frand() < cfg_perpacket ? cfg_probes : 1;
+	    int n_probes = cfg_probes / n_paths; // probes per hop of each path
+	    for (int p = 0; p < n_paths; ++p)
+		randomPath(dist, dst.router, paths[size_t(p)]);
+	    bool dstreply = frand() < cfg_dstreply;
+
+	    for (int p = 0; p < n_paths; ++p) {
+		const vector<Hop> &path = paths[size_t(p)];
+		size_t n_hops = path.size();
+		++n_trace;
+		if (txt)
+		    fprintf(txt, "# trace %d: %s -> %s\n", n_trace,
+			addrstr(src).c_str(), addrstr(dst.addr).c_str());
+		if (ipl) {
+		    append(ipdata, htonl(dst.addr));
+		    append(ipdata, int(n_hops + (dstreply ? 1 : 0)));
+		    ++n_iptraces;
+		}
+		float rtt = 0;
+		for (size_t h = 0; h < n_hops; ++h) {
+		    rtt += float(0.5 + 5 * frand());
+		    uint32_t addr = 0;
+		    for (int k = 0; k < n_probes && !addr; ++k)
+			addr = response(path[h]);
+		    if (txt) fprintf(txt, "%s\n", addrstr(addr).c_str());
+		    if (ipl) appendIplaneHop(ipdata, addr, rtt, int(h + 1));
+		}
+		if (dstreply) {
+		    rtt += float(0.5 + 5 * frand());
+		    if (txt) fprintf(txt, "%s\n", addrstr(dst.addr).c_str());
+		    if (ipl) appendIplaneHop(ipdata, dst.addr, rtt, int(n_hops + 1));
+		}
+	    }
+	}
+	if (ipl) writeIplaneRecord(ipl, int(m), n_iptraces, ipdata);
+    }
+    if (txt) closeOut(txt, txtname);
+    if (ipl) closeOut(ipl, ipname);
+    return n_trace;
+}
+
+static void writeTruth(int argc, char *argv[])
+{
+    string name = string(cfg_base) + ".truth";
+    FILE *f = openOut(name);
+    fprintf(f, "# command line:");
+    for (int i = 0; i < argc; ++i)
+	fprintf(f, " %s", argv[i]);
+    fprintf(f, "\n");
+    for (size_t r = 0; r < routers.size(); ++r) {
+	vector<uint32_t> ifaces(routers[r].ifaces);
+	sort(ifaces.begin(), ifaces.end());
+	fprintf(f, "node N%lu: ", (unsigned long)(r + 1));
+	for (size_t i = 0; i < ifaces.size(); ++i)
+	    fprintf(f, " %s", addrstr(ifaces[i]).c_str());
+	fputc('\n', f);
+    }
+    closeOut(f, name);
+}
+
+static void usageExit(const char *name, int status)
+{
+    cerr << "Usage:" << endl;
+    cerr << name << " [options]" << endl;
+    cerr << "Generate a random router topology and traceroutes over it." << endl;
+    cerr << "-o <base>     basename of output files (default: " << cfg_base << ")" << endl;
+    cerr << "-f <formats>  trace formats:  t (<base>.txt), i (trace.out.<base>)" << endl;
+    cerr << "              (default: " << cfg_formats << ")" << endl;
+    cerr << "-s <seed>     random seed (default: 1)" << endl;
+    cerr << "-r <n>        number of routers (default: " << cfg_routers << ")" << endl;
+    cerr << "-t <n>        number of traced destinations (default: " << cfg_traces << ")" << endl;
+    cerr << "-m <n>        number of monitors (default: " << cfg_monitors << ")" << endl;
+    cerr << "-p <n>        probes per hop (default: " << cfg_probes << ")" << endl;
+    cerr << "-e <x>        extra p2p links per router (default: " << cfg_extra_edges << ")" << endl;
+    cerr << "-w <x>        fraction of p2p links that are /31 (default: " << cfg_slash31 << ")" << endl;
+    cerr << "-l <x>        LANs per router (default: " << cfg_lans << ")" << endl;
+    cerr << "-q <x>        fraction of routers that are silent (default: " << cfg_silent << ")" << endl;
+    cerr << "-a <x>        probability of a lost response (default: " << cfg_loss << ")" << endl;
+    cerr << "-b <x>        fraction of traces with per-packet load balancing (default: " << cfg_perpacket << ")" << endl;
+    cerr << "-d <x>        probability that the destination replies (default: " << cfg_dstreply << ")" << endl;
+    cerr << "Writes the true alias sets to <base>.truth." << endl;
+    exit(status);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    unsigned seed = 1;
+
+    while ((opt = getopt(argc, argv, "o:f:s:r:t:m:p:e:w:l:q:a:b:d:")) != -1) {
+	switch (opt) {
+	case 'o': cfg_base = optarg; break;
+	case 'f': cfg_formats = optarg; break;
+	case 's': seed = unsigned(strtoul(optarg, 0, 10)); break;
+	case 'r': cfg_routers = atoi(optarg); break;
+	case 't': cfg_traces = atoi(optarg); break;
+	case 'm': cfg_monitors = atoi(optarg); break;
+	case 'p': cfg_probes = atoi(optarg); break;
+	case 'e': cfg_extra_edges = atof(optarg); break;
+	case 'w': cfg_slash31 = atof(optarg); break;
+	case 'l': cfg_lans = atof(optarg); break;
+	case 'q': cfg_silent = atof(optarg); break;
+	case 'a': cfg_loss = atof(optarg); break;
+	case 'b': cfg_perpacket = atof(optarg); break;
+	case 'd': cfg_dstreply = atof(optarg); break;
+	default: usageExit(argv[0], 1);
+	}
+    }
+    if (optind != argc || cfg_routers < 2 || cfg_monitors < 1 ||
+	cfg_traces < 0 || cfg_probes < 1)
+	    usageExit(argv[0], 1);
+
+    srandom(seed);
+    makeTopology();
+    writeTruth(argc, argv);
+    int n_traces = makeTraces();
+    cerr << "# " << routers.size() << " routers, " << dests.size() <<
+	" destinations, " << n_traces << " traces to " << cfg_traces <<
+	" destinations" << endl;
+    return 0;
+}